@@ -0,0 +1,15 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <stddef.h>
+
+typedef struct bufferpool *BufferPool;
+
+// Pool of equally sized buffers aligned for O_DIRECT I/O (safe to share between threads)
+int BufferPool_Create(BufferPool*,size_t,size_t);
+void *BufferPool_Get(BufferPool);
+void BufferPool_Put(BufferPool,void*);
+size_t BufferPool_BufferSize(BufferPool);
+int BufferPool_Destroy(BufferPool*);
+
+#endif
@@ -2,6 +2,7 @@
 #define CFS_H
 
 #include <time.h>
+#include <stdint.h>
 
 typedef struct cfs *CFS;
 
@@ -9,6 +10,14 @@ typedef struct cfs *CFS;
 #define DATABLOCK_NUM 5000
 #define FILE_PERMISSIONS 0755
 #define MAX_FILENAME_SIZE 50
+#define MAX_LINKS 16 // Names a file can have besides it's 1st one
+
+// Node allocation policies (cfs_create -alloc first|near)
+#define ALLOCATE_FIRST 0 // 1st hole anywhere in the cfs file
+#define ALLOCATE_NEAR 1 // Hole closest to the parent directory, top level directories spread across allocation groups
+
+// Node ids, sizes and offsets are 64 bit so that cfs files can grow past 4GB
+typedef uint64_t nodeid_t;
 
 // Datastream definition:
 // If entity is directory datablocks are the id's of the entities that the dir contains
@@ -22,20 +31,31 @@ typedef struct {
 typedef struct {
     char deleted; // 1 if the entity was previously deleted and o otherwise
     char root; // 1 if root node and 0 otherwise
+    char snapshot; // 1 if the node is a copy preserved for snapshots and 0 otherwise
     unsigned int links; // number of hard links to that file(must be 0 to be completely deleted)
-    unsigned int nodeid;
+    nodeid_t nodeid;
     char filename[MAX_FILENAME_SIZE];
-    unsigned int size;
+    uint64_t size;
     unsigned int type;
-    unsigned int parent_nodeid;
+    nodeid_t parent_nodeid;
+    nodeid_t link_parents[MAX_LINKS]; // Files only: directories of the names besides the one in parent_nodeid (links of them)
     time_t creation_time;
     time_t accessTime;
     time_t modificationTime;
+    uint64_t subtree_bytes; // Directories only: bytes of the files below them (counted once per name)
+    uint64_t subtree_entries; // Directories only: names below them (. and .. excluded)
+    uint64_t epoch; // Snapshot epoch of the node's last write (copies: 1st snapshot epoch they belong to)
+    uint64_t epoch_end; // Copies only: last snapshot epoch they belong to
+    nodeid_t origin; // Copies only: id of the node they preserve
+    uint64_t sequence; // Log-structured cfs files only: order of the node's versions in the log (0 for slots never written)
     Datastream data;
 } MDS;
 
 int CFS_Init(CFS*);
 int CFS_Run(CFS);
 int CFS_Destroy(CFS*);
+// Builds a cfs file (2nd argument) from a host directory (1st argument) in one sequential pass.
+// The rest of the arguments are the cfs_create parameters (0 MAX_DIRECTORY_FILE_NUMBER for the default).
+int CFS_BuildImage(char*,char*,unsigned int,unsigned int,unsigned int,unsigned int,unsigned int,uint64_t,unsigned int);
 
 #endif
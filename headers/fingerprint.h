@@ -0,0 +1,11 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+// Directory name fingerprints: 1 byte hash per directory entry.
+// A fingerprint of 0 means "unknown" (entries written by older cfs versions) and always matches.
+unsigned char Fingerprint_Compute(const char*);
+// Returns the index of the last fingerprint before end that matches (or is unknown), or count if none does.
+// Directories keep their fingerprints backwards, so going backwards visits the entries in their order.
+unsigned int Fingerprint_FindPrevious(const unsigned char*,unsigned int,unsigned char,unsigned int);
+
+#endif
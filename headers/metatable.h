@@ -0,0 +1,31 @@
+#ifndef METATABLE_H
+#define METATABLE_H
+
+#include <stdint.h>
+
+// State of the rows of deleted (or not yet written) nodes, the rows of live nodes hold the node's type
+#define METATABLE_DELETED 0xFF
+// State of the rows of nodes kept only for snapshots
+#define METATABLE_SNAPSHOT 0xFE
+
+typedef struct metatable *MetaTable;
+
+// Structure of arrays copy of the nodes' metadata, indexed by nodeid and kept in a side file.
+// Every column is a contiguous array so that scans over one attribute read only that attribute.
+// Open reports through it's last argument whether the side file was closed cleanly by the same image
+// (identified by device and inode) or has to be rebuilt by the caller
+int MetaTable_Open(MetaTable*,const char*,uint64_t,uint64_t,int*);
+uint64_t MetaTable_Count(MetaTable);
+int MetaTable_Resize(MetaTable,uint64_t);
+void MetaTable_Set(MetaTable,uint64_t,unsigned char,uint64_t,uint32_t,uint64_t,int64_t,int64_t,int64_t);
+const unsigned char *MetaTable_States(MetaTable);
+const uint64_t *MetaTable_Sizes(MetaTable);
+const uint32_t *MetaTable_Links(MetaTable);
+const uint64_t *MetaTable_Parents(MetaTable);
+const int64_t *MetaTable_CreationTimes(MetaTable);
+const int64_t *MetaTable_AccessTimes(MetaTable);
+const int64_t *MetaTable_ModificationTimes(MetaTable);
+uint64_t MetaTable_FindState(MetaTable,unsigned char,uint64_t);
+int MetaTable_Close(MetaTable*);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Member types of ustar archives (other types are reported as they are)
+#define TAR_FILE '0'
+#define TAR_HARDLINK '1'
+#define TAR_DIRECTORY '5'
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAX_PATH 4096
+
+typedef struct {
+  char type;
+  char name[TAR_MAX_PATH];
+  char linkname[TAR_MAX_PATH]; // Hard links only: member they point to
+  uint64_t size; // Bytes of data following the header
+  time_t mtime;
+} tarEntry;
+
+// Writes a member's header and data (names that do not fit the ustar fields get a pax extended header)
+int Tar_WriteMember(FILE*,const char*,char,unsigned int,time_t,const char*,const char*,uint64_t);
+// Writes the two zero blocks that end an archive
+int Tar_WriteEnd(FILE*);
+// Reads the next member's header (pax and GNU long name headers are applied to the member they precede).
+// Returns 1 for a member, 0 at the end of the archive and -1 if the archive is corrupt.
+// The member's data must then be consumed with Tar_ReadData or Tar_SkipData
+int Tar_ReadMember(FILE*,tarEntry*);
+int Tar_ReadData(FILE*,char*,uint64_t);
+int Tar_SkipData(FILE*,uint64_t);
+// Reads and drops the rest of an archive up to its end (or the end of the stream)
+int Tar_SkipArchive(FILE*);
+
+#endif
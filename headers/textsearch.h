@@ -0,0 +1,9 @@
+#ifndef TEXTSEARCH_H
+#define TEXTSEARCH_H
+
+#include <stddef.h>
+
+// Returns the 1st occurence of needle (of needleLength bytes) in the text, or NULL if there is none
+const char *TextSearch_Find(const char*,size_t,const char*,size_t);
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../headers/bufferpool.h"
+
+typedef struct pnode *PoolNode;
+
+struct bufferpool
+{
+  size_t bufferSize;
+  size_t alignment;
+  PoolNode free;
+  pthread_mutex_t lock; // Buffers may be taken and returned by several threads
+};
+
+// Free buffers are kept in a stack and the stack nodes live inside the buffers themselves
+struct pnode {
+  PoolNode next;
+};
+
+int BufferPool_Create(BufferPool *pool,size_t bufferSize,size_t alignment) {
+  // Allocate memory for the pool
+  if ((*pool = (BufferPool)malloc(sizeof(struct bufferpool))) == NULL) {
+    printf("Not enough memory.\n");
+    return 0;
+  }
+  // Initialize attributes
+  (*pool)->bufferSize = bufferSize < sizeof(struct pnode) ? sizeof(struct pnode) : bufferSize;
+  (*pool)->alignment = alignment < sizeof(void*) ? sizeof(void*) : alignment;
+  (*pool)->free = NULL;
+  pthread_mutex_init(&(*pool)->lock,NULL);
+  return 1;
+}
+
+void *BufferPool_Get(BufferPool pool) {
+  void *buffer;
+  // Reuse a free buffer if there is one
+  pthread_mutex_lock(&pool->lock);
+  if (pool->free != NULL) {
+    buffer = pool->free;
+    pool->free = pool->free->next;
+    pthread_mutex_unlock(&pool->lock);
+    return buffer;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  // Otherwise allocate a new aligned buffer
+  if (posix_memalign(&buffer,pool->alignment,pool->bufferSize) != 0) {
+    printf("Not enough memory.\n");
+    return NULL;
+  }
+  return buffer;
+}
+
+void BufferPool_Put(BufferPool pool,void *buffer) {
+  // Push buffer to the free buffers stack
+  if (buffer != NULL) {
+    PoolNode node = (PoolNode)buffer;
+    pthread_mutex_lock(&pool->lock);
+    node->next = pool->free;
+    pool->free = node;
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+size_t BufferPool_BufferSize(BufferPool pool) {
+  return pool->bufferSize;
+}
+
+int BufferPool_Destroy(BufferPool *pool) {
+  // Check if pool was previously initialized
+  if (*pool != NULL) {
+    // Free all the free buffers
+    PoolNode tmp;
+    while ((*pool)->free != NULL) {
+      tmp = (*pool)->free;
+      (*pool)->free = tmp->next;
+      free(tmp);
+    }
+    pthread_mutex_destroy(&(*pool)->lock);
+    free(*pool);
+    *pool = NULL;
+    return 1;
+  }
+  return 0;
+}
@@ -1,18 +1,31 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <stddef.h>
+#include <limits.h>
 #include <locale.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <fnmatch.h>
+#include <regex.h>
 #include "../headers/cfs.h"
 #include "../headers/string_functions.h"
 #include "../headers/minheap.h"
 #include "../headers/queue.h"
+#include "../headers/fingerprint.h"
+#include "../headers/bufferpool.h"
+#include "../headers/textsearch.h"
+#include "../headers/metatable.h"
+#include "../headers/tar.h"
 
 // Define file types
 #define TYPE_FILE 0
@@ -38,953 +51,4336 @@
 // Define rm option flags
 #define RM_PROMPT 0
 #define RM_RECURSIVE 1
+#define RM_PUNCH 2
+
+// Define import option flags
+#define IMPORT_UPDATE 0
+#define IMPORT_DELETE 1
+
+// Define export option flags
+#define EXPORT_SYNC 0
+#define EXPORT_DELETE 1
+
+// Identifies cfs files and the version of their format
+#define CFS_MAGIC 0x20534643
+#define CFS_VERSION 14
+
+// Node allocation policies (ALLOCATE_FIRST and ALLOCATE_NEAR are in cfs.h)
+#define ALLOCATION_GROUP_SIZE 64 // Nodes per allocation group
+
+// Write modes
+#define WRITE_IN_PLACE 0 // Every node has a fixed location that it's versions overwrite
+#define WRITE_LOG 1 // Every version of a node is appended to a log of slots and an inode map locates the current ones
+
+// Log-structured cfs files: nodes without a version in the log
+#define LOG_UNWRITTEN ((nodeid_t)-1)
+// Log-structured cfs files: slots of the segments that the log fills one at a time and the cleaner frees one at a time
+#define LOG_SEGMENT_SLOTS 256
+// Log-structured cfs files: the cleaner runs in cfs files of at least that many segments
+#define LOG_CLEAN_MIN_SEGMENTS 4
+// Log-structured cfs files: free segments that the cleaner stops at
+#define LOG_CLEAN_FREE_SEGMENTS 4
+
+// Operations recorded in the change log
+#define CHANGE_CREATE 0
+#define CHANGE_MODIFY 1
+#define CHANGE_TOUCH 2
+#define CHANGE_LINK 3
+#define CHANGE_MOVE 4
+#define CHANGE_REMOVE 5
+#define CHANGE_RESET 6 // The tree changed as a whole (cfs_compact renumbered it's nodes or a snapshot was rolled back)
+// Largest change log (in records) that cfs_create -changes accepts
+#define MAX_CHANGE_RECORDS (1 << 24)
+// Records that cfs_changes reads at a time
+#define CHANGE_BATCH 256
+
+// Member files that a striped cfs file can be made of
+#define MAX_STRIPES 16
+
+// Snapshots an image can keep at a time
+#define MAX_SNAPSHOTS 16
+
+// A snapshot sees the nodes last written at or before it's epoch and, for nodes the live tree overwrote
+// since, the copies that were preserved for it
+typedef struct {
+    uint64_t epoch;
+    time_t creation_time;
+    char name[MAX_FILENAME_SIZE];
+} snapshot;
+
+// Superblock definition
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    int BLOCK_SIZE;
+    int FILENAME_SIZE;
+    int MAX_FILE_SIZE;
+    int MAX_DIRECTORY_FILE_NUMBER;
+    unsigned int ALLOCATION_POLICY;
+    unsigned int GROWTH_PERCENT; // The cfs file grows by that percentage of it's reserved nodes (0 for 1 node at a time)
+    uint64_t NODE_COUNT; // Nodes in use (including holes)
+    uint64_t RESERVED_NODES; // Nodes the cfs file has room for (NODE_COUNT and the preallocated ones, log-structured cfs files: slots)
+    uint64_t LIVE_NODES; // Nodes that are not deleted (the rest of NODE_COUNT are holes)
+    uint64_t DIRECTORY_COUNT; // Live directories (including root)
+    uint64_t FILE_BYTES; // Bytes of file data
+    uint64_t HARD_LINKS; // Names of files besides their 1st one
+    uint64_t EPOCH; // Epoch of the live tree (every snapshot takes the current one and a new one starts)
+    uint64_t SNAPSHOT_NODES; // Copies of nodes preserved for the snapshots
+    unsigned int SNAPSHOT_COUNT;
+    snapshot SNAPSHOTS[MAX_SNAPSHOTS]; // Ordered by epoch
+    unsigned int SEALED; // 1 if the cfs file is a read-only image made by cfs_seal
+    unsigned int WRITE_MODE; // WRITE_IN_PLACE or WRITE_LOG (set by cfs_create -write)
+    uint64_t CHANGE_CAPACITY; // Records the change log keeps (0 if there is none, set by cfs_create -changes)
+    uint64_t CHANGE_SEQUENCE; // Sequence number of the last record (records are numbered from 1)
+    uint64_t CHANGE_FIRST; // Oldest sequence number whose record is still kept
+    unsigned int STRIPES; // Member files that the slots are spread across (set by cfs_create -stripe, 0 or 1 for a single file)
+} superblock;
+
+// Record of the change log, a ring of CHANGE_CAPACITY records between the superblock and the nodes where
+// record n is kept in slot (n - 1) % CHANGE_CAPACITY. With BLOCK_SIZE > 1 records do not cross block boundaries.
+typedef struct {
+    uint64_t sequence;
+    unsigned int op;
+    nodeid_t nodeid;
+    nodeid_t parent; // Directory of the name that the operation created, moved to or removed (otherwise the node's parent)
+    char name[MAX_FILENAME_SIZE];
+} changeRecord;
+
+// Header of <file>.imap, the inode map of a log-structured cfs file saved when the cfs file is closed so that it is
+// loaded instead of scanning the log. It is followed by the slot of every node.
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    uint64_t device; // cfs file that the inode map belongs to
+    uint64_t inode;
+    uint64_t nodes;
+    uint64_t segments;
+    uint64_t head;
+    uint64_t sequence;
+    int segmentOpen;
+} logCheckpoint;
 
 // CFS structure definition
 struct cfs {
     int fileDesc; // File descriptor of currently working cfs file
-    char currentFile[MAX_FILENAME_SIZE]; // Name of currently working cfs file
-    int currentDirectoryId; // Nodeid for current directory
+    char currentFile[PATH_MAX]; // Name of currently working cfs file
+    nodeid_t currentDirectoryId; // Nodeid for current directory
     int BLOCK_SIZE;
     int FILENAME_SIZE;
     int MAX_FILE_SIZE;
     int MAX_DIRECTORY_FILE_NUMBER;
+    unsigned int ALLOCATION_POLICY;
+    size_t NODE_SIZE; // Bytes of every node that hold data
+    size_t NODE_STRIDE; // Bytes that every node occupies in the cfs file (NODE_SIZE rounded up to BLOCK_SIZE)
+    off_t CHANGES_OFFSET; // Offset of the change log in the cfs file
+    off_t NODES_OFFSET; // Offset of the 1st node in the cfs file (and in every member of a striped one)
+    unsigned int stripes; // Member files of the cfs file (1 unless it is striped)
+    int memberDesc[MAX_STRIPES]; // File descriptors of the members of a striped cfs file after the 1st one, which is fileDesc
+    int direct; // 1 if the cfs file was opened with O_DIRECT
+    BufferPool buffers; // Block aligned buffers for I/O when BLOCK_SIZE > 1
+    superblock sb; // Working copy of the superblock that keeps the cfs file's counters
+    MetaTable meta; // Columnar copy of the nodes' metadata kept in <file>.meta (NULL if there is none)
+    const char *map; // Read-only mapping of a sealed cfs file (NULL otherwise)
+    size_t mapLength;
+    nodeid_t *logMap; // Inode map of a log-structured cfs file: slot of every node's current version (NULL for in-place cfs files)
+    nodeid_t logMapCapacity;
+    nodeid_t *logSegmentCurrent; // Current versions in every segment (segments without any are free)
+    nodeid_t logSegments;
+    nodeid_t logCurrent; // Slots that hold current versions (the rest are dead or were never written)
+    nodeid_t logHead; // Slot that the next version is written to
+    int logSegmentOpen; // 0 if the head's segment is full and the next version needs a new one
+    uint64_t logSequence; // Sequence number of the last version written
 };
 
-// Superblock definition
+// Block sizes other than 1 (packed nodes) must be powers of 2 in that range
+#define MIN_BLOCK_SIZE 4096
+#define MAX_BLOCK_SIZE 65536
+
+// Layout of cfs files created before the format was versioned (only read by cfs_convert)
+#define LEGACY_FILENAME_SIZE 50
+#define LEGACY_DATABLOCK_NUM 5000
+#define LEGACY_DIRECTORY_ENTRY_SIZE (sizeof(unsigned int) + LEGACY_FILENAME_SIZE*sizeof(char))
+
 typedef struct {
     int BLOCK_SIZE;
     int FILENAME_SIZE;
     int MAX_FILE_SIZE;
     int MAX_DIRECTORY_FILE_NUMBER;
-} superblock;
+} legacySuperblock;
+
+typedef struct {
+    char deleted;
+    char root;
+    unsigned int links;
+    unsigned int nodeid;
+    char filename[LEGACY_FILENAME_SIZE];
+    unsigned int size;
+    unsigned int type;
+    unsigned int parent_nodeid;
+    time_t creation_time;
+    time_t accessTime;
+    time_t modificationTime;
+    char datablocks[LEGACY_DATABLOCK_NUM];
+} legacyMDS;
 
 typedef struct {
     char valid;
     string filenanme;
-    unsigned int nodeid;
+    nodeid_t nodeid;
     unsigned int type;
 } location;
 
-int CFS_Init(CFS *cfs) {
-    // Initialize cfs structure
-    if ((*cfs = malloc(sizeof(struct cfs))) == NULL) {
-        // Not enough memory for cfs structure
-        return 0;
+// Nodes are stored in the cfs file as the metadata followed by only MAX_FILE_SIZE bytes of datablocks.
+// That is a prefix of the MDS structure so every geometry is read and written with a single pread/pwrite
+// straight into an MDS and small file images use proportionally smaller nodes.
+size_t CFS_GeometryNodeSize(unsigned int MAX_FILE_SIZE) {
+    return offsetof(MDS,data) + MAX_FILE_SIZE;
+}
+
+int CFS_ValidBlockSize(unsigned int BLOCK_SIZE) {
+    return BLOCK_SIZE == 1 || (BLOCK_SIZE >= MIN_BLOCK_SIZE && BLOCK_SIZE <= MAX_BLOCK_SIZE && (BLOCK_SIZE & (BLOCK_SIZE - 1)) == 0);
+}
+
+// Change log records that a block holds
+uint64_t CFS_ChangesPerBlock(CFS cfs) {
+    return cfs->BLOCK_SIZE > 1 ? cfs->BLOCK_SIZE/sizeof(changeRecord) : 1;
+}
+
+// Loads the cfs file's parameters from it's superblock
+// With BLOCK_SIZE 1 the change log and the nodes are packed right after the superblock, otherwise the superblock
+// takes the 1st block, the change log whole blocks after it and every node starts at a block boundary and occupies whole blocks
+int CFS_SetGeometry(CFS cfs,superblock *sb) {
+    cfs->sb = *sb;
+    cfs->BLOCK_SIZE = sb->BLOCK_SIZE;
+    cfs->FILENAME_SIZE = sb->FILENAME_SIZE;
+    cfs->MAX_DIRECTORY_FILE_NUMBER = sb->MAX_DIRECTORY_FILE_NUMBER;
+    cfs->MAX_FILE_SIZE = sb->MAX_FILE_SIZE;
+    cfs->ALLOCATION_POLICY = sb->ALLOCATION_POLICY;
+    cfs->NODE_SIZE = CFS_GeometryNodeSize(sb->MAX_FILE_SIZE);
+    cfs->buffers = NULL;
+    cfs->stripes = sb->STRIPES > 1 ? sb->STRIPES : 1;
+    unsigned int member;
+    for (member = 0; member < MAX_STRIPES; member++)
+        cfs->memberDesc[member] = -1;
+    if (sb->BLOCK_SIZE == 1) {
+        cfs->NODE_STRIDE = cfs->NODE_SIZE;
+        cfs->CHANGES_OFFSET = sizeof(superblock);
+        cfs->NODES_OFFSET = cfs->CHANGES_OFFSET + (off_t)sb->CHANGE_CAPACITY*sizeof(changeRecord);
+        return 1;
     }
-    // No initial current working file
-    memset((*cfs)->currentFile,0,MAX_FILENAME_SIZE);
-    (*cfs)->fileDesc = -1;
-    setlocale(LC_TIME, "el_GR.utf8");
-    return 1;
+    uint64_t perBlock = CFS_ChangesPerBlock(cfs);
+    cfs->NODE_STRIDE = (cfs->NODE_SIZE + sb->BLOCK_SIZE - 1)/sb->BLOCK_SIZE*sb->BLOCK_SIZE;
+    cfs->CHANGES_OFFSET = sb->BLOCK_SIZE;
+    cfs->NODES_OFFSET = cfs->CHANGES_OFFSET + (off_t)((sb->CHANGE_CAPACITY + perBlock - 1)/perBlock)*sb->BLOCK_SIZE;
+    return BufferPool_Create(&cfs->buffers,cfs->NODE_STRIDE,sb->BLOCK_SIZE);
 }
 
-unsigned int getNodeIdFromName(int fileDesc,string name,unsigned int nodeid,int *found,unsigned int *type) {
-    *found = 1;
-    MDS data;
-    // Seek to the current block metadata
-    lseek(fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    // Get it's metadata
-    read(fileDesc,&data,sizeof(MDS));
-    // Determine data type
-    if (data.type == TYPE_DIRECTORY) {
-        // Directory
-        // Search all the entities until we find the id of the wanted one
-        unsigned int i,curId;
-        MDS tmpData;
-        *found = 0;
-        for (i = 0; i < data.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)); i++) {
-            // Get id of the current entity
-            curId = *(unsigned int*)(data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-            // Get name of the current entity
-            string filename = data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int);
-            // Seek to the current entity metadata
-            lseek(fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
-            // Get it's metadata
-            read(fileDesc,&tmpData,sizeof(MDS));
-            // Check if the name matches
-            if (!strcmp(name,filename)) {
-                // Found
-                *found = 1; 
-                *type = tmpData.type;
-                return curId;
-            }
+// Saves the inode map of the working log-structured cfs file to <file>.imap (see logCheckpoint).
+// Without it (e.g. in a read-only directory) the next cfs_workwith scans the log.
+void CFS_LogCheckpoint(CFS cfs) {
+    struct stat st;
+    string path = malloc(strlen(cfs->currentFile) + strlen(".imap") + 1);
+    if (path == NULL)
+        return;
+    sprintf(path,"%s.imap",cfs->currentFile);
+    logCheckpoint checkpoint = {CFS_MAGIC, CFS_VERSION, 0, 0, cfs->sb.NODE_COUNT, cfs->logSegments, cfs->logHead, cfs->logSequence, cfs->logSegmentOpen};
+    nodeid_t nodeid;
+    FILE *file;
+    if (stat(cfs->currentFile,&st) == 0 && (file = fopen(path,"wb")) != NULL) {
+        checkpoint.device = st.st_dev;
+        checkpoint.inode = st.st_ino;
+        int ok = fwrite(&checkpoint,sizeof(logCheckpoint),1,file) == 1;
+        for (nodeid = 0; ok && nodeid < checkpoint.nodes; nodeid++) {
+            nodeid_t slot = nodeid < cfs->logMapCapacity ? cfs->logMap[nodeid] : LOG_UNWRITTEN;
+            ok = fwrite(&slot,sizeof(nodeid_t),1,file) == 1;
         }
-    } else {
-        *found = 0;
+        if (fclose(file) != 0 || !ok)
+            unlink(path);
     }
-    return data.nodeid;
+    free(path);
 }
 
-// Checks if an entity with a specific name exists in a specific directory
-int exists(int fileDesc,string name,unsigned int dirnodeid) {
-    int found;
-    unsigned int type;
-    getNodeIdFromName(fileDesc,name,dirnodeid,&found,&type);
-    return found;
+// Opens (or creates, with O_CREAT in flags) the members of a striped cfs file after the 1st one, named <file>.1, <file>.2 ...
+int CFS_OpenMembers(CFS cfs,string file,int flags) {
+    string path = malloc(strlen(file) + 12);
+    unsigned int member;
+    if (path == NULL) {
+        printf("Not enough memory.\n");
+        return 0;
+    }
+    for (member = 1; member < cfs->stripes; member++) {
+        sprintf(path,"%s.%u",file,member);
+        if ((cfs->memberDesc[member] = open(path,flags,FILE_PERMISSIONS)) == -1) {
+            printf("Member %s of %s can not be opened\n",path,file);
+            free(path);
+            return 0;
+        }
+    }
+    free(path);
+    return 1;
 }
 
-location getPathLocation(int fileDesc,string path,unsigned int nodeid,int ignoreLastEntity) {
-    string entityName = strtok(path,"/");
-    // Determine path type
-    if (path[0] == '/') {
-        // Absolute path so start searching from the root
-        nodeid = 0;
+void CFS_CloseMembers(CFS cfs) {
+    unsigned int member;
+    for (member = 1; member < cfs->stripes; member++) {
+        if (cfs->memberDesc[member] != -1)
+            close(cfs->memberDesc[member]);
+        cfs->memberDesc[member] = -1;
     }
-    int found;
-    location ret;
-    ret.nodeid = nodeid;
-    ret.filenanme = "/";
-    ret.type = TYPE_DIRECTORY;
-    ret.valid = 1;
-    while (entityName != NULL){
-        nodeid = getNodeIdFromName(fileDesc,entityName,nodeid,&found,&ret.type);
-        ret.filenanme = entityName;
-        // Not found
-        if (!found) {
-            // Check if we reached the last entity and we want to ignore it (for mkdir,touch,cp,cat,ln,mv commands)
-            if (ignoreLastEntity && strtok(NULL,"/") == NULL) {
-                ret.nodeid = nodeid;
-                ret.valid = 1;
-            } else {
-                ret.valid = 0;
-                ret.nodeid = 0;
-            }
-            break;
+}
+
+// Renames the members of a striped cfs file after the 1st one from the names of one file to the names of another
+// (or removes them if the other one is NULL)
+int CFS_MoveMembers(CFS cfs,string from,string to) {
+    string source = malloc(strlen(from) + 12),destination = malloc((to != NULL ? strlen(to) : 0) + 12);
+    unsigned int member;
+    int ok = source != NULL && destination != NULL;
+    for (member = 1; ok && member < cfs->stripes; member++) {
+        sprintf(source,"%s.%u",from,member);
+        if (to == NULL) {
+            unlink(source);
         } else {
-            ret.valid = 1;
-            entityName = strtok(NULL,"/");
-            if (!(ignoreLastEntity && entityName == NULL)) {
-                ret.nodeid = nodeid;
-            }
+            sprintf(destination,"%s.%u",to,member);
+            ok = rename(source,destination) == 0;
         }
     }
-    return ret;
+    free(source);
+    free(destination);
+    return ok;
 }
 
-unsigned int CFS_GetNextAvailableNodeId(int fileDesc) {
-    // Return the id of the 1st hole or last node id + 1 if no holes exist
-    // Seek to 1st node metadata
-    lseek(fileDesc,sizeof(superblock),SEEK_SET);
-    MDS data,tmpData;
-    // Continue reading node's metadata until a hole is found or we reach the end of the cfs file
-    while (read(fileDesc,&tmpData,sizeof(MDS)) != 0) {
-        data = tmpData;
-        // Hole found
-        if (data.deleted) {
-            lseek(fileDesc,-sizeof(MDS),SEEK_CUR);
-            return data.nodeid;
-        }
+// Releases the resources allocated for the cfs file's geometry
+void CFS_ReleaseGeometry(CFS cfs) {
+    CFS_CloseMembers(cfs);
+    if (cfs->buffers != NULL)
+        BufferPool_Destroy(&cfs->buffers);
+    if (cfs->map != NULL) {
+        munmap((void*)cfs->map,cfs->mapLength);
+        cfs->map = NULL;
     }
-    // End of file reached so new node will be placed there
-    return data.nodeid + 1;
+    if (cfs->meta != NULL)
+        MetaTable_Close(&cfs->meta);
+    // Images written by cfs_create, cfs_compact or cfs_seal are not open as the working cfs file
+    if (cfs->logMap != NULL && cfs->currentFile[0] != '\0')
+        CFS_LogCheckpoint(cfs);
+    free(cfs->logMap);
+    free(cfs->logSegmentCurrent);
+    cfs->logMap = NULL;
+    cfs->logSegmentCurrent = NULL;
 }
 
-unsigned int CFS_CreateDirectory(CFS cfs,string name,unsigned int nodeid) {
-    // Get location directory data
-    MDS locationData;
-    lseek(cfs->fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    read(cfs->fileDesc,&locationData,sizeof(MDS));
-    // Check if new directory fits in directory
-    if (locationData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) > cfs->MAX_DIRECTORY_FILE_NUMBER)
-        return 0;
-    MDS data;
-    // Initialize metadata bytes to 0 to avoid valgrind errors
-    memset(&data,0,sizeof(MDS));
-    // Initialize directory metadata
-    data.deleted = 0;
-    data.root = 0;
-    data.links = 0;
-    data.nodeid = CFS_GetNextAvailableNodeId(cfs->fileDesc);
-    strcpy(data.filename,name);
-    data.size = 0;
-    data.type = TYPE_DIRECTORY;
-    data.parent_nodeid = nodeid;
-    time_t timer = time(NULL);
-    data.creation_time = data.accessTime = data.modificationTime = timer;
-    // Create . shortcut (hardlink)
-    memcpy(data.data.datablocks,&data.nodeid,sizeof(unsigned int));
-    strcpy(data.data.datablocks + sizeof(unsigned int),".");
-    // Create .. shortcut (hardlink)
-    memcpy(data.data.datablocks + sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char),&data.parent_nodeid,sizeof(unsigned int));
-    strcpy(data.data.datablocks + 2*sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char),"..");
-    data.size += 2*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-    // Write directory data to cfs file
-    write(cfs->fileDesc,&data,sizeof(MDS));
-    // Write directory descriptor and name to node's list
-    memcpy(locationData.data.datablocks + locationData.size,&data.nodeid,sizeof(unsigned int));
-    strcpy(locationData.data.datablocks + locationData.size + sizeof(unsigned int),name);
-    locationData.size += (sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-    lseek(cfs->fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    write(cfs->fileDesc,&locationData,sizeof(MDS));
-    return data.nodeid;
+// File descriptor of the member that holds a slot (striped cfs files keep slot i in member i % stripes)
+int CFS_SlotDesc(CFS cfs,nodeid_t slot) {
+    unsigned int member = slot % cfs->stripes;
+    return member == 0 ? cfs->fileDesc : cfs->memberDesc[member];
 }
 
-unsigned int CFS_CreateFile(CFS cfs,string name,unsigned int dirnodeid,char content[DATABLOCK_NUM],int size) {
-    // Get location directory data
-    MDS locationData;
-    lseek(cfs->fileDesc,sizeof(superblock) + dirnodeid * sizeof(MDS),SEEK_SET);
-    read(cfs->fileDesc,&locationData,sizeof(MDS));
-    // Check if new file fits in directory
-    if (locationData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) > cfs->MAX_DIRECTORY_FILE_NUMBER)
-        return 0;
-    MDS data;
-    // Initialize metadata bytes to 0 to avoid valgrind errors
-    memset(&data,0,sizeof(MDS));
-    // Initialize file metadata
-    data.deleted = 0;
-    data.root = 0;
-    data.links = 0;
-    data.nodeid = CFS_GetNextAvailableNodeId(cfs->fileDesc);
-    strcpy(data.filename,name);
-    data.size = size;
-    data.type = TYPE_FILE;
-    data.parent_nodeid = dirnodeid;
-    time_t timer = time(NULL);
-    data.creation_time = data.accessTime = data.modificationTime = timer;
-    // Write content to datablocks
-    memcpy(data.data.datablocks,content,size);
-    // Write file data to cfs file
-    write(cfs->fileDesc,&data,sizeof(MDS));
-    // Write file descriptor and name to directory's node list
-    memcpy(locationData.data.datablocks + locationData.size,&data.nodeid,sizeof(unsigned int));
-    strcpy(locationData.data.datablocks + locationData.size + sizeof(unsigned int),name);
-    locationData.size += (sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-    lseek(cfs->fileDesc,sizeof(superblock) + dirnodeid * sizeof(MDS),SEEK_SET);
-    write(cfs->fileDesc,&locationData,sizeof(MDS));
-    return data.nodeid;
+// Fsyncs every member of the cfs file
+int CFS_SyncMembers(CFS cfs) {
+    unsigned int member;
+    for (member = 0; member < cfs->stripes; member++)
+        if (fsync(CFS_SlotDesc(cfs,member)) != 0)
+            return 0;
+    return 1;
 }
 
-unsigned int CFS_CreateHardLink(CFS cfs,string outputfilename,unsigned int sourcenodeid,unsigned int dirnodeid) {
-    // Get parent directory data
-    MDS parentData;
-    lseek(cfs->fileDesc,sizeof(superblock) + dirnodeid * sizeof(MDS),SEEK_SET);
-    read(cfs->fileDesc,&parentData,sizeof(MDS));
-    // Check if new link fits in directory
-    if (parentData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) > cfs->MAX_DIRECTORY_FILE_NUMBER)
-        return 0;
-    // Write shortcut descriptor to parent directory's node list
-    memcpy(parentData.data.datablocks + parentData.size,&sourcenodeid,sizeof(unsigned int));
-    strcpy(parentData.data.datablocks + parentData.size + sizeof(unsigned int),outputfilename);
-    parentData.size += (sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-    lseek(cfs->fileDesc,-sizeof(MDS),SEEK_CUR);
-    write(cfs->fileDesc,&parentData,sizeof(MDS));
-    // Get source node id data
-    MDS sourceData;
-    lseek(cfs->fileDesc,sizeof(superblock) + sourcenodeid * sizeof(MDS),SEEK_SET);
-    read(cfs->fileDesc,&sourceData,sizeof(MDS));
-    // Increase source # of links
-    sourceData.links++;
-    // Write updated source data back to cfs file
-    lseek(cfs->fileDesc,-sizeof(MDS),SEEK_CUR);
-    write(cfs->fileDesc,&sourceData,sizeof(MDS));
+// Offset of a slot in it's member of the cfs file (in-place cfs files keep node i in slot i)
+off_t CFS_SlotOffset(CFS cfs,nodeid_t slot) {
+    return cfs->NODES_OFFSET + (off_t)(slot/cfs->stripes) * cfs->NODE_STRIDE;
+}
+
+// Offset of the end of a member of the cfs file when it holds it's share of the 1st slots slots
+off_t CFS_MemberEnd(CFS cfs,unsigned int member,nodeid_t slots) {
+    return cfs->NODES_OFFSET + (off_t)(slots/cfs->stripes + (member < slots % cfs->stripes)) * cfs->NODE_STRIDE;
+}
+
+// Bytes that the members of the cfs file take up when they hold the 1st slots slots
+uint64_t CFS_SlotsBytes(CFS cfs,nodeid_t slots) {
+    uint64_t bytes = 0;
+    unsigned int member;
+    for (member = 0; member < cfs->stripes; member++)
+        bytes += CFS_MemberEnd(cfs,member,slots);
+    return bytes;
+}
+
+// Truncates every member of the cfs file after it's share of the 1st slots slots
+int CFS_TruncateSlots(CFS cfs,nodeid_t slots) {
+    unsigned int member;
+    for (member = 0; member < cfs->stripes; member++)
+        if (ftruncate(CFS_SlotDesc(cfs,member),CFS_MemberEnd(cfs,member,slots)) == -1)
+            return 0;
     return 1;
 }
 
-// Determines whether a directory is empty or not
-int CFS_DirectoryIsEmpty(int fileDesc,unsigned int nodeId) {
-    //Get directory data
-    MDS data;
-    lseek(fileDesc,sizeof(superblock) + nodeId * sizeof(MDS),SEEK_SET);
-    read(fileDesc,&data,sizeof(MDS));
-    // A cfs directory is empty only when it's only contents are . and .. shortcuts
-    return data.type == TYPE_DIRECTORY && data.size == 2*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
+// Slot of a node's current version (LOG_UNWRITTEN for nodes of log-structured cfs files that were never written)
+nodeid_t CFS_NodeSlot(CFS cfs,nodeid_t nodeid) {
+    if (cfs->logMap == NULL)
+        return nodeid;
+    if (nodeid >= cfs->logMapCapacity)
+        return LOG_UNWRITTEN;
+    return cfs->logMap[nodeid];
 }
 
-// Decreases link count or marks node as deleted
-int CFS_RemoveEntity(int fileDesc,unsigned int nodeId) {
-    // Cannot remove root directory
-    if (nodeId == 0) {
+// Reads size bytes from a block aligned offset through an aligned buffer of length (multiple of BLOCK_SIZE) bytes
+int CFS_ReadAligned(CFS cfs,int fd,off_t offset,void *data,size_t size,size_t length) {
+    char *buffer = BufferPool_Get(cfs->buffers);
+    if (buffer == NULL)
         return 0;
+    int ok = pread(fd,buffer,length,offset) == length;
+    if (ok)
+        memcpy(data,buffer,size);
+    BufferPool_Put(cfs->buffers,buffer);
+    return ok;
+}
+
+// Writes size bytes padded with zeros to length (multiple of BLOCK_SIZE) bytes at a block aligned offset
+int CFS_WriteAligned(CFS cfs,int fd,off_t offset,void *data,size_t size,size_t length) {
+    char *buffer = BufferPool_Get(cfs->buffers);
+    if (buffer == NULL)
+        return 0;
+    memcpy(buffer,data,size);
+    memset(buffer + size,0,length - size);
+    int ok = pwrite(fd,buffer,length,offset) == length;
+    BufferPool_Put(cfs->buffers,buffer);
+    return ok;
+}
+
+int CFS_ReadSuperblock(CFS cfs,superblock *sb) {
+    if (cfs->BLOCK_SIZE > 1)
+        return CFS_ReadAligned(cfs,cfs->fileDesc,0,sb,sizeof(superblock),cfs->BLOCK_SIZE);
+    return pread(cfs->fileDesc,sb,sizeof(superblock),0) == sizeof(superblock);
+}
+
+int CFS_WriteSuperblock(CFS cfs,superblock *sb) {
+    if (cfs->BLOCK_SIZE > 1)
+        return CFS_WriteAligned(cfs,cfs->fileDesc,0,sb,sizeof(superblock),cfs->BLOCK_SIZE);
+    return pwrite(cfs->fileDesc,sb,sizeof(superblock),0) == sizeof(superblock);
+}
+
+// Writes the working copy of the superblock to the cfs file
+int CFS_SyncSuperblock(CFS cfs) {
+    return CFS_WriteSuperblock(cfs,&cfs->sb);
+}
+
+// Number of nodes (including holes) in the cfs file
+// The file itself may be longer since it also holds the preallocated nodes
+nodeid_t CFS_NodeCount(CFS cfs) {
+    return cfs->sb.NODE_COUNT;
+}
+
+// Makes sure that the cfs file has room for at least nodes nodes (log-structured cfs files: slots).
+// Space is reserved in geometric steps so that appended nodes land in few, contiguous host extents.
+void CFS_ReserveNodes(CFS cfs,nodeid_t nodes) {
+    if (nodes <= cfs->sb.RESERVED_NODES)
+        return;
+    nodeid_t reserved = cfs->sb.RESERVED_NODES + cfs->sb.RESERVED_NODES*cfs->sb.GROWTH_PERCENT/100;
+    if (reserved < nodes)
+        reserved = nodes;
+    // Hosts that can not preallocate still grow the cfs file when the nodes are written
+    unsigned int member;
+    int ok = 1;
+    for (member = 0; ok && member < cfs->stripes; member++) {
+        off_t offset = CFS_MemberEnd(cfs,member,cfs->sb.RESERVED_NODES),end = CFS_MemberEnd(cfs,member,reserved);
+        ok = end == offset || fallocate(CFS_SlotDesc(cfs,member),0,offset,end - offset) == 0;
     }
-    // Seek to the directory where the file is located
-    lseek(fileDesc,sizeof(superblock) + nodeId * sizeof(MDS),SEEK_SET);
-    MDS data;
-    read(fileDesc,&data,sizeof(MDS));
-    // If node is linked into 1 file mark it as deleted
-    if (data.links == 0)
-        data.deleted = 1;
-    // If the node is hard-linked into more than 1 names decrease the links number
-    else
-        data.links--;
-    // Write updated data to cfs
-    lseek(fileDesc,-sizeof(MDS),SEEK_CUR);
-    write(fileDesc,&data,sizeof(MDS));
-    return 1;
+    cfs->sb.RESERVED_NODES = ok ? reserved : nodes;
 }
 
-int CFS_RemoveDirectoryContent(int fileDesc,unsigned int dirnodeid,int options[2]) {
-    // Seek to the directory location
-    lseek(fileDesc,sizeof(superblock) + dirnodeid * sizeof(MDS),SEEK_SET);
-    MDS dirData;
-    read(fileDesc,&dirData,sizeof(MDS));
-    // Loop through all the files and directories ignoring . and .. locations
-    unsigned int i,curId,delete,deletions = 0;
-    MDS tmpData;
-    for (i = 0; i < dirData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));) {
-        delete = 0;
-        // Get id of the current entity
-        curId = *(unsigned int*)(dirData.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-        // Get name of the current entity
-        string filename = dirData.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int);
-        // Ignore . and .. directories to avoid glitches and possible infinite loop
-        if (!strcmp(".",filename) || !strcmp("..",filename)) {
-            i++;
-            continue;
-        }
-        // Seek to the current entity metadata
-        lseek(fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
-        // Get it's metadata
-        read(fileDesc,&tmpData,sizeof(MDS));
-        // Determine type
-        if (tmpData.type == TYPE_DIRECTORY) {
-            // Directory so remove empty sub-directories and if -r option is enabled remove content from non empty sub-directories
-            if (CFS_DirectoryIsEmpty(fileDesc,curId)) {
-                CFS_RemoveEntity(fileDesc,curId);
-                delete = 1;
-            } else {
-                if (options[RM_RECURSIVE]) {
-                    CFS_RemoveDirectoryContent(fileDesc,curId,options);
-                }
-            }
-        } else if (tmpData.type == TYPE_FILE) {
-            CFS_RemoveEntity(fileDesc,curId);
-            delete = 1;
-        }
-        // If entity was deleted move the next (id,name) tuples 1 place left
-        if (delete) {
-            // If prompt(-i option) is enabled ask the user before deleting
-            char answer;
-            if (options[RM_PROMPT]) {
-                do {
-                    printf("Remove '%s'?(y/n)",filename);
-                    answer = getPromptAnswer();
-                } while (answer != 'n' && answer != 'y');
-            } else {
-                answer = 'y';
-            }
-            if (answer == 'y') {
-                if (i < dirData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) - 1)
-                    memcpy(dirData.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)),dirData.data.datablocks + (i+1)*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)),(dirData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) - i - 1)*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-                dirData.size -= (sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-                deletions++;
-            } else {
-                i++;
-            }
-        } else {
-            i++;
+// Offset of a slot of the change log
+off_t CFS_ChangeOffset(CFS cfs,uint64_t slot) {
+    if (cfs->BLOCK_SIZE == 1)
+        return cfs->CHANGES_OFFSET + (off_t)slot*sizeof(changeRecord);
+    uint64_t perBlock = CFS_ChangesPerBlock(cfs);
+    return cfs->CHANGES_OFFSET + (off_t)(slot/perBlock)*cfs->BLOCK_SIZE + (off_t)(slot%perBlock)*sizeof(changeRecord);
+}
+
+// Appends a record to the change log of the cfs file (if it has one), taking the slot of the oldest record once it is full
+void CFS_RecordChange(CFS cfs,unsigned int op,nodeid_t nodeid,nodeid_t parent,const char *name) {
+    if (cfs->sb.CHANGE_CAPACITY == 0)
+        return;
+    changeRecord record;
+    memset(&record,0,sizeof(changeRecord));
+    record.sequence = ++cfs->sb.CHANGE_SEQUENCE;
+    record.op = op;
+    record.nodeid = nodeid;
+    record.parent = parent;
+    strncpy(record.name,name,MAX_FILENAME_SIZE - 1);
+    off_t offset = CFS_ChangeOffset(cfs,(record.sequence - 1) % cfs->sb.CHANGE_CAPACITY);
+    if (cfs->BLOCK_SIZE > 1) {
+        // The record shares it's block with others
+        char *buffer = BufferPool_Get(cfs->buffers);
+        off_t block = offset/cfs->BLOCK_SIZE*cfs->BLOCK_SIZE;
+        if (buffer != NULL && pread(cfs->fileDesc,buffer,cfs->BLOCK_SIZE,block) == cfs->BLOCK_SIZE) {
+            memcpy(buffer + (offset - block),&record,sizeof(changeRecord));
+            pwrite(cfs->fileDesc,buffer,cfs->BLOCK_SIZE,block);
         }
+        BufferPool_Put(cfs->buffers,buffer);
+    } else {
+        pwrite(cfs->fileDesc,&record,sizeof(changeRecord),offset);
     }
-    // Write changes (if any occured) to cfs file
-    if (deletions) {
-        lseek(fileDesc,sizeof(superblock) + dirnodeid * sizeof(MDS),SEEK_SET);
-        write(fileDesc,&dirData,sizeof(MDS));
+    if (record.sequence - cfs->sb.CHANGE_FIRST >= cfs->sb.CHANGE_CAPACITY)
+        cfs->sb.CHANGE_FIRST = record.sequence - cfs->sb.CHANGE_CAPACITY + 1;
+    CFS_SyncSuperblock(cfs);
+}
+
+// Reads the records of count consecutive slots of the change log, one block at a time with BLOCK_SIZE > 1
+int CFS_ReadChanges(CFS cfs,uint64_t slot,uint64_t count,changeRecord *records) {
+    if (cfs->BLOCK_SIZE == 1)
+        return pread(cfs->fileDesc,records,count*sizeof(changeRecord),CFS_ChangeOffset(cfs,slot)) == count*sizeof(changeRecord);
+    char *buffer = BufferPool_Get(cfs->buffers);
+    if (buffer == NULL)
+        return 0;
+    uint64_t perBlock = CFS_ChangesPerBlock(cfs),i = 0,n;
+    int ok = 1;
+    while (ok && i < count) {
+        off_t offset = CFS_ChangeOffset(cfs,slot + i),block = offset/cfs->BLOCK_SIZE*cfs->BLOCK_SIZE;
+        n = perBlock - (slot + i)%perBlock;
+        if (n > count - i)
+            n = count - i;
+        ok = pread(cfs->fileDesc,buffer,cfs->BLOCK_SIZE,block) == cfs->BLOCK_SIZE;
+        if (ok)
+            memcpy(records + i,buffer + (offset - block),n*sizeof(changeRecord));
+        i += n;
     }
+    BufferPool_Put(cfs->buffers,buffer);
+    return ok;
+}
+
+// Copies size bytes from the mapping of a sealed cfs file (no system call and no aligned buffer needed)
+int CFS_ReadMapped(CFS cfs,off_t offset,void *data,size_t size) {
+    if (offset + size > cfs->mapLength)
+        return 0;
+    memcpy(data,cfs->map + offset,size);
     return 1;
 }
 
-int CFS_ModifyFileTimestamps(int fileDesc,unsigned int nodeid,int access,int modification) {
-    MDS data;
-    // Seek to file's metadata location in cfs file
-    lseek(fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    // Read file's metadata
-    read(fileDesc,&data,sizeof(MDS));
-    // Modify the timestamps
-    time_t timestamp = time(NULL);
-    if (access)
-        data.accessTime = timestamp;
-    if (modification)
-        data.modificationTime = timestamp;
-    // Seek again to file's metadata location in cfs file
-    lseek(fileDesc,-sizeof(MDS),SEEK_CUR);
-    // Write changes to cfs file
-    write(fileDesc,&data,sizeof(MDS));
-    return 1;
+// Reads the node stored at a slot of the cfs file
+int CFS_ReadNodeAt(CFS cfs,nodeid_t slot,MDS *data) {
+    off_t offset = CFS_SlotOffset(cfs,slot);
+    // Sealed cfs files are never striped
+    if (cfs->map != NULL)
+        return CFS_ReadMapped(cfs,offset,data,cfs->NODE_SIZE);
+    if (cfs->BLOCK_SIZE > 1)
+        return CFS_ReadAligned(cfs,CFS_SlotDesc(cfs,slot),offset,data,cfs->NODE_SIZE,cfs->NODE_STRIDE);
+    return pread(CFS_SlotDesc(cfs,slot),data,cfs->NODE_SIZE,offset) == cfs->NODE_SIZE;
 }
 
-int Create_CFS_File(string pathname,unsigned int BLOCK_SIZE,unsigned int FILENAME_SIZE,unsigned int MAX_FILE_SIZE,unsigned int MAX_DIRECTORY_FILE_NUMBER) {
-    int fd = -1;
-    // Check if sizes satisfy constraints
-    if (MAX_FILE_SIZE <= DATABLOCK_NUM && FILENAME_SIZE <= MAX_FILENAME_SIZE && MAX_DIRECTORY_FILE_NUMBER <= MAX_FILE_SIZE/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) && BLOCK_SIZE == 1) {
-        // Create the file
-        fd = open(pathname,O_RDWR|O_CREAT|O_TRUNC,FILE_PERMISSIONS);
-        // Check if creation was successful
-        if (fd != -1) {
-            // Write superblock data
-            superblock sb = {BLOCK_SIZE, FILENAME_SIZE, MAX_FILE_SIZE, MAX_DIRECTORY_FILE_NUMBER};
-            lseek(fd,0,SEEK_END);
-            write(fd,&sb,sizeof(superblock));
-            // Write root node data
-            MDS data;
-            // Initialize metadata bytes to 0 to avoid valgrind errors
-            memset(&data,0,sizeof(MDS));
-            // Initialize root directory metadata
-            data.deleted = 0;
-            data.root = 1;
-            data.nodeid = 0;
-            strcpy(data.filename,"/");
-            data.size = 0;
-            data.type = TYPE_DIRECTORY;
-            data.parent_nodeid = 0;
-            time_t timer = time(NULL);
-            data.creation_time = data.accessTime = data.modificationTime = timer;
-            // Create . shortcut (hardlink)
-            memcpy(data.data.datablocks,&data.nodeid,sizeof(unsigned int));
-            strcpy(data.data.datablocks + sizeof(unsigned int),".");
-            // Create .. shortcut (hardlink)
-            memcpy(data.data.datablocks + sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char),&data.parent_nodeid,sizeof(unsigned int));
-            strcpy(data.data.datablocks + 2*sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char),"..");
-            data.size += 2*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-            lseek(fd,0,SEEK_END);
-            write(fd,&data,sizeof(MDS));
-            // Close the file after writing data
-            close(fd);
-        } else {
-            perror("Error creating cfs file:");
-            return -1;
-        }
-    } else {
-        printf("Constraints are not satisfied.\n");
+// Reads only the metadata of the node stored at a slot of the cfs file
+int CFS_ReadNodeMetadataAt(CFS cfs,nodeid_t slot,MDS *data) {
+    off_t offset = CFS_SlotOffset(cfs,slot);
+    // The metadata always fit in the node's 1st block
+    if (cfs->map != NULL)
+        return CFS_ReadMapped(cfs,offset,data,offsetof(MDS,data));
+    if (cfs->BLOCK_SIZE > 1)
+        return CFS_ReadAligned(cfs,CFS_SlotDesc(cfs,slot),offset,data,offsetof(MDS,data),cfs->BLOCK_SIZE);
+    return pread(CFS_SlotDesc(cfs,slot),data,offsetof(MDS,data),offset) == offsetof(MDS,data);
+}
+
+// Reads a node's metadata and data
+int CFS_ReadNode(CFS cfs,nodeid_t nodeid,MDS *data) {
+    nodeid_t slot = CFS_NodeSlot(cfs,nodeid);
+    // Like the reserved nodes of in-place cfs files, nodes that were never written read back as zeros
+    if (slot == LOG_UNWRITTEN) {
+        memset(data,0,cfs->NODE_SIZE);
+        return 1;
     }
-    return fd;
+    return CFS_ReadNodeAt(cfs,slot,data);
 }
 
-void CFS_pwd(int fileDesc,unsigned int nodeid,int last) {
-    // Seek to current node's metadata in cfs file
-    MDS data;
-    lseek(fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    // Read the metadata from the cfs file
-    read(fileDesc,&data,sizeof(MDS));
-    if (!data.root) {
-        CFS_pwd(fileDesc,data.parent_nodeid,0);
-        printf("%s",data.filename);
-        if (!last)
-            printf("/");
-        else
-            printf("\n");
-    } else {
-        printf("%s",data.filename);
-        if (last)
-            printf("\n");
+// Reads only a node's metadata (without it's datablocks)
+int CFS_ReadNodeMetadata(CFS cfs,nodeid_t nodeid,MDS *data) {
+    nodeid_t slot = CFS_NodeSlot(cfs,nodeid);
+    if (slot == LOG_UNWRITTEN) {
+        memset(data,0,offsetof(MDS,data));
+        return 1;
     }
+    return CFS_ReadNodeMetadataAt(cfs,slot,data);
 }
 
-void CFS_PrintFileInfo(int fileDesc,MDS data,string filename,int options[6]) {
-    // Ignore hidden files if -a option was not specified
-    if (!options[LS_ALL_FILES] && filename[0] == '.')
+// Mirrors a node's metadata into the metadata table.
+// If the table can not grow it is dropped and every query falls back to reading the nodes.
+void CFS_MetaTableRecord(CFS cfs,MDS *data) {
+    if (cfs->meta == NULL)
         return;
-    // If -d option (only directories) was specified ignore other types
-    if (options[LS_DIRECTORIES_ONLY] && data.type != TYPE_DIRECTORY)
-        return;
-    // If -h option (only links) was specified ignore other types
-    if (options[LS_LINKS_ONLY] && data.links == 0)
+    if (data->nodeid >= MetaTable_Count(cfs->meta) && !MetaTable_Resize(cfs->meta,data->nodeid + 1)) {
+        MetaTable_Close(&cfs->meta);
         return;
-    if (options[LS_ALL_ATTRIBUTES]) {
-        switch (data.type) {
-            case TYPE_DIRECTORY:
-                printf("dir ");
-                break;
-            case TYPE_FILE:
-                printf("file");
-                break;
-            default:
-                printf("    ");
-                break;
+    }
+    MetaTable_Set(cfs->meta,data->nodeid,data->deleted ? METATABLE_DELETED : (data->snapshot ? METATABLE_SNAPSHOT : data->type),data->size,data->links,data->parent_nodeid,data->creation_time,data->accessTime,data->modificationTime);
+}
+
+// Writes a node at a slot of the cfs file
+// Whole blocks are written so that the host never has to read-modify-write them
+int CFS_StoreNodeAt(CFS cfs,nodeid_t slot,MDS *data) {
+    if (cfs->BLOCK_SIZE > 1)
+        return CFS_WriteAligned(cfs,CFS_SlotDesc(cfs,slot),CFS_SlotOffset(cfs,slot),data,cfs->NODE_SIZE,cfs->NODE_STRIDE);
+    return pwrite(CFS_SlotDesc(cfs,slot),data,cfs->NODE_SIZE,CFS_SlotOffset(cfs,slot)) == cfs->NODE_SIZE;
+}
+
+// Points a node of a log-structured cfs file to a slot, growing the inode map if needed
+int CFS_LogMapSet(CFS cfs,nodeid_t nodeid,nodeid_t slot) {
+    if (nodeid >= cfs->logMapCapacity) {
+        nodeid_t capacity = cfs->logMapCapacity > 0 ? cfs->logMapCapacity : ALLOCATION_GROUP_SIZE,i;
+        while (capacity <= nodeid)
+            capacity *= 2;
+        nodeid_t *logMap = realloc(cfs->logMap,capacity*sizeof(nodeid_t));
+        if (logMap == NULL) {
+            printf("Not enough memory.\n");
+            return 0;
         }
-        char creationTime[70],accessTime[70],modificationTime[70];
-        strftime(creationTime,sizeof(creationTime),"%c",localtime(&data.creation_time));
-        strftime(accessTime,sizeof(accessTime),"%c",localtime(&data.accessTime));
-        strftime(modificationTime,sizeof(modificationTime),"%c",localtime(&data.modificationTime));
-        printf(" %s %s %s %d %s\n",creationTime,accessTime,modificationTime,data.size,filename);
-    } else {
-        printf("%s ",data.filename);
+        for (i = cfs->logMapCapacity; i < capacity; i++)
+            logMap[i] = LOG_UNWRITTEN;
+        cfs->logMap = logMap;
+        cfs->logMapCapacity = capacity;
     }
+    cfs->logMap[nodeid] = slot;
+    return 1;
 }
 
-MDS getMetadataFromNodeId(int fileDesc,unsigned int nodeid) {
-    MDS data;
-    // Seek to the wanted block metadata
-    lseek(fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    // Get it's metadata
-    read(fileDesc,&data,sizeof(MDS));
-    // Return the metadata
-    return data;
+// Releases the inode map and the segment counters of a log-structured cfs file
+void CFS_CloseLog(CFS cfs) {
+    free(cfs->logMap);
+    free(cfs->logSegmentCurrent);
+    cfs->logMap = NULL;
+    cfs->logSegmentCurrent = NULL;
+}
+
+// Adds segments to the end of a log-structured cfs file (one, or more if GROWTH_PERCENT of the reserved slots is more)
+int CFS_LogExtend(CFS cfs) {
+    nodeid_t segments = cfs->logSegments,count,i;
+    CFS_ReserveNodes(cfs,(segments + 1)*LOG_SEGMENT_SLOTS);
+    count = cfs->sb.RESERVED_NODES/LOG_SEGMENT_SLOTS;
+    nodeid_t *current = realloc(cfs->logSegmentCurrent,count*sizeof(nodeid_t));
+    if (current == NULL) {
+        printf("Not enough memory.\n");
+        return 0;
+    }
+    for (i = segments; i < count; i++)
+        current[i] = 0;
+    cfs->logSegmentCurrent = current;
+    cfs->logSegments = count;
+    return CFS_SyncSuperblock(cfs);
+}
+
+// Loads the inode map of the working log-structured cfs file from <file>.imap if it was saved when the cfs file
+// was last closed. The side file is removed right away, so that it is not trusted after a run that does not end cleanly.
+int CFS_LogLoadCheckpoint(CFS cfs) {
+    struct stat st;
+    logCheckpoint checkpoint;
+    nodeid_t nodeid,slot;
+    string path = malloc(strlen(cfs->currentFile) + strlen(".imap") + 1);
+    FILE *file;
+    if (path == NULL)
+        return 0;
+    sprintf(path,"%s.imap",cfs->currentFile);
+    if ((file = fopen(path,"rb")) == NULL) {
+        free(path);
+        return 0;
+    }
+    unlink(path);
+    free(path);
+    int ok = fstat(cfs->fileDesc,&st) == 0 && fread(&checkpoint,sizeof(logCheckpoint),1,file) == 1
+        && checkpoint.magic == CFS_MAGIC && checkpoint.version == CFS_VERSION && checkpoint.device == st.st_dev && checkpoint.inode == st.st_ino
+        && checkpoint.nodes == cfs->sb.NODE_COUNT && checkpoint.segments == cfs->logSegments && checkpoint.head <= checkpoint.segments*LOG_SEGMENT_SLOTS;
+    for (nodeid = 0; ok && nodeid < checkpoint.nodes; nodeid++) {
+        ok = fread(&slot,sizeof(nodeid_t),1,file) == 1 && (slot == LOG_UNWRITTEN || slot < checkpoint.segments*LOG_SEGMENT_SLOTS);
+        if (ok && slot != LOG_UNWRITTEN) {
+            ok = CFS_LogMapSet(cfs,nodeid,slot);
+            cfs->logSegmentCurrent[slot/LOG_SEGMENT_SLOTS]++;
+            cfs->logCurrent++;
+        }
+    }
+    fclose(file);
+    if (ok) {
+        cfs->logHead = checkpoint.head;
+        cfs->logSequence = checkpoint.sequence;
+        cfs->logSegmentOpen = checkpoint.segmentOpen;
+        return 1;
+    }
+    // Start over for the scan
+    for (nodeid = 0; nodeid < cfs->logMapCapacity; nodeid++)
+        cfs->logMap[nodeid] = LOG_UNWRITTEN;
+    for (slot = 0; slot < cfs->logSegments; slot++)
+        cfs->logSegmentCurrent[slot] = 0;
+    cfs->logCurrent = 0;
+    return 0;
 }
 
-void CFS_ls(int fileDesc,unsigned int nodeid,int options[6],string path) {
+// Loads the inode map of a log-structured cfs file, from <file>.imap or else by scanning the metadata of it's slots:
+// the version of every node with the highest sequence number is the current one and the log continues after the
+// highest sequence number of all. Nodes past NODE_COUNT (dropped by cfs_trim) and slots never written (sequence 0) are ignored.
+int CFS_OpenLog(CFS cfs) {
     MDS data;
-    // Seek to the wanted block metadata
-    lseek(fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    // Get it's metadata
-    read(fileDesc,&data,sizeof(MDS));
-    // Determine data type
-    if (data.type == TYPE_DIRECTORY) {
-        // Directory so show all the contents of the directory
-        // Show info for all the directory's entities
-        unsigned int i,curId;
-        MDS tmpData;
-        MinHeap fileHeap;
-        // If we do not have the unorderedoption create a minheap to sort the contents
-        if (!options[LS_UNORDERED])
-            fileHeap = MinHeap_Create(data.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-        // In recursive directory option print the current path
-        if (options[LS_RECURSIVE_PRINT])
-            printf("%s:\n",path);
-        for (i = 0; i < data.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)); i++) {
-            // Get id of the current entity
-            curId = *(unsigned int*)(data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-            // Get name of the current entity
-            string filename = data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int);
-            // Seek to the current entity metadata
-            lseek(fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
-            // Get it's metadata
-            read(fileDesc,&tmpData,sizeof(MDS));
-            // If we want ordered print store all the contents in a minheap and we will print them later
-            if (!options[LS_UNORDERED]) {
-                MinHeap_Insert(fileHeap,tmpData,filename);
-            } else {
-                // Otherwise just print entity info
-                CFS_PrintFileInfo(fileDesc,tmpData,filename,options);
-            }
+    nodeid_t slot,last = LOG_UNWRITTEN;
+    uint64_t *sequences;
+    cfs->logMap = cfs->logSegmentCurrent = NULL;
+    cfs->logMapCapacity = cfs->logCurrent = 0;
+    cfs->logSegments = cfs->sb.RESERVED_NODES/LOG_SEGMENT_SLOTS;
+    cfs->logSequence = 0;
+    if ((sequences = calloc(cfs->sb.NODE_COUNT > 0 ? cfs->sb.NODE_COUNT : 1,sizeof(uint64_t))) == NULL
+        || (cfs->logSegmentCurrent = calloc(cfs->logSegments > 0 ? cfs->logSegments : 1,sizeof(nodeid_t))) == NULL
+        || !CFS_LogMapSet(cfs,0,LOG_UNWRITTEN)) {
+        free(sequences);
+        CFS_CloseLog(cfs);
+        return 0;
+    }
+    if (cfs->currentFile[0] != '\0' && CFS_LogLoadCheckpoint(cfs)) {
+        free(sequences);
+        return 1;
+    }
+    for (slot = 0; slot < cfs->logSegments*LOG_SEGMENT_SLOTS; slot++) {
+        // Slots the host could not preallocate may not exist yet
+        if (!CFS_ReadNodeMetadataAt(cfs,slot,&data) || data.sequence == 0)
+            continue;
+        if (data.sequence > cfs->logSequence) {
+            cfs->logSequence = data.sequence;
+            last = slot;
         }
-        // Print all the contents ordered if -u is not enabled
-        if (!options[LS_UNORDERED]) {
-            MDS tmp;
-            int empty = 0;
-            while (!empty){
-                tmp = MinHeap_ExtractMin(fileHeap,&empty);
-                if (!empty)
-                    CFS_PrintFileInfo(fileDesc,tmp,tmp.filename,options);
-            }
-            MinHeap_Destroy(&fileHeap);
+        if (data.nodeid >= cfs->sb.NODE_COUNT || data.sequence < sequences[data.nodeid])
+            continue;
+        if (sequences[data.nodeid] == 0)
+            cfs->logCurrent++;
+        else
+            cfs->logSegmentCurrent[cfs->logMap[data.nodeid]/LOG_SEGMENT_SLOTS]--;
+        sequences[data.nodeid] = data.sequence;
+        cfs->logSegmentCurrent[slot/LOG_SEGMENT_SLOTS]++;
+        if (!CFS_LogMapSet(cfs,data.nodeid,slot)) {
+            free(sequences);
+            CFS_CloseLog(cfs);
+            return 0;
         }
-        // In recursive print option recursively print all subfolder's contents
-        if (options[LS_RECURSIVE_PRINT]) {
-            for (i = 0; i < data.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)); i++) {
-                // Get id of the current entity
-                curId = *(unsigned int*)(data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-                // Get name of the current entity
-                string filename = data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int);
-                // Seek to the current entity metadata
-                lseek(fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
-                // Get it's metadata
-                read(fileDesc,&tmpData,sizeof(MDS));
-                // Recursively ls only on directories (except . and .. shortcuts to avoid infinite loop)
-                if (tmpData.type == TYPE_DIRECTORY && strcmp(".",filename) && strcmp("..",filename)) {
-                    string newPath = copyString(path);
-                    stringAppend(&newPath,"/");
-                    stringAppend(&newPath,tmpData.filename);
-                    CFS_ls(fileDesc,tmpData.nodeid,options,newPath);
-                    DestroyString(&newPath);
-                }
-            }
+    }
+    free(sequences);
+    cfs->logHead = last == LOG_UNWRITTEN ? 0 : last + 1;
+    cfs->logSegmentOpen = cfs->logHead % LOG_SEGMENT_SLOTS != 0;
+    return 1;
+}
+
+// Moves the head of a log-structured cfs file to the next segment without current versions, in circular order,
+// or to a new segment at the end of the cfs file if there is none
+int CFS_LogNextSegment(CFS cfs) {
+    nodeid_t start = cfs->logHead/LOG_SEGMENT_SLOTS,segment,i;
+    for (i = 0; i < cfs->logSegments; i++) {
+        segment = (start + i) % cfs->logSegments;
+        if (cfs->logSegmentCurrent[segment] == 0) {
+            cfs->logHead = segment*LOG_SEGMENT_SLOTS;
+            cfs->logSegmentOpen = 1;
+            return 1;
         }
     }
-    if (!options[LS_ALL_ATTRIBUTES])
-        printf("\n");
+    segment = cfs->logSegments;
+    if (!CFS_LogExtend(cfs))
+        return 0;
+    cfs->logHead = segment*LOG_SEGMENT_SLOTS;
+    cfs->logSegmentOpen = 1;
+    return 1;
 }
 
-void CFS_ModifyFile(int fileDesc,unsigned int nodeid,char content[DATABLOCK_NUM],unsigned int size) {
-    MDS destData;
-    // Seek to file's metadata location in cfs file
-    lseek(fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    // Read file's metadata
-    read(fileDesc,&destData,sizeof(MDS));
-    // Modify the timestamps
-    time_t timestamp = time(NULL);
-    destData.modificationTime = timestamp;
-    // Modify content
-    memcpy(destData.data.datablocks,content,size);
-    // Modify size
-    destData.size = size;
-    // Seek again to file's metadata location in cfs file
-    lseek(fileDesc,-sizeof(MDS),SEEK_CUR);
-    // Write changes to cfs file
-    write(fileDesc,&destData,sizeof(MDS));
+// Writes a version of a node at the head of the log of a log-structured cfs file and points the inode map to it
+int CFS_LogWrite(CFS cfs,MDS *data) {
+    if (!cfs->logSegmentOpen && !CFS_LogNextSegment(cfs))
+        return 0;
+    nodeid_t slot = cfs->logHead;
+    nodeid_t old = data->nodeid < cfs->logMapCapacity ? cfs->logMap[data->nodeid] : LOG_UNWRITTEN;
+    data->sequence = ++cfs->logSequence;
+    if (!CFS_StoreNodeAt(cfs,slot,data) || !CFS_LogMapSet(cfs,data->nodeid,slot))
+        return 0;
+    if (old != LOG_UNWRITTEN)
+        cfs->logSegmentCurrent[old/LOG_SEGMENT_SLOTS]--;
+    else
+        cfs->logCurrent++;
+    cfs->logSegmentCurrent[slot/LOG_SEGMENT_SLOTS]++;
+    cfs->logHead++;
+    // The next version needs a new segment once this one is full
+    cfs->logSegmentOpen = cfs->logHead % LOG_SEGMENT_SLOTS != 0;
+    return 1;
 }
 
-// Copy a file with a specific nodeid and name to a directory with a specific id
-int CFS_CopyFile(CFS cfs,unsigned int nodeId,unsigned int destDirId,string filename,int prompt) {
-    char answer;
-    // If -i option is enabled ask the user before copying
-    if (prompt) {
-        do {
-            printf("Copy '%s'?(y/n)",filename);
-            answer = getPromptAnswer();
-        } while (answer != 'n' && answer != 'y');
-    } else {
-        answer = 'y';
+// Frees the segments with the fewest current versions by appending their current versions again at the head of the log,
+// until LOG_CLEAN_FREE_SEGMENTS segments are free or no segment is at least half dead
+int CFS_LogClean(CFS cfs) {
+    MDS *data = malloc(sizeof(MDS));
+    if (data == NULL) {
+        printf("Not enough memory.\n");
+        return 0;
     }
-    if (answer == 'y') {
-        // Get sourceFileData
-        MDS fileData;
-        // Seek to the wanted block metadata
-        lseek(cfs->fileDesc,sizeof(superblock) + nodeId * sizeof(MDS),SEEK_SET);
-        // Get it's metadata
-        read(cfs->fileDesc,&fileData,sizeof(MDS));
-        // Check if file exists in destination
-        int found;
-        unsigned int type;
-        unsigned int destFileId = getNodeIdFromName(cfs->fileDesc,filename,destDirId,&found,&type);
-        if (exists(cfs->fileDesc,filename,destDirId)) {
-            // If exists just change the content and modify the timestamps
-            CFS_ModifyFile(cfs->fileDesc,destFileId,fileData.data.datablocks,fileData.size);
-        } else {
-            // Create a new file in destination dir
-            destFileId = CFS_CreateFile(cfs,filename,destDirId,fileData.data.datablocks,fileData.size);
+    int ok = 1;
+    while (ok) {
+        nodeid_t segment,slot,victim = LOG_UNWRITTEN,freeSegments = 0,head = cfs->logHead/LOG_SEGMENT_SLOTS;
+        for (segment = 0; segment < cfs->logSegments; segment++) {
+            if (cfs->logSegmentCurrent[segment] == 0)
+                freeSegments++;
+            else if (segment != head && cfs->logSegmentCurrent[segment] <= LOG_SEGMENT_SLOTS/2 && (victim == LOG_UNWRITTEN || cfs->logSegmentCurrent[segment] < cfs->logSegmentCurrent[victim]))
+                victim = segment;
         }
-        return destFileId;
-    } else {
-        return 1;
+        if (freeSegments >= LOG_CLEAN_FREE_SEGMENTS || victim == LOG_UNWRITTEN)
+            break;
+        for (slot = victim*LOG_SEGMENT_SLOTS; ok && slot < (victim + 1)*LOG_SEGMENT_SLOTS && cfs->logSegmentCurrent[victim] > 0; slot++) {
+            ok = CFS_ReadNodeMetadataAt(cfs,slot,data);
+            if (ok && data->sequence != 0 && data->nodeid < cfs->logMapCapacity && cfs->logMap[data->nodeid] == slot)
+                ok = CFS_ReadNodeAt(cfs,slot,data) && CFS_LogWrite(cfs,data);
+        }
+        // Counters that do not match the slots would make the same victim come up again
+        ok = ok && cfs->logSegmentCurrent[victim] == 0;
     }
+    free(data);
+    return ok;
 }
 
-void CFS_CopyDirectoryContents(CFS cfs,unsigned int sourceDirNodeId,unsigned int destDirNodeId,int options[3]) {
-    MDS dirData;
-    // Seek to the wanted block metadata
-    lseek(cfs->fileDesc,sizeof(superblock) + sourceDirNodeId * sizeof(MDS),SEEK_SET);
-    // Get it's metadata
-    read(cfs->fileDesc,&dirData,sizeof(MDS));
-    if (dirData.type == TYPE_DIRECTORY) {
-        // Loop through every content in source directory
-        unsigned int i,curId;
-        MDS tmpData;
-        for (i = 0; i < dirData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)); i++) {
-            // Get id of the current entity
-            curId = *(unsigned int*)(dirData.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-            // Get name of the current entity
-            string filename = dirData.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int);
-            // Seek to the current entity metadata
-            lseek(cfs->fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
-            // Get it's metadata
-            read(cfs->fileDesc,&tmpData,sizeof(MDS));
-            // Determine ith entity type
-            if (tmpData.type == TYPE_DIRECTORY) {
-                // Directory
-                // Ignore . and .. directories and sane destimation directory to avoid infinite loop
-                if (strcmp(".",filename) && strcmp("..",filename) && tmpData.nodeid != destDirNodeId) {
-                    // Recursively copy only with -r option
-                    if (options[CP_RECURSIVELY_COPY_DIRECTORIES]) {
-                        unsigned int newDirId = CFS_CreateDirectory(cfs,filename,destDirNodeId);
-                        if (newDirId != 0) {
-                            char answer;
-                            // If -i option is enabled ask the user before copying
-                            if (options[CP_PROMPT]) {
-                                do {
-                                    printf("Copy '%s'?(y/n)",filename);
-                                    answer = getPromptAnswer();
-                                } while (answer != 'n' && answer != 'y');
-                            } else {
-                                answer = 'y';
-                            }
-                            if (answer == 'y')
-                                CFS_CopyDirectoryContents(cfs,curId,newDirId,options);
-                        } else {
-                            printf("Not enough space for new directory\n");
-                            return;
-                        }
-                    }
-                }
-            } else if (tmpData.type == TYPE_FILE) {
-                if(!CFS_CopyFile(cfs,curId,destDirNodeId,filename,options[CP_PROMPT]))
-                    printf("Not enough space to copy file %s\n",filename);
-            }
-        }
-    }
+// Appends a version of a node to the log of a log-structured cfs file.
+// The cleaner runs whenever that makes the cfs file grow while at least half of it's slots do not hold current versions.
+int CFS_LogAppend(CFS cfs,MDS *data) {
+    nodeid_t segments = cfs->logSegments;
+    if (!CFS_LogWrite(cfs,data))
+        return 0;
+    // A cleaner that fails leaves every node pointing to a valid version, so the write still stands
+    if (cfs->logSegments > segments && cfs->logSegments >= LOG_CLEAN_MIN_SEGMENTS && 2*cfs->logCurrent <= cfs->logSegments*LOG_SEGMENT_SLOTS)
+        CFS_LogClean(cfs);
+    return 1;
 }
 
-int CFS_MoveSource(CFS cfs,unsigned int sourcedirid,string sourcename,unsigned int destDirId,string destname,int prompt) {
-    char answer;
-    // If -i option is enabled ask the user before copying
-    if (prompt) {
-        do {
-            printf("Move '%s'?(y/n)",sourcename);
-            answer = getPromptAnswer();
-        } while (answer != 'n' && answer != 'y');
-    } else {
-        answer = 'y';
+// Moves the current versions of a log-structured cfs file to it's first slots, keeping their order, and releases the
+// segments after them. Versions get new sequence numbers so that an interrupted compaction leaves only dead versions behind.
+int CFS_LogCompact(CFS cfs) {
+    nodeid_t slot,nodeid,next = 0,slots = cfs->logSegments*LOG_SEGMENT_SLOTS,segments;
+    nodeid_t *owners = malloc((slots > 0 ? slots : 1)*sizeof(nodeid_t));
+    MDS *data = malloc(sizeof(MDS));
+    if (owners == NULL || data == NULL) {
+        printf("Not enough memory.\n");
+        free(owners);
+        free(data);
+        return 0;
     }
-    if (answer == 'y') {
-        // Get source node data
-        MDS sourceDirdata;
-        // Seek to the current block metadata
-        lseek(cfs->fileDesc,sizeof(superblock) + sourcedirid * sizeof(MDS),SEEK_SET);
-        // Get it's metadata
-        read(cfs->fileDesc,&sourceDirdata,sizeof(MDS));
-        // Search all the entities until we find the id of the wanted one
-        unsigned int i,curId;
-        MDS tmpData;
-        for (i = 0; i < sourceDirdata.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)); i++) {
-            // Get id of the current entity
-            curId = *(unsigned int*)(sourceDirdata.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-            // Get name of the current entity
-            string filename = sourceDirdata.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int);
-            // Seek to the current entity metadata
-            lseek(cfs->fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
+    for (slot = 0; slot < slots; slot++)
+        owners[slot] = LOG_UNWRITTEN;
+    // Versions of nodes past NODE_COUNT are dead as well
+    for (nodeid = 0; nodeid < cfs->logMapCapacity; nodeid++) {
+        if (nodeid >= cfs->sb.NODE_COUNT)
+            cfs->logMap[nodeid] = LOG_UNWRITTEN;
+        else if (cfs->logMap[nodeid] != LOG_UNWRITTEN)
+            owners[cfs->logMap[nodeid]] = nodeid;
+    }
+    int ok = 1;
+    for (slot = 0; ok && slot < slots; slot++) {
+        if (owners[slot] == LOG_UNWRITTEN)
+            continue;
+        ok = CFS_ReadNodeAt(cfs,slot,data);
+        data->sequence = ++cfs->logSequence;
+        ok = ok && CFS_StoreNodeAt(cfs,next,data);
+        if (ok)
+            cfs->logMap[owners[slot]] = next++;
+    }
+    free(owners);
+    free(data);
+    if (!ok)
+        return 0;
+    segments = (next + LOG_SEGMENT_SLOTS - 1)/LOG_SEGMENT_SLOTS;
+    if (!CFS_TruncateSlots(cfs,segments*LOG_SEGMENT_SLOTS))
+        return 0;
+    for (slot = 0; slot < segments; slot++)
+        cfs->logSegmentCurrent[slot] = slot + 1 < segments || next % LOG_SEGMENT_SLOTS == 0 ? LOG_SEGMENT_SLOTS : next % LOG_SEGMENT_SLOTS;
+    cfs->logSegments = segments;
+    cfs->logCurrent = cfs->logHead = next;
+    cfs->logSegmentOpen = next % LOG_SEGMENT_SLOTS != 0;
+    cfs->sb.RESERVED_NODES = segments*LOG_SEGMENT_SLOTS;
+    return CFS_SyncSuperblock(cfs);
+}
+
+// Writes a node to it's location in the cfs file (log-structured cfs files: appends a new version of it)
+int CFS_StoreNode(CFS cfs,MDS *data) {
+    if (cfs->logMap != NULL)
+        return CFS_LogAppend(cfs,data);
+    return CFS_StoreNodeAt(cfs,data->nodeid,data);
+}
+
+// Appends a node to the cfs file and returns it's id
+nodeid_t CFS_AppendNodeId(CFS cfs) {
+    nodeid_t count = CFS_NodeCount(cfs);
+    // Log-structured cfs files reserve slots as the versions are appended
+    if (cfs->logMap == NULL)
+        CFS_ReserveNodes(cfs,count + 1);
+    cfs->sb.NODE_COUNT = count + 1;
+    CFS_SyncSuperblock(cfs);
+    return count;
+}
+
+// Called before the live tree overwrites a node: if a snapshot still sees the node's current version
+// (it was last written at or before the latest snapshot) a copy of it is appended to the cfs file.
+// Copies are appended rather than placed in holes so that they never take the place of nodes a rollback restores.
+void CFS_SnapshotPreserve(CFS cfs,nodeid_t nodeid) {
+    if (cfs->sb.SNAPSHOT_COUNT == 0 || nodeid >= CFS_NodeCount(cfs))
+        return;
+    MDS old;
+    // Nodes that were never written read back as zeros and live nodes' epochs start at 1
+    if (!CFS_ReadNodeMetadata(cfs,nodeid,&old) || old.deleted || old.snapshot || old.epoch == 0 || old.epoch > cfs->sb.SNAPSHOTS[cfs->sb.SNAPSHOT_COUNT - 1].epoch)
+        return;
+    CFS_ReadNode(cfs,nodeid,&old);
+    old.nodeid = CFS_AppendNodeId(cfs);
+    old.origin = nodeid;
+    old.snapshot = 1;
+    old.epoch_end = cfs->sb.EPOCH - 1;
+    cfs->sb.SNAPSHOT_NODES++;
+    CFS_MetaTableRecord(cfs,&old);
+    CFS_StoreNode(cfs,&old);
+    CFS_SyncSuperblock(cfs);
+}
+
+// Stamps a node of the live tree with the current epoch, preserving it's previous version if needed
+void CFS_SnapshotStamp(CFS cfs,MDS *data) {
+    if (data->snapshot)
+        return;
+    CFS_SnapshotPreserve(cfs,data->nodeid);
+    data->epoch = cfs->sb.EPOCH;
+}
+
+// Writes a node of the live tree (or a change to a snapshot copy) to the cfs file
+int CFS_WriteNode(CFS cfs,MDS *data) {
+    CFS_SnapshotStamp(cfs,data);
+    CFS_MetaTableRecord(cfs,data);
+    return CFS_StoreNode(cfs,data);
+}
+
+// Writes only a node's metadata (it's datablocks are left as they are)
+int CFS_WriteNodeMetadata(CFS cfs,MDS *data) {
+    CFS_SnapshotStamp(cfs,data);
+    CFS_MetaTableRecord(cfs,data);
+    nodeid_t slot = cfs->logMap != NULL && data->nodeid < cfs->logMapCapacity ? cfs->logMap[data->nodeid] : LOG_UNWRITTEN;
+    if (slot != LOG_UNWRITTEN && slot + 1 == cfs->logHead && cfs->logSegmentOpen) {
+        // The version at the end of the log (e.g. a directory written right before it's aggregates are updated)
+        // is amended in place, with a new sequence number since the caller's copy may come from an older version
+        data->sequence = ++cfs->logSequence;
+    } else if (cfs->logMap != NULL) {
+        // Other versions in the log are never overwritten so the whole node is appended
+        MDS node;
+        if (!CFS_ReadNode(cfs,data->nodeid,&node))
+            return 0;
+        memcpy(&node,data,offsetof(MDS,data));
+        return CFS_LogAppend(cfs,&node);
+    }
+    slot = CFS_NodeSlot(cfs,data->nodeid);
+    off_t offset = CFS_SlotOffset(cfs,slot);
+    int fd = CFS_SlotDesc(cfs,slot);
+    if (cfs->BLOCK_SIZE > 1) {
+        // The metadata share the node's 1st block with the start of the datablocks
+        char *buffer = BufferPool_Get(cfs->buffers);
+        if (buffer == NULL)
+            return 0;
+        int ok = pread(fd,buffer,cfs->BLOCK_SIZE,offset) == cfs->BLOCK_SIZE;
+        memcpy(buffer,data,offsetof(MDS,data));
+        ok = ok && pwrite(fd,buffer,cfs->BLOCK_SIZE,offset) == cfs->BLOCK_SIZE;
+        BufferPool_Put(cfs->buffers,buffer);
+        return ok;
+    }
+    return pwrite(fd,data,offsetof(MDS,data),offset) == offsetof(MDS,data);
+}
+
+// Nodes of one member of the cfs file whose metadata are recorded by a thread when the metadata table is rebuilt
+typedef struct {
+    CFS cfs;
+    unsigned int member;
+    nodeid_t count;
+} metaRebuild;
+
+void *CFS_MetaRebuildWorker(void *arg) {
+    metaRebuild *rebuild = arg;
+    nodeid_t nodeid;
+    MDS data;
+    for (nodeid = rebuild->member; rebuild->cfs->meta != NULL && nodeid < rebuild->count; nodeid += rebuild->cfs->stripes) {
+        if (CFS_ReadNodeMetadata(rebuild->cfs,nodeid,&data)) {
+            data.nodeid = nodeid;
+            CFS_MetaTableRecord(rebuild->cfs,&data);
+        }
+    }
+    return NULL;
+}
+
+// Opens the working cfs file's metadata table, rebuilding it from the nodes if it is missing, belongs to another
+// image or was not closed cleanly. Without a table (e.g. in a read-only directory) queries read the nodes instead.
+void CFS_OpenMetaTable(CFS cfs,int rebuild) {
+    string path = malloc(strlen(cfs->currentFile) + strlen(".meta") + 1);
+    struct stat st;
+    int valid;
+    cfs->meta = NULL;
+    if (path == NULL) {
+        printf("Not enough memory.\n");
+        return;
+    }
+    sprintf(path,"%s.meta",cfs->currentFile);
+    if (fstat(cfs->fileDesc,&st) == 0 && MetaTable_Open(&cfs->meta,path,st.st_dev,st.st_ino,&valid)
+        && (rebuild || !valid || MetaTable_Count(cfs->meta) != CFS_NodeCount(cfs))) {
+        nodeid_t count = CFS_NodeCount(cfs);
+        metaRebuild rebuilds[MAX_STRIPES];
+        pthread_t threads[MAX_STRIPES];
+        unsigned int member,started = 0;
+        // Rows are sized up front so that the threads only set their own
+        if (!MetaTable_Resize(cfs->meta,count))
+            MetaTable_Close(&cfs->meta);
+        // The members of a striped cfs file are read in parallel, the 1st one by this thread
+        for (member = 0; member < cfs->stripes; member++) {
+            rebuilds[member].cfs = cfs;
+            rebuilds[member].member = member;
+            rebuilds[member].count = count;
+        }
+        for (member = 1; member < cfs->stripes; member++) {
+            if (pthread_create(&threads[started],NULL,CFS_MetaRebuildWorker,&rebuilds[member]) != 0)
+                CFS_MetaRebuildWorker(&rebuilds[member]);
+            else
+                started++;
+        }
+        CFS_MetaRebuildWorker(&rebuilds[0]);
+        for (member = 0; member < started; member++)
+            pthread_join(threads[member],NULL);
+    }
+    free(path);
+}
+
+// Reads the attributes kept in the metadata table (everything but the name and the aggregates),
+// from the table if there is one and from the node otherwise
+int CFS_ReadNodeAttributes(CFS cfs,nodeid_t nodeid,MDS *data) {
+    if (cfs->meta == NULL || nodeid >= MetaTable_Count(cfs->meta))
+        return CFS_ReadNodeMetadata(cfs,nodeid,data);
+    unsigned char state = MetaTable_States(cfs->meta)[nodeid];
+    data->nodeid = nodeid;
+    data->deleted = state == METATABLE_DELETED;
+    data->type = data->deleted ? TYPE_FILE : state;
+    data->size = MetaTable_Sizes(cfs->meta)[nodeid];
+    data->links = MetaTable_Links(cfs->meta)[nodeid];
+    data->parent_nodeid = MetaTable_Parents(cfs->meta)[nodeid];
+    data->creation_time = MetaTable_CreationTimes(cfs->meta)[nodeid];
+    data->accessTime = MetaTable_AccessTimes(cfs->meta)[nodeid];
+    data->modificationTime = MetaTable_ModificationTimes(cfs->meta)[nodeid];
+    return 1;
+}
+
+// 1 if the node is a hole that a new entity can take
+int CFS_NodeDeleted(CFS cfs,nodeid_t nodeid) {
+    if (cfs->meta != NULL && nodeid < MetaTable_Count(cfs->meta))
+        return MetaTable_States(cfs->meta)[nodeid] == METATABLE_DELETED;
+    MDS data;
+    CFS_ReadNodeMetadata(cfs,nodeid,&data);
+    return data.deleted;
+}
+
+int CFS_Init(CFS *cfs) {
+    // Initialize cfs structure
+    if ((*cfs = malloc(sizeof(struct cfs))) == NULL) {
+        // Not enough memory for cfs structure
+        return 0;
+    }
+    // No initial current working file
+    memset((*cfs)->currentFile,0,PATH_MAX);
+    (*cfs)->fileDesc = -1;
+    (*cfs)->buffers = NULL;
+    (*cfs)->meta = NULL;
+    (*cfs)->map = NULL;
+    (*cfs)->logMap = NULL;
+    (*cfs)->direct = 0;
+    (*cfs)->stripes = 1;
+    setlocale(LC_TIME, "el_GR.utf8");
+    return 1;
+}
+
+// Directory datablocks layout:
+// A header with the number of entries followed by the packed entries growing forwards.
+// Each entry is the entity's nodeid, it's type, the name's length and the null terminated name.
+// The fingerprints of the entries' names are kept at the end of the datablocks and grow backwards
+// (the fingerprint of the ith entry is stored in datablocks[MAX_FILE_SIZE - 1 - i])
+typedef struct {
+    unsigned int entries;
+} directoryHeader;
+
+#define DIRECTORY_ENTRY_HEADER_SIZE (sizeof(nodeid_t) + 2*sizeof(char))
+// Smallest entry (1 character name) together with it's fingerprint
+#define MIN_DIRECTORY_ENTRY_SIZE (DIRECTORY_ENTRY_HEADER_SIZE + 2*sizeof(char) + 1)
+
+unsigned int CFS_DirectoryEntryCount(MDS *dirData) {
+    return ((directoryHeader*)dirData->data.datablocks)->entries;
+}
+
+// Bytes that an entry with a specific name occupies in a directory
+unsigned int CFS_DirectoryEntrySize(string name) {
+    return DIRECTORY_ENTRY_HEADER_SIZE + strlen(name) + 1;
+}
+
+// Offset of the 1st entry in the directory's datablocks
+unsigned int CFS_DirectoryFirstEntry() {
+    return sizeof(directoryHeader);
+}
+
+// Offset of the entry following the one in the given offset
+unsigned int CFS_DirectoryNextEntry(MDS *dirData,unsigned int offset) {
+    return offset + DIRECTORY_ENTRY_HEADER_SIZE + (unsigned char)dirData->data.datablocks[offset + sizeof(nodeid_t) + 1] + 1;
+}
+
+nodeid_t CFS_DirectoryEntryId(MDS *dirData,unsigned int offset) {
+    nodeid_t id;
+    memcpy(&id,dirData->data.datablocks + offset,sizeof(nodeid_t));
+    return id;
+}
+
+unsigned int CFS_DirectoryEntryType(MDS *dirData,unsigned int offset) {
+    return dirData->data.datablocks[offset + sizeof(nodeid_t)];
+}
+
+string CFS_DirectoryEntryName(MDS *dirData,unsigned int offset) {
+    return dirData->data.datablocks + offset + DIRECTORY_ENTRY_HEADER_SIZE;
+}
+
+// Offset of the ith entry in the directory's datablocks
+unsigned int CFS_DirectoryEntryOffset(MDS *dirData,unsigned int i) {
+    unsigned int offset = CFS_DirectoryFirstEntry();
+    while (i-- > 0)
+        offset = CFS_DirectoryNextEntry(dirData,offset);
+    return offset;
+}
+
+unsigned char *CFS_DirectoryFingerprints(CFS cfs,MDS *dirData) {
+    return (unsigned char*)dirData->data.datablocks + cfs->MAX_FILE_SIZE - CFS_DirectoryEntryCount(dirData);
+}
+
+// Directories of sealed cfs files keep their entries after . and .. sorted by name and, in the place of the
+// fingerprints, a table with the 16 bit offset of every entry so that lookups are binary searches.
+// Directories without room for the table keep their fingerprints (both sides decide that from the directory's size).
+int CFS_DirectoryIndexed(CFS cfs,MDS *dirData) {
+    return cfs->sb.SEALED && dirData->size + 2*CFS_DirectoryEntryCount(dirData) <= cfs->MAX_FILE_SIZE;
+}
+
+unsigned int CFS_DirectoryIndexOffset(CFS cfs,MDS *dirData,unsigned int i) {
+    uint16_t offset;
+    memcpy(&offset,dirData->data.datablocks + cfs->MAX_FILE_SIZE - 2*(CFS_DirectoryEntryCount(dirData) - i),sizeof(uint16_t));
+    return offset;
+}
+
+// Checks if a new entry with the given name fits in a directory (both the entry and it's fingerprint)
+// and the name respects the cfs file's FILENAME_SIZE
+int CFS_DirectoryFits(CFS cfs,MDS *dirData,string name) {
+    unsigned int entries = CFS_DirectoryEntryCount(dirData);
+    return entries <= cfs->MAX_DIRECTORY_FILE_NUMBER && strlen(name) < cfs->FILENAME_SIZE && dirData->size + CFS_DirectoryEntrySize(name) + entries + 1 <= cfs->MAX_FILE_SIZE;
+}
+
+// Appends an entry to a directory (fitting must be checked before)
+void CFS_DirectoryAddEntry(CFS cfs,MDS *dirData,nodeid_t nodeid,unsigned int type,string name) {
+    char *entry = dirData->data.datablocks + dirData->size;
+    unsigned int i = CFS_DirectoryEntryCount(dirData);
+    memcpy(entry,&nodeid,sizeof(nodeid_t));
+    entry[sizeof(nodeid_t)] = type;
+    entry[sizeof(nodeid_t) + 1] = strlen(name);
+    strcpy(entry + DIRECTORY_ENTRY_HEADER_SIZE,name);
+    dirData->size += CFS_DirectoryEntrySize(name);
+    dirData->data.datablocks[cfs->MAX_FILE_SIZE - 1 - i] = Fingerprint_Compute(name);
+    ((directoryHeader*)dirData->data.datablocks)->entries++;
+}
+
+// Initializes an empty directory with it's . and .. shortcuts (hardlinks)
+void CFS_DirectoryInit(CFS cfs,MDS *dirData) {
+    ((directoryHeader*)dirData->data.datablocks)->entries = 0;
+    dirData->size = sizeof(directoryHeader);
+    CFS_DirectoryAddEntry(cfs,dirData,dirData->nodeid,TYPE_DIRECTORY,".");
+    CFS_DirectoryAddEntry(cfs,dirData,dirData->parent_nodeid,TYPE_DIRECTORY,"..");
+}
+
+// Returns the index of the entry with the given name in a directory or -1 if it does not exist
+// The entry's offset is stored in offset if found
+int CFS_DirectoryFindEntry(CFS cfs,MDS *dirData,string name,unsigned int *offset) {
+    unsigned int entries = CFS_DirectoryEntryCount(dirData);
+    if (CFS_DirectoryIndexed(cfs,dirData)) {
+        int low = 2,high = (int)entries - 1,middle,comparison;
+        // . and .. are not part of the sorted entries
+        if (!strcmp(".",name) || !strcmp("..",name)) {
+            *offset = CFS_DirectoryEntryOffset(dirData,name[1] == '.');
+            return name[1] == '.';
+        }
+        while (low <= high) {
+            middle = (low + high)/2;
+            *offset = CFS_DirectoryIndexOffset(cfs,dirData,middle);
+            if ((comparison = strcmp(name,CFS_DirectoryEntryName(dirData,*offset))) == 0)
+                return middle;
+            if (comparison < 0)
+                high = middle - 1;
+            else
+                low = middle + 1;
+        }
+        return -1;
+    }
+    unsigned char *fingerprints = CFS_DirectoryFingerprints(cfs,dirData);
+    unsigned char fingerprint = Fingerprint_Compute(name);
+    unsigned int length = strlen(name);
+    // Only compare names of the entries whose fingerprints match. The candidates come in the entries' order,
+    // so the offset moves forward from one candidate to the next rather than from the 1st entry every time.
+    unsigned int k = Fingerprint_FindPrevious(fingerprints,entries,fingerprint,entries),i = 0;
+    *offset = CFS_DirectoryFirstEntry();
+    while (k < entries) {
+        for (; i < entries - 1 - k; i++)
+            *offset = CFS_DirectoryNextEntry(dirData,*offset);
+        if ((unsigned char)dirData->data.datablocks[*offset + sizeof(nodeid_t) + 1] == length && !strcmp(name,CFS_DirectoryEntryName(dirData,*offset)))
+            return i;
+        k = Fingerprint_FindPrevious(fingerprints,entries,fingerprint,k);
+    }
+    return -1;
+}
+
+// Removes the ith entry (located at offset) and it's fingerprint from a directory
+void CFS_DirectoryRemoveEntry(CFS cfs,MDS *dirData,unsigned int i,unsigned int offset) {
+    unsigned int entries = CFS_DirectoryEntryCount(dirData);
+    unsigned int next = CFS_DirectoryNextEntry(dirData,offset);
+    unsigned char *fingerprints = CFS_DirectoryFingerprints(cfs,dirData);
+    // Move the next entries left to fill the gap
+    memmove(dirData->data.datablocks + offset,dirData->data.datablocks + next,dirData->size - next);
+    dirData->size -= next - offset;
+    if (i < entries - 1)
+        memmove(fingerprints + 1,fingerprints,entries - i - 1);
+    fingerprints[0] = 0;
+    ((directoryHeader*)dirData->data.datablocks)->entries--;
+}
+
+// Adds a change of a directory's contents to the subtree aggregates of the directory and all of it's ancestors
+// Callers must have written their copy of the directory before, since only the metadata are updated
+void CFS_PropagateSubtreeDelta(CFS cfs,nodeid_t dirnodeid,int64_t bytes,int64_t entries) {
+    MDS data;
+    if (bytes == 0 && entries == 0)
+        return;
+    while (1) {
+        CFS_ReadNodeMetadata(cfs,dirnodeid,&data);
+        data.subtree_bytes += bytes;
+        data.subtree_entries += entries;
+        CFS_WriteNodeMetadata(cfs,&data);
+        if (data.root)
+            break;
+        dirnodeid = data.parent_nodeid;
+    }
+}
+
+// The directories of a file's names are parent_nodeid and the 1st links of link_parents
+// (a directory holding several of the names is there once for each of them)
+
+// Replaces one occurrence of directory from among the directories of a file's names with directory to
+void CFS_MoveFileName(MDS *fileData,nodeid_t from,nodeid_t to) {
+    unsigned int j;
+    if (fileData->parent_nodeid == from) {
+        fileData->parent_nodeid = to;
+        return;
+    }
+    for (j = 0; j < fileData->links; j++) {
+        if (fileData->link_parents[j] == from) {
+            fileData->link_parents[j] = to;
+            return;
+        }
+    }
+}
+
+// Drops one occurrence of directory dirnodeid from the directories of a hard linked file's names
+void CFS_DropFileName(MDS *fileData,nodeid_t dirnodeid) {
+    CFS_MoveFileName(fileData,dirnodeid,fileData->link_parents[fileData->links - 1]);
+    fileData->links--;
+}
+
+// Adds a file's size change to every directory holding one of it's names (and their ancestors)
+void CFS_PropagateFileResize(CFS cfs,MDS *fileData,int64_t bytes) {
+    unsigned int j;
+    CFS_PropagateSubtreeDelta(cfs,fileData->parent_nodeid,bytes,0);
+    for (j = 0; j < fileData->links; j++)
+        CFS_PropagateSubtreeDelta(cfs,fileData->link_parents[j],bytes,0);
+}
+
+// Points the directories of a file's names to the ids that cfs_compact or cfs_seal gave them
+void CFS_RenumberFileNames(MDS *fileData,nodeid_t *idMap) {
+    unsigned int j;
+    fileData->parent_nodeid = idMap[fileData->parent_nodeid];
+    for (j = 0; j < fileData->links; j++)
+        fileData->link_parents[j] = idMap[fileData->link_parents[j]];
+}
+
+nodeid_t getNodeIdFromName(CFS cfs,string name,nodeid_t nodeid,int *found,unsigned int *type) {
+    *found = 1;
+    MDS data;
+    // Get it's metadata
+    CFS_ReadNode(cfs,nodeid,&data);
+    // Determine data type
+    if (data.type == TYPE_DIRECTORY) {
+        // Directory
+        // Search the directory entries whose fingerprints match the wanted name
+        unsigned int offset;
+        *found = 0;
+        if (CFS_DirectoryFindEntry(cfs,&data,name,&offset) != -1) {
+            // Found (the type is kept in the directory entry so there is no need to read the entity)
+            *found = 1;
+            *type = CFS_DirectoryEntryType(&data,offset);
+            return CFS_DirectoryEntryId(&data,offset);
+        }
+    } else {
+        *found = 0;
+    }
+    return data.nodeid;
+}
+
+// Checks if an entity with a specific name exists in a specific directory
+int exists(CFS cfs,string name,nodeid_t dirnodeid) {
+    int found;
+    unsigned int type;
+    getNodeIdFromName(cfs,name,dirnodeid,&found,&type);
+    return found;
+}
+
+location getPathLocation(CFS cfs,string path,nodeid_t nodeid,int ignoreLastEntity) {
+    string entityName = strtok(path,"/");
+    // Determine path type
+    if (path[0] == '/') {
+        // Absolute path so start searching from the root
+        nodeid = 0;
+    }
+    int found;
+    location ret;
+    ret.nodeid = nodeid;
+    ret.filenanme = "/";
+    ret.type = TYPE_DIRECTORY;
+    ret.valid = 1;
+    while (entityName != NULL){
+        nodeid = getNodeIdFromName(cfs,entityName,nodeid,&found,&ret.type);
+        ret.filenanme = entityName;
+        // Not found
+        if (!found) {
+            // Check if we reached the last entity and we want to ignore it (for mkdir,touch,cp,cat,ln,mv commands)
+            if (ignoreLastEntity && strtok(NULL,"/") == NULL) {
+                ret.nodeid = nodeid;
+                ret.valid = 1;
+            } else {
+                ret.valid = 0;
+                ret.nodeid = 0;
+            }
+            break;
+        } else {
+            ret.valid = 1;
+            entityName = strtok(NULL,"/");
+            if (!(ignoreLastEntity && entityName == NULL)) {
+                ret.nodeid = nodeid;
+            }
+        }
+    }
+    return ret;
+}
+
+nodeid_t CFS_GetFirstAvailableNodeId(CFS cfs,nodeid_t count) {
+    // Return the id of the 1st hole or last node id + 1 if no holes exist
+    nodeid_t nodeid;
+    // The metadata table's states column is searched at once
+    if (cfs->meta != NULL && MetaTable_Count(cfs->meta) == count)
+        return MetaTable_FindState(cfs->meta,METATABLE_DELETED,0);
+    // Continue reading node's metadata until a hole is found or we reach the end of the cfs file
+    for (nodeid = 0; nodeid < count; nodeid++) {
+        // Hole found
+        if (CFS_NodeDeleted(cfs,nodeid))
+            return nodeid;
+    }
+    // End of file reached so new node will be placed there
+    return count;
+}
+
+nodeid_t CFS_GetNearestAvailableNodeId(CFS cfs,nodeid_t parent,nodeid_t count) {
+    // Search outwards from the parent, preferring the node after it so that scans keep reading forward.
+    // The end of the cfs file counts as a hole at distance count - parent.
+    nodeid_t distance;
+    for (distance = 1; parent + distance < count; distance++) {
+        if (CFS_NodeDeleted(cfs,parent + distance))
+            return parent + distance;
+        if (distance <= parent && CFS_NodeDeleted(cfs,parent - distance))
+            return parent - distance;
+    }
+    return count;
+}
+
+nodeid_t CFS_GetSpreadAvailableNodeId(CFS cfs,nodeid_t count) {
+    // Place the directory in the allocation group with the most holes so that it's children find room next to it.
+    // If no group is at least a quarter empty start using the end of the cfs file instead.
+    nodeid_t nodeid,groupHole = 0,bestHole = count;
+    unsigned int groupFree = 0,bestFree = 0;
+    for (nodeid = 0; nodeid < count; nodeid++) {
+        if (nodeid % ALLOCATION_GROUP_SIZE == 0)
+            groupFree = 0;
+        if (CFS_NodeDeleted(cfs,nodeid) && groupFree++ == 0)
+            groupHole = nodeid;
+        if (groupFree > bestFree) {
+            bestFree = groupFree;
+            bestHole = groupHole;
+        }
+    }
+    if (bestFree < ALLOCATION_GROUP_SIZE/4)
+        return count;
+    return bestHole;
+}
+
+nodeid_t CFS_GetNextAvailableNodeId(CFS cfs,nodeid_t parent,unsigned int type) {
+    nodeid_t nodeid,count = CFS_NodeCount(cfs);
+    if (cfs->ALLOCATION_POLICY == ALLOCATE_NEAR) {
+        if (type == TYPE_DIRECTORY && parent == 0)
+            nodeid = CFS_GetSpreadAvailableNodeId(cfs,count);
+        else
+            nodeid = CFS_GetNearestAvailableNodeId(cfs,parent,count);
+    } else {
+        nodeid = CFS_GetFirstAvailableNodeId(cfs,count);
+    }
+    // The new node is appended to the cfs file
+    if (nodeid == count)
+        CFS_AppendNodeId(cfs);
+    return nodeid;
+}
+
+nodeid_t CFS_CreateDirectory(CFS cfs,string name,nodeid_t nodeid) {
+    // Get location directory data
+    MDS locationData;
+    CFS_ReadNode(cfs,nodeid,&locationData);
+    // Check if new directory fits in directory
+    if (!CFS_DirectoryFits(cfs,&locationData,name))
+        return 0;
+    MDS data;
+    // Initialize metadata bytes to 0 to avoid valgrind errors
+    memset(&data,0,sizeof(MDS));
+    // Initialize directory metadata
+    data.deleted = 0;
+    data.root = 0;
+    data.links = 0;
+    data.nodeid = CFS_GetNextAvailableNodeId(cfs,nodeid,TYPE_DIRECTORY);
+    strcpy(data.filename,name);
+    data.size = 0;
+    data.type = TYPE_DIRECTORY;
+    data.parent_nodeid = nodeid;
+    time_t timer = time(NULL);
+    data.creation_time = data.accessTime = data.modificationTime = timer;
+    // Create . and .. shortcuts (hardlinks)
+    CFS_DirectoryInit(cfs,&data);
+    // Write directory data to cfs file
+    CFS_WriteNode(cfs,&data);
+    // Write directory descriptor and name to node's list
+    CFS_DirectoryAddEntry(cfs,&locationData,data.nodeid,TYPE_DIRECTORY,name);
+    CFS_WriteNode(cfs,&locationData);
+    // Update counters
+    cfs->sb.LIVE_NODES++;
+    cfs->sb.DIRECTORY_COUNT++;
+    CFS_SyncSuperblock(cfs);
+    CFS_PropagateSubtreeDelta(cfs,nodeid,0,1);
+    CFS_RecordChange(cfs,CHANGE_CREATE,data.nodeid,nodeid,name);
+    return data.nodeid;
+}
+
+// Creates a file modified at modificationTime (imports pass the host file's, so that later updates can tell if it changed)
+nodeid_t CFS_CreateFile(CFS cfs,string name,nodeid_t dirnodeid,char content[DATABLOCK_NUM],uint64_t size,time_t modificationTime) {
+    // Get location directory data
+    MDS locationData;
+    CFS_ReadNode(cfs,dirnodeid,&locationData);
+    // Check if new file fits in directory
+    if (!CFS_DirectoryFits(cfs,&locationData,name))
+        return 0;
+    MDS data;
+    // Initialize metadata bytes to 0 to avoid valgrind errors
+    memset(&data,0,sizeof(MDS));
+    // Initialize file metadata
+    data.deleted = 0;
+    data.root = 0;
+    data.links = 0;
+    data.nodeid = CFS_GetNextAvailableNodeId(cfs,dirnodeid,TYPE_FILE);
+    strcpy(data.filename,name);
+    data.size = size;
+    data.type = TYPE_FILE;
+    data.parent_nodeid = dirnodeid;
+    time_t timer = time(NULL);
+    data.creation_time = data.accessTime = timer;
+    data.modificationTime = modificationTime;
+    // Write content to datablocks
+    memcpy(data.data.datablocks,content,size);
+    // Write file data to cfs file
+    CFS_WriteNode(cfs,&data);
+    // Write file descriptor and name to directory's node list
+    CFS_DirectoryAddEntry(cfs,&locationData,data.nodeid,TYPE_FILE,name);
+    CFS_WriteNode(cfs,&locationData);
+    // Update counters
+    cfs->sb.LIVE_NODES++;
+    cfs->sb.FILE_BYTES += size;
+    CFS_SyncSuperblock(cfs);
+    CFS_PropagateSubtreeDelta(cfs,dirnodeid,size,1);
+    CFS_RecordChange(cfs,CHANGE_CREATE,data.nodeid,dirnodeid,name);
+    return data.nodeid;
+}
+
+// Returns 0 if the link does not fit in the directory and -1 if the file has MAX_LINKS links already
+int CFS_CreateHardLink(CFS cfs,string outputfilename,nodeid_t sourcenodeid,nodeid_t dirnodeid) {
+    // Get source node id data
+    MDS sourceData;
+    CFS_ReadNode(cfs,sourcenodeid,&sourceData);
+    if (sourceData.links == MAX_LINKS)
+        return -1;
+    // Get parent directory data
+    MDS parentData;
+    CFS_ReadNode(cfs,dirnodeid,&parentData);
+    // Check if new link fits in directory
+    if (!CFS_DirectoryFits(cfs,&parentData,outputfilename))
+        return 0;
+    // Write shortcut descriptor to parent directory's node list
+    CFS_DirectoryAddEntry(cfs,&parentData,sourcenodeid,TYPE_FILE,outputfilename);
+    CFS_WriteNode(cfs,&parentData);
+    // Increase source # of links and record the new name's directory
+    sourceData.link_parents[sourceData.links++] = dirnodeid;
+    // Write updated source data back to cfs file
+    CFS_WriteNode(cfs,&sourceData);
+    // Update counters
+    cfs->sb.HARD_LINKS++;
+    CFS_SyncSuperblock(cfs);
+    CFS_PropagateSubtreeDelta(cfs,dirnodeid,sourceData.size,1);
+    CFS_RecordChange(cfs,CHANGE_LINK,sourcenodeid,dirnodeid,outputfilename);
+    return 1;
+}
+
+// Determines whether a directory is empty or not
+int CFS_DirectoryIsEmpty(CFS cfs,nodeid_t nodeId) {
+    //Get directory data
+    MDS data;
+    CFS_ReadNode(cfs,nodeId,&data);
+    // A cfs directory is empty only when it's only contents are . and .. shortcuts
+    return data.type == TYPE_DIRECTORY && CFS_DirectoryEntryCount(&data) == 2;
+}
+
+// Releases the host disk space of a deleted node's datablocks, leaving it's metadata in place
+int CFS_PunchNode(CFS cfs,nodeid_t nodeId) {
+    // The deleted version of a node of a log-structured cfs file is it's current one, the cleaner reclaims the old ones
+    if (cfs->logMap != NULL)
+        return 1;
+    off_t offset = CFS_SlotOffset(cfs,nodeId) + offsetof(MDS,data);
+    return fallocate(CFS_SlotDesc(cfs,nodeId),FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,offset,cfs->NODE_STRIDE - offsetof(MDS,data)) == 0;
+}
+
+// Removes a node's name (name in directory dirnodeid, the entry itself is removed by the caller):
+// decreases link count or marks node as deleted (and punches it's datablocks if punch is set)
+int CFS_RemoveEntity(CFS cfs,nodeid_t nodeId,int punch,nodeid_t dirnodeid,string name) {
+    // Cannot remove root directory
+    if (nodeId == 0) {
+        return 0;
+    }
+    // Get the entity's metadata
+    MDS data;
+    CFS_ReadNode(cfs,nodeId,&data);
+    // If node is linked into 1 file mark it as deleted
+    if (data.links == 0) {
+        data.deleted = 1;
+        cfs->sb.LIVE_NODES--;
+        if (data.type == TYPE_DIRECTORY)
+            cfs->sb.DIRECTORY_COUNT--;
+        else
+            cfs->sb.FILE_BYTES -= data.size;
+    }
+    // If the node is hard-linked into more than 1 names decrease the links number
+    else {
+        CFS_DropFileName(&data,dirnodeid);
+        cfs->sb.HARD_LINKS--;
+    }
+    // Write updated data to cfs
+    CFS_WriteNode(cfs,&data);
+    CFS_SyncSuperblock(cfs);
+    if (punch && data.deleted)
+        CFS_PunchNode(cfs,nodeId);
+    CFS_RecordChange(cfs,CHANGE_REMOVE,nodeId,dirnodeid,name);
+    return 1;
+}
+
+int CFS_RemoveDirectoryContent(CFS cfs,nodeid_t dirnodeid,int options[3]) {
+    // Get the directory's data
+    MDS dirData;
+    CFS_ReadNode(cfs,dirnodeid,&dirData);
+    // Loop through all the files and directories ignoring . and .. locations
+    unsigned int i,offset,delete,deletions = 0;
+    uint64_t deletedBytes = 0;
+    nodeid_t curId;
+    MDS entityData;
+    for (i = 0,offset = CFS_DirectoryFirstEntry(); i < CFS_DirectoryEntryCount(&dirData);) {
+        delete = 0;
+        // Get id of the current entity
+        curId = CFS_DirectoryEntryId(&dirData,offset);
+        // Get name of the current entity
+        string filename = CFS_DirectoryEntryName(&dirData,offset);
+        // Ignore . and .. directories to avoid glitches and possible infinite loop
+        if (!strcmp(".",filename) || !strcmp("..",filename)) {
+            i++;
+            offset = CFS_DirectoryNextEntry(&dirData,offset);
+            continue;
+        }
+        // Determine type
+        if (CFS_DirectoryEntryType(&dirData,offset) == TYPE_DIRECTORY) {
+            // Directory so remove empty sub-directories and if -r option is enabled remove content from non empty sub-directories
+            if (CFS_DirectoryIsEmpty(cfs,curId)) {
+                delete = 1;
+            } else {
+                if (options[RM_RECURSIVE]) {
+                    CFS_RemoveDirectoryContent(cfs,curId,options);
+                }
+            }
+        } else if (CFS_DirectoryEntryType(&dirData,offset) == TYPE_FILE) {
+            delete = 1;
+        }
+        // If entity was deleted remove it's entry from the directory
+        if (delete) {
+            // If prompt(-i option) is enabled ask the user before deleting
+            char answer;
+            if (options[RM_PROMPT]) {
+                do {
+                    printf("Remove '%s'?(y/n)",filename);
+                    answer = getPromptAnswer();
+                } while (answer != 'n' && answer != 'y');
+            } else {
+                answer = 'y';
+            }
+            if (answer == 'y') {
+                CFS_ReadNodeMetadata(cfs,curId,&entityData);
+                if (entityData.type == TYPE_FILE)
+                    deletedBytes += entityData.size;
+                CFS_RemoveEntity(cfs,curId,options[RM_PUNCH],dirnodeid,filename);
+                // The next entries move left so offset now points to the next entry
+                CFS_DirectoryRemoveEntry(cfs,&dirData,i,offset);
+                deletions++;
+            } else {
+                i++;
+                offset = CFS_DirectoryNextEntry(&dirData,offset);
+            }
+        } else {
+            i++;
+            offset = CFS_DirectoryNextEntry(&dirData,offset);
+        }
+    }
+    // Write changes (if any occured) to cfs file
+    if (deletions) {
+        // Removals in sub-directories already updated the aggregates on disk
+        CFS_ReadNodeMetadata(cfs,dirnodeid,&entityData);
+        dirData.subtree_bytes = entityData.subtree_bytes;
+        dirData.subtree_entries = entityData.subtree_entries;
+        CFS_WriteNode(cfs,&dirData);
+        CFS_PropagateSubtreeDelta(cfs,dirnodeid,-(int64_t)deletedBytes,-(int64_t)deletions);
+    }
+    return 1;
+}
+
+int CFS_ModifyFileTimestamps(CFS cfs,nodeid_t nodeid,int access,int modification) {
+    MDS data;
+    // Read file's metadata
+    CFS_ReadNode(cfs,nodeid,&data);
+    // Modify the timestamps
+    time_t timestamp = time(NULL);
+    if (access)
+        data.accessTime = timestamp;
+    if (modification)
+        data.modificationTime = timestamp;
+    // Write changes to cfs file
+    CFS_WriteNode(cfs,&data);
+    CFS_RecordChange(cfs,CHANGE_TOUCH,nodeid,data.parent_nodeid,data.filename);
+    return 1;
+}
+
+// Checks if the parameters of a new cfs file satisfy the constraints of the format
+int CFS_ValidGeometry(unsigned int BLOCK_SIZE,unsigned int FILENAME_SIZE,unsigned int MAX_FILE_SIZE,unsigned int MAX_DIRECTORY_FILE_NUMBER,unsigned int ALLOCATION_POLICY) {
+    return MAX_FILE_SIZE <= DATABLOCK_NUM && FILENAME_SIZE <= MAX_FILENAME_SIZE && FILENAME_SIZE > strlen("..") && MAX_FILE_SIZE >= sizeof(directoryHeader) + MIN_DIRECTORY_ENTRY_SIZE && MAX_DIRECTORY_FILE_NUMBER <= (MAX_FILE_SIZE - sizeof(directoryHeader))/MIN_DIRECTORY_ENTRY_SIZE && CFS_ValidBlockSize(BLOCK_SIZE) && ALLOCATION_POLICY <= ALLOCATE_NEAR;
+}
+
+// Fills the superblock of a new cfs file (made by cfs_create or mkcfs): a single in-place cfs file without nodes or a change log
+void CFS_NewSuperblock(superblock *sb,unsigned int BLOCK_SIZE,unsigned int FILENAME_SIZE,unsigned int MAX_FILE_SIZE,unsigned int MAX_DIRECTORY_FILE_NUMBER,unsigned int ALLOCATION_POLICY,unsigned int GROWTH_PERCENT) {
+    memset(sb,0,sizeof(superblock));
+    sb->magic = CFS_MAGIC;
+    sb->version = CFS_VERSION;
+    sb->BLOCK_SIZE = BLOCK_SIZE;
+    sb->FILENAME_SIZE = FILENAME_SIZE;
+    sb->MAX_FILE_SIZE = MAX_FILE_SIZE;
+    sb->MAX_DIRECTORY_FILE_NUMBER = MAX_DIRECTORY_FILE_NUMBER;
+    sb->ALLOCATION_POLICY = ALLOCATION_POLICY;
+    sb->GROWTH_PERCENT = GROWTH_PERCENT;
+    sb->EPOCH = 1;
+    sb->WRITE_MODE = WRITE_IN_PLACE;
+    sb->CHANGE_FIRST = 1;
+    sb->STRIPES = 1;
+}
+
+int Create_CFS_File(string pathname,unsigned int BLOCK_SIZE,unsigned int FILENAME_SIZE,unsigned int MAX_FILE_SIZE,unsigned int MAX_DIRECTORY_FILE_NUMBER,unsigned int ALLOCATION_POLICY,nodeid_t PREALLOCATED_NODES,unsigned int GROWTH_PERCENT,unsigned int WRITE_MODE,uint64_t CHANGE_CAPACITY,unsigned int STRIPES) {
+    int fd = -1;
+    // Check if sizes satisfy constraints
+    if (CFS_ValidGeometry(BLOCK_SIZE,FILENAME_SIZE,MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER,ALLOCATION_POLICY) && WRITE_MODE <= WRITE_LOG && CHANGE_CAPACITY <= MAX_CHANGE_RECORDS && STRIPES >= 1 && STRIPES <= MAX_STRIPES) {
+        // Create the file
+        fd = open(pathname,O_RDWR|O_CREAT|O_TRUNC,FILE_PERMISSIONS);
+        // Check if creation was successful
+        if (fd != -1) {
+            // Nodes are laid out according to the new superblock
+            superblock sb;
+            CFS_NewSuperblock(&sb,BLOCK_SIZE,FILENAME_SIZE,MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER,ALLOCATION_POLICY,GROWTH_PERCENT);
+            sb.WRITE_MODE = WRITE_MODE;
+            sb.CHANGE_CAPACITY = CHANGE_CAPACITY;
+            sb.STRIPES = STRIPES;
+            struct cfs image;
+            memset(&image,0,sizeof(struct cfs));
+            image.fileDesc = fd;
+            // The root node is the 1st version in the log of log-structured cfs files
+            if (!CFS_SetGeometry(&image,&sb)) {
+                printf("Not enough memory.\n");
+                CFS_ReleaseGeometry(&image);
+                close(fd);
+                return -1;
+            }
+            if (!CFS_OpenMembers(&image,pathname,O_RDWR|O_CREAT|O_TRUNC) || (WRITE_MODE == WRITE_LOG && !CFS_OpenLog(&image))) {
+                CFS_ReleaseGeometry(&image);
+                close(fd);
+                return -1;
+            }
+            // Reserve the initial size and account for the root node
+            CFS_ReserveNodes(&image,PREALLOCATED_NODES > 1 ? PREALLOCATED_NODES : 1);
+            image.sb.NODE_COUNT = image.sb.LIVE_NODES = image.sb.DIRECTORY_COUNT = 1;
+            // Write superblock data
+            CFS_SyncSuperblock(&image);
+            // Write root node data
+            MDS data;
+            // Initialize metadata bytes to 0 to avoid valgrind errors
+            memset(&data,0,sizeof(MDS));
+            // Initialize root directory metadata
+            data.deleted = 0;
+            data.root = 1;
+            data.nodeid = 0;
+            strcpy(data.filename,"/");
+            data.size = 0;
+            data.type = TYPE_DIRECTORY;
+            data.parent_nodeid = 0;
+            time_t timer = time(NULL);
+            data.creation_time = data.accessTime = data.modificationTime = timer;
+            // Create . and .. shortcuts (hardlinks)
+            CFS_DirectoryInit(&image,&data);
+            CFS_WriteNode(&image,&data);
+            // Close the file after writing data
+            CFS_ReleaseGeometry(&image);
+            close(fd);
+            // A metadata table or an inode map left by a previous cfs file with the same name no longer applies
+            string metaFile = malloc(strlen(pathname) + strlen(".meta") + 1);
+            if (metaFile != NULL) {
+                sprintf(metaFile,"%s.meta",pathname);
+                unlink(metaFile);
+                sprintf(metaFile,"%s.imap",pathname);
+                unlink(metaFile);
+                free(metaFile);
+            }
+        } else {
+            perror("Error creating cfs file:");
+            return -1;
+        }
+    } else {
+        printf("Constraints are not satisfied.\n");
+    }
+    return fd;
+}
+
+void CFS_pwd(CFS cfs,nodeid_t nodeid,int last) {
+    // Get current node's metadata
+    MDS data;
+    // Read the metadata from the cfs file
+    CFS_ReadNode(cfs,nodeid,&data);
+    if (!data.root) {
+        CFS_pwd(cfs,data.parent_nodeid,0);
+        printf("%s",data.filename);
+        if (!last)
+            printf("/");
+        else
+            printf("\n");
+    } else {
+        printf("%s",data.filename);
+        if (last)
+            printf("\n");
+    }
+}
+
+void CFS_PrintFileInfo(CFS cfs,MDS data,string filename,int options[6]) {
+    // Ignore hidden files if -a option was not specified
+    if (!options[LS_ALL_FILES] && filename[0] == '.')
+        return;
+    // If -d option (only directories) was specified ignore other types
+    if (options[LS_DIRECTORIES_ONLY] && data.type != TYPE_DIRECTORY)
+        return;
+    // If -h option (only links) was specified ignore other types
+    if (options[LS_LINKS_ONLY] && data.links == 0)
+        return;
+    if (options[LS_ALL_ATTRIBUTES]) {
+        switch (data.type) {
+            case TYPE_DIRECTORY:
+                printf("dir ");
+                break;
+            case TYPE_FILE:
+                printf("file");
+                break;
+            default:
+                printf("    ");
+                break;
+        }
+        char creationTime[70],accessTime[70],modificationTime[70];
+        strftime(creationTime,sizeof(creationTime),"%c",localtime(&data.creation_time));
+        strftime(accessTime,sizeof(accessTime),"%c",localtime(&data.accessTime));
+        strftime(modificationTime,sizeof(modificationTime),"%c",localtime(&data.modificationTime));
+        printf(" %s %s %s %llu %s\n",creationTime,accessTime,modificationTime,(unsigned long long)data.size,filename);
+    } else {
+        printf("%s ",data.filename);
+    }
+}
+
+MDS getMetadataFromNodeId(CFS cfs,nodeid_t nodeid) {
+    MDS data;
+    // Get it's metadata
+    CFS_ReadNode(cfs,nodeid,&data);
+    // Return the metadata
+    return data;
+}
+
+void CFS_ls(CFS cfs,nodeid_t nodeid,int options[6],string path) {
+    MDS data;
+    // Get it's metadata
+    CFS_ReadNode(cfs,nodeid,&data);
+    // Determine data type
+    if (data.type == TYPE_DIRECTORY) {
+        // Directory so show all the contents of the directory
+        // Show info for all the directory's entities
+        unsigned int i,offset;
+        nodeid_t curId;
+        MDS tmpData;
+        MinHeap fileHeap;
+        // If we do not have the unorderedoption create a minheap to sort the contents
+        if (!options[LS_UNORDERED])
+            fileHeap = MinHeap_Create(CFS_DirectoryEntryCount(&data));
+        // In recursive directory option print the current path
+        if (options[LS_RECURSIVE_PRINT])
+            printf("%s:\n",path);
+        for (i = 0,offset = CFS_DirectoryFirstEntry(); i < CFS_DirectoryEntryCount(&data); i++,offset = CFS_DirectoryNextEntry(&data,offset)) {
+            // Get id of the current entity
+            curId = CFS_DirectoryEntryId(&data,offset);
+            // Get name of the current entity
+            string filename = CFS_DirectoryEntryName(&data,offset);
+            // Get it's metadata
+            CFS_ReadNode(cfs,curId,&tmpData);
+            // If we want ordered print store all the contents in a minheap and we will print them later
+            if (!options[LS_UNORDERED]) {
+                MinHeap_Insert(fileHeap,tmpData,filename);
+            } else {
+                // Otherwise just print entity info
+                CFS_PrintFileInfo(cfs,tmpData,filename,options);
+            }
+        }
+        // Print all the contents ordered if -u is not enabled
+        if (!options[LS_UNORDERED]) {
+            MDS tmp;
+            int empty = 0;
+            while (!empty){
+                tmp = MinHeap_ExtractMin(fileHeap,&empty);
+                if (!empty)
+                    CFS_PrintFileInfo(cfs,tmp,tmp.filename,options);
+            }
+            MinHeap_Destroy(&fileHeap);
+        }
+        // In recursive print option recursively print all subfolder's contents
+        if (options[LS_RECURSIVE_PRINT]) {
+            for (i = 0,offset = CFS_DirectoryFirstEntry(); i < CFS_DirectoryEntryCount(&data); i++,offset = CFS_DirectoryNextEntry(&data,offset)) {
+                // Get id of the current entity
+                curId = CFS_DirectoryEntryId(&data,offset);
+                // Get name of the current entity
+                string filename = CFS_DirectoryEntryName(&data,offset);
+                // Get it's metadata
+                CFS_ReadNode(cfs,curId,&tmpData);
+                // Recursively ls only on directories (except . and .. shortcuts to avoid infinite loop)
+                if (tmpData.type == TYPE_DIRECTORY && strcmp(".",filename) && strcmp("..",filename)) {
+                    string newPath = copyString(path);
+                    stringAppend(&newPath,"/");
+                    stringAppend(&newPath,tmpData.filename);
+                    CFS_ls(cfs,tmpData.nodeid,options,newPath);
+                    DestroyString(&newPath);
+                }
+            }
+        }
+    }
+    if (!options[LS_ALL_ATTRIBUTES])
+        printf("\n");
+}
+
+// Replaces a file's content, stamping it with modificationTime like CFS_CreateFile does
+void CFS_ModifyFile(CFS cfs,nodeid_t nodeid,char content[DATABLOCK_NUM],uint64_t size,time_t modificationTime) {
+    MDS destData;
+    // Read file's metadata
+    CFS_ReadNode(cfs,nodeid,&destData);
+    // Modify the timestamps
+    destData.modificationTime = modificationTime;
+    // Modify content
+    memcpy(destData.data.datablocks,content,size);
+    // Modify size
+    int64_t delta = (int64_t)size - (int64_t)destData.size;
+    cfs->sb.FILE_BYTES += delta;
+    destData.size = size;
+    // Write changes to cfs file
+    CFS_WriteNode(cfs,&destData);
+    CFS_SyncSuperblock(cfs);
+    CFS_PropagateFileResize(cfs,&destData,delta);
+    CFS_RecordChange(cfs,CHANGE_MODIFY,nodeid,destData.parent_nodeid,destData.filename);
+}
+
+// Copy a file with a specific nodeid and name to a directory with a specific id
+nodeid_t CFS_CopyFile(CFS cfs,nodeid_t nodeId,nodeid_t destDirId,string filename,int prompt) {
+    char answer;
+    // If -i option is enabled ask the user before copying
+    if (prompt) {
+        do {
+            printf("Copy '%s'?(y/n)",filename);
+            answer = getPromptAnswer();
+        } while (answer != 'n' && answer != 'y');
+    } else {
+        answer = 'y';
+    }
+    if (answer == 'y') {
+        // Get sourceFileData
+        MDS fileData;
+        // Get it's metadata
+        CFS_ReadNode(cfs,nodeId,&fileData);
+        // Check if file exists in destination
+        int found;
+        unsigned int type;
+        nodeid_t destFileId = getNodeIdFromName(cfs,filename,destDirId,&found,&type);
+        if (exists(cfs,filename,destDirId)) {
+            // If exists just change the content and modify the timestamps
+            CFS_ModifyFile(cfs,destFileId,fileData.data.datablocks,fileData.size,time(NULL));
+        } else {
+            // Create a new file in destination dir
+            destFileId = CFS_CreateFile(cfs,filename,destDirId,fileData.data.datablocks,fileData.size,time(NULL));
+        }
+        return destFileId;
+    } else {
+        return 1;
+    }
+}
+
+void CFS_CopyDirectoryContents(CFS cfs,nodeid_t sourceDirNodeId,nodeid_t destDirNodeId,int options[3]) {
+    MDS dirData;
+    // Get it's metadata
+    CFS_ReadNode(cfs,sourceDirNodeId,&dirData);
+    if (dirData.type == TYPE_DIRECTORY) {
+        // Loop through every content in source directory
+        unsigned int i,offset;
+        nodeid_t curId;
+        MDS tmpData;
+        for (i = 0,offset = CFS_DirectoryFirstEntry(); i < CFS_DirectoryEntryCount(&dirData); i++,offset = CFS_DirectoryNextEntry(&dirData,offset)) {
+            // Get id of the current entity
+            curId = CFS_DirectoryEntryId(&dirData,offset);
+            // Get name of the current entity
+            string filename = CFS_DirectoryEntryName(&dirData,offset);
             // Get it's metadata
-            read(cfs->fileDesc,&tmpData,sizeof(MDS));
-            // Check if the name matches
-            if (!strcmp(sourcename,filename)) {
-                // Found
+            CFS_ReadNode(cfs,curId,&tmpData);
+            // Determine ith entity type
+            if (tmpData.type == TYPE_DIRECTORY) {
+                // Directory
+                // Ignore . and .. directories and sane destimation directory to avoid infinite loop
+                if (strcmp(".",filename) && strcmp("..",filename) && tmpData.nodeid != destDirNodeId) {
+                    // Recursively copy only with -r option
+                    if (options[CP_RECURSIVELY_COPY_DIRECTORIES]) {
+                        nodeid_t newDirId = CFS_CreateDirectory(cfs,filename,destDirNodeId);
+                        if (newDirId != 0) {
+                            char answer;
+                            // If -i option is enabled ask the user before copying
+                            if (options[CP_PROMPT]) {
+                                do {
+                                    printf("Copy '%s'?(y/n)",filename);
+                                    answer = getPromptAnswer();
+                                } while (answer != 'n' && answer != 'y');
+                            } else {
+                                answer = 'y';
+                            }
+                            if (answer == 'y')
+                                CFS_CopyDirectoryContents(cfs,curId,newDirId,options);
+                        } else {
+                            printf("Not enough space for new directory\n");
+                            return;
+                        }
+                    }
+                }
+            } else if (tmpData.type == TYPE_FILE) {
+                if(!CFS_CopyFile(cfs,curId,destDirNodeId,filename,options[CP_PROMPT]))
+                    printf("Not enough space to copy file %s\n",filename);
+            }
+        }
+    }
+}
+
+int CFS_MoveSource(CFS cfs,nodeid_t sourcedirid,string sourcename,nodeid_t destDirId,string destname,int prompt) {
+    char answer;
+    // If -i option is enabled ask the user before copying
+    if (prompt) {
+        do {
+            printf("Move '%s'?(y/n)",sourcename);
+            answer = getPromptAnswer();
+        } while (answer != 'n' && answer != 'y');
+    } else {
+        answer = 'y';
+    }
+    if (answer == 'y') {
+        // Get source node data
+        MDS sourceDirdata;
+        // Get it's metadata
+        CFS_ReadNode(cfs,sourcedirid,&sourceDirdata);
+        // Find the wanted entity using the directory's fingerprints
+        unsigned int offset;
+        int i = CFS_DirectoryFindEntry(cfs,&sourceDirdata,sourcename,&offset);
+        if (i != -1) {
+            // Found
+            nodeid_t curId = CFS_DirectoryEntryId(&sourceDirdata,offset);
+            unsigned int type = CFS_DirectoryEntryType(&sourceDirdata,offset);
+            // Check if destination directory is the same with the source one
+            if (destDirId != sourcedirid) {
                 // Get destination directory data
                 MDS destinationDirData;
-                lseek(cfs->fileDesc,sizeof(superblock) + destDirId * sizeof(MDS),SEEK_SET);
-                read(cfs->fileDesc,&destinationDirData,sizeof(MDS));
-                // Check if destination directory is the same with the source one
-                if (destDirId != sourcedirid) {
-                    // Check if there is enough space to copy the entity there
-                    if (destinationDirData.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) <= cfs->MAX_DIRECTORY_FILE_NUMBER) {
-                        // Copy nodeid to destination directory
-                        memcpy(destinationDirData.data.datablocks + destinationDirData.size,&curId,sizeof(unsigned int));
-                        // Copy destination name to destination directory
-                        strcpy(destinationDirData.data.datablocks + destinationDirData.size + sizeof(unsigned int),destname);
-                        // Increase destination size
-                        destinationDirData.size += (sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-                        // Remove (nodeid,name) tuple from source directory
-                        if (i < sourceDirdata.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) - 1)
-                            memcpy(sourceDirdata.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)),sourceDirdata.data.datablocks + (i+1)*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)),(sourceDirdata.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) - i - 1)*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-                        // Decrease source directory size
-                        sourceDirdata.size -= (sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char));
-                        // If source is directory change it's parent to the new directory
-                        if (tmpData.type == TYPE_DIRECTORY) {
-                            // Change parent in metadata
-                            tmpData.parent_nodeid = destDirId;
-                            // Change .. hardlink
-                            memcpy(tmpData.data.datablocks + sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char),&destDirId,sizeof(unsigned int));
-                            // Write updated data back to cfs
-                            lseek(cfs->fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
-                            write(cfs->fileDesc,&tmpData,sizeof(MDS));
-                        }
-                        // Write updated destination data back to cfs
-                        lseek(cfs->fileDesc,sizeof(superblock) + destDirId * sizeof(MDS),SEEK_SET);
-                        write(cfs->fileDesc,&destinationDirData,sizeof(MDS));
-                        // Write updated source data back to cfs
-                        lseek(cfs->fileDesc,sizeof(superblock) + sourcedirid * sizeof(MDS),SEEK_SET);
-                        write(cfs->fileDesc,&sourceDirdata,sizeof(MDS));
-                        return 1;
+                CFS_ReadNode(cfs,destDirId,&destinationDirData);
+                // Check if there is enough space to copy the entity there
+                if (CFS_DirectoryFits(cfs,&destinationDirData,destname)) {
+                    // Copy nodeid and destination name to destination directory
+                    CFS_DirectoryAddEntry(cfs,&destinationDirData,curId,type,destname);
+                    // Remove entry from source directory
+                    CFS_DirectoryRemoveEntry(cfs,&sourceDirdata,i,offset);
+                    MDS tmpData;
+                    int64_t movedBytes;
+                    // If source is directory change it's parent to the new directory
+                    if (type == TYPE_DIRECTORY) {
+                        CFS_ReadNode(cfs,curId,&tmpData);
+                        // Change parent in metadata
+                        tmpData.parent_nodeid = destDirId;
+                        // Change .. hardlink (always the 2nd entry)
+                        memcpy(tmpData.data.datablocks + CFS_DirectoryEntryOffset(&tmpData,1),&destDirId,sizeof(nodeid_t));
+                        // Write updated data back to cfs
+                        CFS_WriteNode(cfs,&tmpData);
+                        movedBytes = tmpData.subtree_bytes;
+                    } else {
+                        // The file records the directory of the moved name
+                        CFS_ReadNodeMetadata(cfs,curId,&tmpData);
+                        CFS_MoveFileName(&tmpData,sourcedirid,destDirId);
+                        CFS_WriteNodeMetadata(cfs,&tmpData);
+                        movedBytes = tmpData.size;
+                    }
+                    // Write updated destination data back to cfs
+                    CFS_WriteNode(cfs,&destinationDirData);
+                    // Write updated source data back to cfs
+                    CFS_WriteNode(cfs,&sourceDirdata);
+                    // Move the entity's share of the aggregates
+                    int64_t movedEntries = 1 + (type == TYPE_DIRECTORY ? tmpData.subtree_entries : 0);
+                    CFS_PropagateSubtreeDelta(cfs,sourcedirid,-movedBytes,-movedEntries);
+                    CFS_PropagateSubtreeDelta(cfs,destDirId,movedBytes,movedEntries);
+                    CFS_RecordChange(cfs,CHANGE_MOVE,curId,destDirId,destname);
+                    return 1;
+                } else {
+                    printf("Not enough space to move %s in new directory\n",sourcename);
+                    return 0;
+                }
+            } else {
+                // Destination directory is the same with the source one so simply rename the file
+                // Entries are packed so the renamed entry is moved to the end of the directory
+                CFS_DirectoryRemoveEntry(cfs,&sourceDirdata,i,offset);
+                if (!CFS_DirectoryFits(cfs,&sourceDirdata,destname)) {
+                    printf("Not enough space to rename %s\n",sourcename);
+                    return 0;
+                }
+                CFS_DirectoryAddEntry(cfs,&sourceDirdata,curId,type,destname);
+                // Write updated source data back to cfs
+                CFS_WriteNode(cfs,&sourceDirdata);
+                CFS_RecordChange(cfs,CHANGE_MOVE,curId,destDirId,destname);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+string getEntityNameFromPath(string path) {
+    string pathCopy = copyString(path);
+    string token = strtok(pathCopy,"/");
+    string name;
+    while (token != NULL) {
+        name = token;
+        token = strtok(NULL,"/");
+    }
+    name = copyString(name);
+    DestroyString(&pathCopy);
+    return name;
+}
+
+// What an import with -update did
+typedef struct {
+    int options[2];
+    uint64_t added; // Files that were not in cfs
+    uint64_t addedBytes;
+    uint64_t updated; // Files rewritten in place
+    uint64_t updatedBytes;
+    uint64_t unchanged; // Files whose cfs copy was current
+    uint64_t unchangedBytes;
+    uint64_t removed; // Entities that no longer exist in the host directory
+} importReport;
+
+// Imports a file. When updating (report is not NULL) a file that already exists is rewritten in place,
+// keeping it's nodeid, unless it has the host file's size and modification time
+int CFS_ImportFile(CFS cfs,string source,nodeid_t nodeid,importReport *report) {
+    // Check if file exists in cfs
+    string filename = getEntityNameFromPath(source);
+    int ret = 1,found;
+    unsigned int type;
+    nodeid_t fileId = getNodeIdFromName(cfs,filename,nodeid,&found,&type);
+    if (!found || (report != NULL && type == TYPE_FILE)) {
+        // Open linux file
+        int fd = open(source,O_RDONLY);
+        // Get linux file size in bytes
+        struct stat st;
+        if (fd == -1 || fstat(fd,&st) == -1) {
+            printf("File %s can not be read\n",source);
+            if (fd != -1)
+                close(fd);
+            DestroyString(&filename);
+            return 0;
+        }
+        uint64_t size = st.st_size;
+        MDS data;
+        if (found)
+            CFS_ReadNodeMetadata(cfs,fileId,&data);
+        if (found && data.size == size && data.modificationTime == st.st_mtime) {
+            // Unchanged since the last import so it's content is not even read
+            report->unchanged++;
+            report->unchangedBytes += size;
+        } else if (size <= cfs->MAX_FILE_SIZE) {
+            // Linux file fits in cfs
+            // Read it's content
+            char bytes[DATABLOCK_NUM];
+            pread(fd,bytes,size,0);
+            if (found) {
+                CFS_ModifyFile(cfs,fileId,bytes,size,st.st_mtime);
+                report->updated++;
+                report->updatedBytes += size;
+            } else if ((fileId = CFS_CreateFile(cfs,filename,nodeid,bytes,size,st.st_mtime)) == 0) {
+                // Create the corresponding file in cfs
+                printf("Not enough space in cfs to import file %s\n",filename);
+                ret = 0;
+            } else if (report != NULL) {
+                report->added++;
+                report->addedBytes += size;
+            }
+        } else {
+            // Linux file does not fit in cfs
+            printf("File %s does not fit in cfs.\n",filename);
+            ret = 0;
+        }
+        // Close linux file
+        close(fd);
+    } else {
+        printf("File %s already exists\n",filename);
+        ret = 0;
+    }
+    DestroyString(&filename);
+    return ret;
+}
+
+// Removes an entity (name in directory dirnodeid) and everything below it (the entry in it's directory is removed by the caller)
+void CFS_RemoveTree(CFS cfs,nodeid_t nodeid,nodeid_t dirnodeid,string name) {
+    MDS data;
+    CFS_ReadNode(cfs,nodeid,&data);
+    if (data.type == TYPE_DIRECTORY) {
+        unsigned int i,offset;
+        // Skip . and .. shortcuts
+        for (i = 2,offset = CFS_DirectoryEntryOffset(&data,2); i < CFS_DirectoryEntryCount(&data); i++,offset = CFS_DirectoryNextEntry(&data,offset))
+            CFS_RemoveTree(cfs,CFS_DirectoryEntryId(&data,offset),nodeid,CFS_DirectoryEntryName(&data,offset));
+    }
+    CFS_RemoveEntity(cfs,nodeid,0,dirnodeid,name);
+}
+
+// Removes the entities of a cfs directory that are not in the host directory it was imported from
+void CFS_ImportRemoveVanished(CFS cfs,string source,nodeid_t dirnodeid,importReport *report) {
+    MDS dirData,entityData;
+    CFS_ReadNode(cfs,dirnodeid,&dirData);
+    unsigned int i,offset;
+    uint64_t removedBytes = 0,removedEntries = 0;
+    struct stat st;
+    // Skip . and .. shortcuts
+    for (i = 2,offset = CFS_DirectoryEntryOffset(&dirData,2); i < CFS_DirectoryEntryCount(&dirData);) {
+        string path = copyString(source);
+        stringAppend(&path,"/");
+        stringAppend(&path,CFS_DirectoryEntryName(&dirData,offset));
+        if (lstat(path,&st) == -1) {
+            CFS_ReadNodeMetadata(cfs,CFS_DirectoryEntryId(&dirData,offset),&entityData);
+            if (entityData.type == TYPE_DIRECTORY) {
+                removedBytes += entityData.subtree_bytes;
+                removedEntries += entityData.subtree_entries + 1;
+            } else {
+                removedBytes += entityData.size;
+                removedEntries++;
+            }
+            CFS_RemoveTree(cfs,entityData.nodeid,dirnodeid,CFS_DirectoryEntryName(&dirData,offset));
+            // The next entries move left so offset now points to the next entry
+            CFS_DirectoryRemoveEntry(cfs,&dirData,i,offset);
+            report->removed++;
+        } else {
+            i++;
+            offset = CFS_DirectoryNextEntry(&dirData,offset);
+        }
+        DestroyString(&path);
+    }
+    if (removedEntries) {
+        CFS_ReadNodeMetadata(cfs,dirnodeid,&entityData);
+        dirData.subtree_bytes = entityData.subtree_bytes;
+        dirData.subtree_entries = entityData.subtree_entries;
+        CFS_WriteNode(cfs,&dirData);
+        CFS_PropagateSubtreeDelta(cfs,dirnodeid,-(int64_t)removedBytes,-(int64_t)removedEntries);
+    }
+}
+
+int CFS_ImportDirectory(CFS cfs,string source,nodeid_t nodeid,importReport *report) {
+    struct stat entryinfo;
+    DIR *dirp;
+    struct dirent *dirContent;
+    // Open linux directory
+    dirp = opendir(source);
+    // Read and import all entries
+    while ((dirContent = readdir(dirp)) != NULL) {
+        // Ignore . , .. directories and deleted entities
+        if (!strcmp(".",dirContent->d_name) || !strcmp("..",dirContent->d_name) || dirContent->d_ino == 0)
+            continue;
+        // Recursively import all elements in linux directory 
+        string dirContentPath = copyString(source);
+        stringAppend(&dirContentPath,"/");
+        stringAppend(&dirContentPath,dirContent->d_name);
+        // Get entry type
+        if (stat(dirContentPath,&entryinfo) != -1) {
+            if (S_ISDIR(entryinfo.st_mode)) {
+                // Directory
+                // Check if corresponding directory exists
+                int found;
+                unsigned int type;
+                nodeid_t existingId = getNodeIdFromName(cfs,dirContent->d_name,nodeid,&found,&type);
+                if (found && report != NULL && type == TYPE_DIRECTORY) {
+                    // Update the existing directory's content
+                    CFS_ImportDirectory(cfs,dirContentPath,existingId,report);
+                } else if (!found) {
+                    // Create corresponding directory in cfs
+                    nodeid_t dirNodeId;
+                    // Check if there is enough space for the new directory
+                    if ((dirNodeId = CFS_CreateDirectory(cfs,dirContent->d_name,nodeid)) == 0) {
+                        printf("Not enough space to create directory %s\n",dirContent->d_name);
+                    } else {
+                        // Recursively import linux directory's content to cfs directory
+                        CFS_ImportDirectory(cfs,dirContentPath,dirNodeId,report);
+                    }
+                } else {
+                    printf("File %s already exists\n",dirContent->d_name);
+                }
+            } else if (S_ISREG(entryinfo.st_mode)) {
+                // Regular file
+                CFS_ImportFile(cfs,dirContentPath,nodeid,report);
+            } else {
+                printf("Unknown file type of %s\n",source);
+            }
+        } else {
+            perror("Failed  to get  file  status");
+        }
+        DestroyString(&dirContentPath);
+    }
+    // Close linux directory
+    closedir(dirp);
+    if (report != NULL && report->options[IMPORT_DELETE])
+        CFS_ImportRemoveVanished(cfs,source,nodeid,report);
+    return 1;
+}
+
+int CFS_ImportSource(CFS cfs,string source,nodeid_t nodeid,importReport *report) {
+    struct stat sourceinfo;
+    // Get source type
+    if (stat(source,&sourceinfo) != -1) {
+        if (S_ISDIR(sourceinfo.st_mode)) {
+            // Directory
+            CFS_ImportDirectory(cfs,source,nodeid,report);
+        } else if (S_ISREG(sourceinfo.st_mode)) {
+            // Regular file
+            CFS_ImportFile(cfs,source,nodeid,report);
+        } else {
+            printf("Unknown file type of %s\n",source);
+            return 0;
+        }
+    } else {
+        perror("Failed  to get  file  status");
+        return 0;
+    }
+    return 1;
+}
+
+// What an export with -sync did
+typedef struct {
+    int options[2];
+    uint64_t written; // New or changed files
+    uint64_t writtenBytes;
+    uint64_t skipped; // Files whose host copy was current
+    uint64_t skippedBytes;
+    uint64_t deleted; // Host files and directories that no longer exist in cfs
+} exportReport;
+
+// Removes a host file or directory tree that no longer exists in cfs
+void CFS_ExportRemoveHostEntry(string path,exportReport *report) {
+    struct stat st;
+    if (lstat(path,&st) == -1)
+        return;
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dirp = opendir(path);
+        struct dirent *dirContent;
+        while (dirp != NULL && (dirContent = readdir(dirp)) != NULL) {
+            if (!strcmp(".",dirContent->d_name) || !strcmp("..",dirContent->d_name))
+                continue;
+            string entryPath = copyString(path);
+            stringAppend(&entryPath,"/");
+            stringAppend(&entryPath,dirContent->d_name);
+            CFS_ExportRemoveHostEntry(entryPath,report);
+            DestroyString(&entryPath);
+        }
+        if (dirp != NULL)
+            closedir(dirp);
+        if (rmdir(path) == -1) {
+            perror("Directory removal error");
+            return;
+        }
+    } else if (unlink(path) == -1) {
+        perror("File removal error");
+        return;
+    }
+    report->deleted++;
+}
+
+// Exports a file. When syncing (report is not NULL) a host copy with the same size and modification time
+// is left as it is, and written copies get the cfs modification time so that the next sync recognizes them
+int CFS_ExportFile(CFS cfs,nodeid_t nodeid,string directory,string filename,exportReport *report) {
+    MDS data;
+    // Determine export path
+    string path = copyString(directory);
+    stringAppend(&path,"/");
+    stringAppend(&path,filename);
+    if (report != NULL) {
+        struct stat st;
+        CFS_ReadNodeMetadata(cfs,nodeid,&data);
+        if (stat(path,&st) == 0 && S_ISREG(st.st_mode) && st.st_size == data.size && st.st_mtime == data.modificationTime) {
+            report->skipped++;
+            report->skippedBytes += data.size;
+            DestroyString(&path);
+            return 1;
+        }
+        // A host directory in the file's place
+        if (report->options[EXPORT_DELETE] && stat(path,&st) == 0 && S_ISDIR(st.st_mode))
+            CFS_ExportRemoveHostEntry(path,report);
+    }
+    // Get file data
+    CFS_ReadNode(cfs,nodeid,&data);
+    // Create file in linux and check if creation was ok
+    int fd;
+    if ((fd = open(path,O_CREAT|O_WRONLY|O_TRUNC,FILE_PERMISSIONS)) != -1) {
+        // Successful creation so write data
+        write(fd,data.data.datablocks,data.size);
+        if (report != NULL) {
+            struct timespec times[2] = {{data.accessTime,0},{data.modificationTime,0}};
+            futimens(fd,times);
+            report->written++;
+            report->writtenBytes += data.size;
+        }
+        // Close the file
+        close(fd);
+        DestroyString(&path);
+        return 1;
+    } else {
+        DestroyString(&path);
+        perror("File creation error");
+        return 0;
+    }
+}
+
+int CFS_ExportDirectory(CFS cfs,nodeid_t nodeid,string directory,exportReport *report) {
+    // Get directory data
+    MDS data;
+    CFS_ReadNode(cfs,nodeid,&data);
+    // Loop through all the entities
+    unsigned int i,offset;
+    nodeid_t curId;
+    MDS tmpData;
+    string path;
+    struct stat st;
+    for (i = 0,offset = CFS_DirectoryFirstEntry(); i < CFS_DirectoryEntryCount(&data); i++,offset = CFS_DirectoryNextEntry(&data,offset)) {
+        // Get id of the current entity
+        curId = CFS_DirectoryEntryId(&data,offset);
+        // Get name of the current entity
+        string filename = CFS_DirectoryEntryName(&data,offset);
+        // Ignore . and .. shortcuts to avoid infinite loop
+        if (!strcmp(".",filename) || !strcmp("..",filename))
+            continue;
+        // Get it's metadata (files read their datablocks only if they are written)
+        CFS_ReadNodeMetadata(cfs,curId,&tmpData);
+        // Check it's type
+        if (tmpData.type == TYPE_DIRECTORY) {
+            // Directory
+            // Create the corresponding directory in linux
+            path = copyString(directory);
+            stringAppend(&path,"/");
+            stringAppend(&path,filename);
+            // A host file in the directory's place
+            if (report != NULL && report->options[EXPORT_DELETE] && lstat(path,&st) == 0 && !S_ISDIR(st.st_mode))
+                CFS_ExportRemoveHostEntry(path,report);
+            mkdir(path,FILE_PERMISSIONS);
+            // Recursively export content of the current directory
+            CFS_ExportDirectory(cfs,tmpData.nodeid,path,report);
+            DestroyString(&path);
+        } else if (tmpData.type == TYPE_FILE) {
+            // Regular file
+            CFS_ExportFile(cfs,tmpData.nodeid,directory,filename,report);
+        }
+    }
+    // Remove the host entries that are not in the cfs directory
+    if (report != NULL && report->options[EXPORT_DELETE]) {
+        DIR *dirp = opendir(directory);
+        struct dirent *dirContent;
+        while (dirp != NULL && (dirContent = readdir(dirp)) != NULL) {
+            if (!strcmp(".",dirContent->d_name) || !strcmp("..",dirContent->d_name) || CFS_DirectoryFindEntry(cfs,&data,dirContent->d_name,&offset) != -1)
+                continue;
+            path = copyString(directory);
+            stringAppend(&path,"/");
+            stringAppend(&path,dirContent->d_name);
+            CFS_ExportRemoveHostEntry(path,report);
+            DestroyString(&path);
+        }
+        if (dirp != NULL)
+            closedir(dirp);
+    }
+    return 1;
+}
+
+int CFS_ExportSource(CFS cfs,string source,string directory,exportReport *report) {
+    // Get source location
+    string sourceBackup = copyString(source);
+    location loc = getPathLocation(cfs,sourceBackup,cfs->currentDirectoryId,0);
+    // Check if it exists
+    if (loc.valid) {
+        // Check source type (shortcuts are not exported)
+        if (loc.type == TYPE_DIRECTORY) {
+            // Directory
+            CFS_ExportDirectory(cfs,loc.nodeid,directory,report);
+        } else if (loc.type == TYPE_FILE) {
+            // Regular file
+            CFS_ExportFile(cfs,loc.nodeid,directory,loc.filenanme,report);
+        }
+    } else {
+        printf("%s not found.\n",source);
+    }
+    DestroyString(&sourceBackup);
+    return 1;
+}
+
+// Size of the host buffer of archives written or read by cfs_pack and cfs_unpack
+#define PACK_BUFFER_SIZE 65536
+
+// File of a packed subtree, archived in nodeid order once the whole tree was walked
+typedef struct {
+    nodeid_t nodeid;
+    string path;
+} packEntry;
+
+typedef struct {
+    FILE *out;
+    packEntry *files;
+    uint64_t fileCount;
+    uint64_t capacity;
+    uint64_t directories;
+    uint64_t links; // Files archived as hard links to a file packed before
+    uint64_t bytes;
+} packArchive;
+
+// Archives the directories below a cfs directory in tree order (parents before their contents)
+// and collects it's files. path is the directory's member path ("" or ending with /).
+int CFS_PackDirectory(CFS cfs,nodeid_t dirnodeid,string path,packArchive *archive) {
+    MDS data,entityData;
+    CFS_ReadNode(cfs,dirnodeid,&data);
+    unsigned int i,offset;
+    // Skip . and .. shortcuts
+    for (i = 2,offset = CFS_DirectoryEntryOffset(&data,2); i < CFS_DirectoryEntryCount(&data); i++,offset = CFS_DirectoryNextEntry(&data,offset)) {
+        string memberPath = copyString(path);
+        stringAppend(&memberPath,CFS_DirectoryEntryName(&data,offset));
+        nodeid_t curId = CFS_DirectoryEntryId(&data,offset);
+        if (CFS_DirectoryEntryType(&data,offset) == TYPE_DIRECTORY) {
+            stringAppend(&memberPath,"/");
+            CFS_ReadNodeAttributes(cfs,curId,&entityData);
+            if (!Tar_WriteMember(archive->out,memberPath,TAR_DIRECTORY,FILE_PERMISSIONS,entityData.modificationTime,"",NULL,0)) {
+                DestroyString(&memberPath);
+                return 0;
+            }
+            archive->directories++;
+            int ok = CFS_PackDirectory(cfs,curId,memberPath,archive);
+            DestroyString(&memberPath);
+            if (!ok)
+                return 0;
+        } else {
+            if (archive->fileCount == archive->capacity) {
+                uint64_t capacity = archive->capacity ? 2*archive->capacity : 1024;
+                packEntry *files = realloc(archive->files,capacity*sizeof(packEntry));
+                if (files == NULL) {
+                    printf("Not enough memory.\n");
+                    DestroyString(&memberPath);
+                    return 0;
+                }
+                archive->files = files;
+                archive->capacity = capacity;
+            }
+            archive->files[archive->fileCount].nodeid = curId;
+            archive->files[archive->fileCount++].path = memberPath;
+        }
+    }
+    return 1;
+}
+
+int CFS_PackEntryCompare(const void *a,const void *b) {
+    const packEntry *x = a,*y = b;
+    if (x->nodeid != y->nodeid)
+        return x->nodeid < y->nodeid ? -1 : 1;
+    // Names of the same file are ordered by path so that archives of the same tree are identical
+    return strcmp(x->path,y->path);
+}
+
+// Writes a cfs file or directory tree to a tar stream.
+// Files are read in nodeid order so that the cfs file is read forward whatever the tree looks like.
+int CFS_Pack(CFS cfs,location loc,FILE *out,packArchive *archive) {
+    uint64_t i;
+    MDS data;
+    int ok = 1;
+    archive->out = out;
+    if (loc.type == TYPE_DIRECTORY) {
+        ok = CFS_PackDirectory(cfs,loc.nodeid,"",archive);
+        qsort(archive->files,archive->fileCount,sizeof(packEntry),CFS_PackEntryCompare);
+    } else if ((archive->files = malloc(sizeof(packEntry))) != NULL) {
+        archive->files[0].nodeid = loc.nodeid;
+        archive->files[0].path = copyString(loc.filenanme);
+        archive->fileCount = 1;
+    } else {
+        printf("Not enough memory.\n");
+        return 0;
+    }
+    for (i = 0; ok && i < archive->fileCount; i++) {
+        if (i > 0 && archive->files[i].nodeid == archive->files[i - 1].nodeid) {
+            // Another name of the previous file
+            CFS_ReadNodeAttributes(cfs,archive->files[i].nodeid,&data);
+            ok = Tar_WriteMember(out,archive->files[i].path,TAR_HARDLINK,0644,data.modificationTime,archive->files[i - 1].path,NULL,0);
+            // Later names of it link to it's 1st name
+            DestroyString(&archive->files[i].path);
+            archive->files[i].path = copyString(archive->files[i - 1].path);
+            archive->links++;
+        } else {
+            CFS_ReadNode(cfs,archive->files[i].nodeid,&data);
+            ok = Tar_WriteMember(out,archive->files[i].path,TAR_FILE,0644,data.modificationTime,"",data.data.datablocks,data.size);
+            archive->bytes += data.size;
+        }
+    }
+    for (i = 0; i < archive->fileCount; i++)
+        DestroyString(&archive->files[i].path);
+    free(archive->files);
+    archive->files = NULL;
+    if (ok)
+        ok = Tar_WriteEnd(out);
+    if (fflush(out) == EOF)
+        ok = 0;
+    if (!ok)
+        perror("Archive write error");
+    return ok;
+}
+
+// Directory that unpacked entries are added to. It's entries are kept in memory and the directory is written
+// once for the whole batch of consecutive members that it contains, instead of once per member.
+typedef struct {
+    int active;
+    nodeid_t dirnodeid;
+    string path; // Member path of the directory ("" for the directory unpacked to)
+    MDS dirData;
+    int64_t bytes; // Subtree changes of the batch
+    int64_t entries;
+    uint64_t directories;
+    uint64_t files;
+    uint64_t fileBytes;
+    uint64_t links;
+} unpackBatch;
+
+// Writes the batched directory and propagates it's changes
+void CFS_UnpackFlush(CFS cfs,unpackBatch *batch) {
+    if (!batch->active)
+        return;
+    if (batch->entries) {
+        CFS_WriteNode(cfs,&batch->dirData);
+        CFS_SyncSuperblock(cfs);
+        CFS_PropagateSubtreeDelta(cfs,batch->dirnodeid,batch->bytes,batch->entries);
+    }
+    DestroyString(&batch->path);
+    batch->active = 0;
+}
+
+// Makes the directory at path (relative to the directory unpacked to) the batched one, creating the missing directories
+int CFS_UnpackParent(CFS cfs,nodeid_t dirnodeid,string path,unpackBatch *batch) {
+    if (batch->active && !strcmp(batch->path,path))
+        return 1;
+    CFS_UnpackFlush(cfs,batch);
+    string pathCopy = copyString(path);
+    char *component;
+    int found;
+    unsigned int type;
+    for (component = strtok(pathCopy,"/"); component != NULL; component = strtok(NULL,"/")) {
+        nodeid_t nodeid = getNodeIdFromName(cfs,component,dirnodeid,&found,&type);
+        if (!found && (nodeid = CFS_CreateDirectory(cfs,component,dirnodeid)) != 0) {
+            batch->directories++;
+        } else if (!found) {
+            printf("Not enough space to create directory %s\n",component);
+            DestroyString(&pathCopy);
+            return 0;
+        } else if (type != TYPE_DIRECTORY) {
+            printf("%s is not a directory\n",component);
+            DestroyString(&pathCopy);
+            return 0;
+        }
+        dirnodeid = nodeid;
+    }
+    DestroyString(&pathCopy);
+    batch->active = 1;
+    batch->dirnodeid = dirnodeid;
+    batch->path = copyString(path);
+    CFS_ReadNode(cfs,dirnodeid,&batch->dirData);
+    batch->bytes = batch->entries = 0;
+    return 1;
+}
+
+// Creates a file or directory in the batched directory and returns it's id (0 if it does not fit)
+nodeid_t CFS_UnpackCreate(CFS cfs,unpackBatch *batch,string name,unsigned int type,char *content,uint64_t size,time_t modificationTime) {
+    if (!CFS_DirectoryFits(cfs,&batch->dirData,name))
+        return 0;
+    MDS data;
+    // Initialize metadata bytes to 0 to avoid valgrind errors
+    memset(&data,0,sizeof(MDS));
+    data.nodeid = CFS_GetNextAvailableNodeId(cfs,batch->dirnodeid,type);
+    strcpy(data.filename,name);
+    data.type = type;
+    data.parent_nodeid = batch->dirnodeid;
+    data.creation_time = data.accessTime = time(NULL);
+    data.modificationTime = modificationTime;
+    if (type == TYPE_DIRECTORY) {
+        CFS_DirectoryInit(cfs,&data);
+        cfs->sb.DIRECTORY_COUNT++;
+        batch->directories++;
+    } else {
+        data.size = size;
+        memcpy(data.data.datablocks,content,size);
+        cfs->sb.FILE_BYTES += size;
+        batch->files++;
+        batch->fileBytes += size;
+    }
+    CFS_WriteNode(cfs,&data);
+    CFS_DirectoryAddEntry(cfs,&batch->dirData,data.nodeid,type,name);
+    cfs->sb.LIVE_NODES++;
+    batch->bytes += data.type == TYPE_FILE ? size : 0;
+    batch->entries++;
+    CFS_RecordChange(cfs,CHANGE_CREATE,data.nodeid,batch->dirnodeid,name);
+    return data.nodeid;
+}
+
+// Returns a member name without . components and leading or trailing /, or NULL if it leaves the directory unpacked to
+string CFS_UnpackName(string name) {
+    string nameCopy = copyString(name),normalized = copyString("");
+    char *component;
+    for (component = strtok(nameCopy,"/"); component != NULL; component = strtok(NULL,"/")) {
+        if (!strcmp(".",component))
+            continue;
+        if (!strcmp("..",component)) {
+            DestroyString(&normalized);
+            break;
+        }
+        if (normalized[0] != '\0')
+            stringAppend(&normalized,"/");
+        stringAppend(&normalized,component);
+    }
+    DestroyString(&nameCopy);
+    return normalized;
+}
+
+// Adds the members of a tar stream to a cfs directory.
+// When importing with -update (report is not NULL) existing files are rewritten in place unless the member
+// has their size and modification time.
+int CFS_Unpack(CFS cfs,FILE *in,nodeid_t dirnodeid,importReport *report) {
+    tarEntry entry;
+    unpackBatch batch;
+    memset(&batch,0,sizeof(unpackBatch));
+    char content[DATABLOCK_NUM];
+    unsigned int offset;
+    int ret;
+    while ((ret = Tar_ReadMember(in,&entry)) == 1) {
+        int consumed = 0;
+        string name = CFS_UnpackName(entry.name);
+        if (name == NULL) {
+            printf("Skipping %s (outside of the directory)\n",entry.name);
+        } else if (name[0] != '\0' && (entry.type == TAR_FILE || entry.type == TAR_DIRECTORY || entry.type == TAR_HARDLINK)) {
+            // Split the name to the parent's path and the entity's name
+            char *slash = strrchr(name,'/');
+            string filename = slash == NULL ? name : slash + 1;
+            if (slash != NULL)
+                *slash = '\0';
+            location target = {0};
+            if (entry.type == TAR_HARDLINK) {
+                // The link's target may be in the batched directory
+                CFS_UnpackFlush(cfs,&batch);
+                string targetName = CFS_UnpackName(entry.linkname);
+                if (targetName != NULL) {
+                    target = getPathLocation(cfs,targetName,dirnodeid,0);
+                    DestroyString(&targetName);
+                }
+            }
+            if (!CFS_UnpackParent(cfs,dirnodeid,slash == NULL ? "" : name,&batch)) {
+                // Already reported
+            } else if (CFS_DirectoryFindEntry(cfs,&batch.dirData,filename,&offset) != -1) {
+                nodeid_t existingId = CFS_DirectoryEntryId(&batch.dirData,offset);
+                unsigned int existingType = CFS_DirectoryEntryType(&batch.dirData,offset);
+                MDS existingData;
+                if (entry.type == TAR_DIRECTORY && existingType == TYPE_DIRECTORY) {
+                    // Directories that already exist are merged with the archived ones
+                } else if (report != NULL && entry.type == TAR_HARDLINK && target.valid && existingId == target.nodeid) {
+                    // Link from an earlier import
+                } else if (report != NULL && entry.type == TAR_FILE && existingType == TYPE_FILE && CFS_ReadNodeAttributes(cfs,existingId,&existingData)
+                    && existingData.size == entry.size && existingData.modificationTime == entry.mtime) {
+                    report->unchanged++;
+                    report->unchangedBytes += entry.size;
+                } else if (report != NULL && entry.type == TAR_FILE && existingType == TYPE_FILE && entry.size <= cfs->MAX_FILE_SIZE) {
+                    consumed = 1;
+                    if (!Tar_ReadData(in,content,entry.size)) {
+                        ret = -1;
                     } else {
-                        printf("Not enough space to move %s in new directory\n",sourcename);
-                        return 0;
+                        // The file's size change is propagated through the directory so it must be written first
+                        CFS_UnpackFlush(cfs,&batch);
+                        CFS_ModifyFile(cfs,existingId,content,entry.size,entry.mtime);
+                        report->updated++;
+                        report->updatedBytes += entry.size;
                     }
+                } else if (report != NULL && entry.type == TAR_FILE && existingType == TYPE_FILE) {
+                    printf("File %s does not fit in cfs.\n",filename);
                 } else {
-                    // Destination directory is the same with the source one so simply rename the file
-                    strcpy(sourceDirdata.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int),destname);
-                    // Write updated source data back to cfs
-                    lseek(cfs->fileDesc,sizeof(superblock) + sourcedirid * sizeof(MDS),SEEK_SET);
-                    write(cfs->fileDesc,&sourceDirdata,sizeof(MDS));
-                    return 1;
+                    printf("File %s already exists\n",filename);
+                }
+            } else if (entry.type == TAR_DIRECTORY) {
+                if (CFS_UnpackCreate(cfs,&batch,filename,TYPE_DIRECTORY,NULL,0,entry.mtime) == 0)
+                    printf("Not enough space to create directory %s\n",filename);
+            } else if (entry.type == TAR_HARDLINK) {
+                MDS sourceData;
+                if (!target.valid || target.type != TYPE_FILE) {
+                    printf("Link target %s not found\n",entry.linkname);
+                } else if (!CFS_DirectoryFits(cfs,&batch.dirData,filename)) {
+                    printf("Not enough space in cfs to unpack %s\n",filename);
+                } else if (CFS_ReadNode(cfs,target.nodeid,&sourceData) && sourceData.links == MAX_LINKS) {
+                    printf("Too many links to %s\n",entry.linkname);
+                } else {
+                    sourceData.link_parents[sourceData.links++] = batch.dirnodeid;
+                    CFS_WriteNode(cfs,&sourceData);
+                    CFS_DirectoryAddEntry(cfs,&batch.dirData,target.nodeid,TYPE_FILE,filename);
+                    cfs->sb.HARD_LINKS++;
+                    batch.bytes += sourceData.size;
+                    batch.entries++;
+                    batch.links++;
+                    CFS_RecordChange(cfs,CHANGE_LINK,target.nodeid,batch.dirnodeid,filename);
+                }
+            } else if (entry.size > cfs->MAX_FILE_SIZE) {
+                printf("File %s does not fit in cfs.\n",filename);
+            } else {
+                consumed = 1;
+                if (!Tar_ReadData(in,content,entry.size))
+                    ret = -1;
+                else if (CFS_UnpackCreate(cfs,&batch,filename,TYPE_FILE,content,entry.size,entry.mtime) == 0)
+                    printf("Not enough space in cfs to unpack %s\n",filename);
+                else if (report != NULL) {
+                    report->added++;
+                    report->addedBytes += entry.size;
+                }
+            }
+        } else if (name[0] != '\0') {
+            printf("Skipping %s (unsupported member type)\n",entry.name);
+        }
+        if (name != NULL)
+            DestroyString(&name);
+        if (ret == -1 || (!consumed && !Tar_SkipData(in,entry.size))) {
+            ret = -1;
+            break;
+        }
+    }
+    CFS_UnpackFlush(cfs,&batch);
+    if (ret == -1)
+        printf("Archive is corrupt or truncated\n");
+    if (report == NULL)
+        printf("Unpacked %llu directories, %llu files (%llu bytes) and %llu links\n",(unsigned long long)batch.directories,(unsigned long long)batch.files,(unsigned long long)batch.fileBytes,(unsigned long long)batch.links);
+    return ret != -1;
+}
+
+// Size of the host buffer that CFS_BuildImage writes the cfs file through
+#define BUILD_BUFFER_SIZE (1 << 20)
+
+// Entity of an image planned by CFS_BuildImage. It's index in the plan is it's nodeid.
+typedef struct {
+    string name;
+    nodeid_t parent;
+    nodeid_t firstChild; // Directories only: children in the order of their entries (0 for none)
+    nodeid_t lastChild;
+    nodeid_t nextSibling;
+    unsigned int type;
+    uint64_t size; // Files only
+    time_t mtime; // Files only: modification time of the host file
+    uint64_t subtree_bytes; // Directories only
+    uint64_t subtree_entries;
+} buildNode;
+
+typedef struct {
+    buildNode *nodes;
+    nodeid_t count;
+    nodeid_t capacity;
+    uint64_t directories;
+    uint64_t fileBytes;
+} buildPlan;
+
+// Appends an entity to the plan and links it to it's parent's children
+nodeid_t CFS_BuildAddNode(buildPlan *plan,string name,nodeid_t parent,unsigned int type,uint64_t size) {
+    if (plan->count == plan->capacity) {
+        nodeid_t capacity = plan->capacity ? 2*plan->capacity : 1024;
+        buildNode *nodes = realloc(plan->nodes,capacity*sizeof(buildNode));
+        if (nodes == NULL) {
+            printf("Not enough memory.\n");
+            return 0;
+        }
+        plan->nodes = nodes;
+        plan->capacity = capacity;
+    }
+    nodeid_t nodeid = plan->count++;
+    buildNode *node = plan->nodes + nodeid;
+    memset(node,0,sizeof(buildNode));
+    node->name = copyString(name);
+    node->parent = parent;
+    node->type = type;
+    node->size = size;
+    if (nodeid != parent) {
+        if (plan->nodes[parent].firstChild == 0)
+            plan->nodes[parent].firstChild = nodeid;
+        else
+            plan->nodes[plan->nodes[parent].lastChild].nextSibling = nodeid;
+        plan->nodes[parent].lastChild = nodeid;
+    }
+    if (type == TYPE_DIRECTORY)
+        plan->directories++;
+    else
+        plan->fileBytes += size;
+    return nodeid;
+}
+
+// Plans the contents of a host directory the way cfs_import would create them: in readdir order, every directory
+// followed by it's contents, skipping what would not fit. dirData is a scratch copy of the directory's node
+// that decides what fits in it.
+int CFS_BuildScanDirectory(CFS image,string source,nodeid_t dirnodeid,MDS *dirData,buildPlan *plan) {
+    struct stat entryinfo;
+    DIR *dirp;
+    struct dirent *dirContent;
+    MDS *childData = NULL;
+    int ok = 1;
+    if ((dirp = opendir(source)) == NULL) {
+        perror("Failed to open directory");
+        return 1;
+    }
+    dirData->nodeid = dirnodeid;
+    dirData->parent_nodeid = plan->nodes[dirnodeid].parent;
+    CFS_DirectoryInit(image,dirData);
+    while (ok && (dirContent = readdir(dirp)) != NULL) {
+        // Ignore . , .. directories and deleted entities
+        if (!strcmp(".",dirContent->d_name) || !strcmp("..",dirContent->d_name) || dirContent->d_ino == 0)
+            continue;
+        string dirContentPath = copyString(source);
+        stringAppend(&dirContentPath,"/");
+        stringAppend(&dirContentPath,dirContent->d_name);
+        if (stat(dirContentPath,&entryinfo) == -1) {
+            perror("Failed  to get  file  status");
+        } else if (S_ISDIR(entryinfo.st_mode)) {
+            if (!CFS_DirectoryFits(image,dirData,dirContent->d_name)) {
+                printf("Not enough space to create directory %s\n",dirContent->d_name);
+            } else if (childData == NULL && (childData = malloc(sizeof(MDS))) == NULL) {
+                printf("Not enough memory.\n");
+                ok = 0;
+            } else {
+                nodeid_t nodeid = CFS_BuildAddNode(plan,dirContent->d_name,dirnodeid,TYPE_DIRECTORY,0);
+                if (nodeid == 0) {
+                    ok = 0;
+                } else {
+                    CFS_DirectoryAddEntry(image,dirData,nodeid,TYPE_DIRECTORY,dirContent->d_name);
+                    ok = CFS_BuildScanDirectory(image,dirContentPath,nodeid,childData,plan);
+                }
+            }
+        } else if (S_ISREG(entryinfo.st_mode)) {
+            if (entryinfo.st_size > image->MAX_FILE_SIZE) {
+                printf("File %s does not fit in cfs.\n",dirContent->d_name);
+            } else if (!CFS_DirectoryFits(image,dirData,dirContent->d_name)) {
+                printf("Not enough space in cfs to import file %s\n",dirContent->d_name);
+            } else {
+                nodeid_t nodeid = CFS_BuildAddNode(plan,dirContent->d_name,dirnodeid,TYPE_FILE,entryinfo.st_size);
+                if (nodeid == 0) {
+                    ok = 0;
+                } else {
+                    plan->nodes[nodeid].mtime = entryinfo.st_mtime;
+                    CFS_DirectoryAddEntry(image,dirData,nodeid,TYPE_FILE,dirContent->d_name);
                 }
             }
+        } else {
+            printf("Unknown file type of %s\n",dirContentPath);
+        }
+        DestroyString(&dirContentPath);
+    }
+    closedir(dirp);
+    if (childData != NULL)
+        free(childData);
+    return ok;
+}
+
+// Host path of a planned entity
+string CFS_BuildHostPath(buildPlan *plan,string source,nodeid_t nodeid) {
+    if (nodeid == 0)
+        return copyString(source);
+    string path = CFS_BuildHostPath(plan,source,plan->nodes[nodeid].parent);
+    stringAppend(&path,"/");
+    stringAppend(&path,plan->nodes[nodeid].name);
+    return path;
+}
+
+// Builds a cfs file with the contents of a host directory without going through the interactive commands.
+// The whole tree is planned in memory first (nodeids in depth first order and complete directories) and
+// then every node is written once, in nodeid order, in a single sequential pass over the cfs file.
+// The result is the cfs file that cfs_create and cfs_import into / would produce.
+int CFS_BuildImage(string source,string pathname,unsigned int BLOCK_SIZE,unsigned int FILENAME_SIZE,unsigned int MAX_FILE_SIZE,unsigned int MAX_DIRECTORY_FILE_NUMBER,unsigned int ALLOCATION_POLICY,nodeid_t PREALLOCATED_NODES,unsigned int GROWTH_PERCENT) {
+    // By default directories hold as many entries as fit in MAX_FILE_SIZE
+    if (MAX_DIRECTORY_FILE_NUMBER == 0 && MAX_FILE_SIZE > sizeof(directoryHeader))
+        MAX_DIRECTORY_FILE_NUMBER = (MAX_FILE_SIZE - sizeof(directoryHeader))/MIN_DIRECTORY_ENTRY_SIZE;
+    if (!CFS_ValidGeometry(BLOCK_SIZE,FILENAME_SIZE,MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER,ALLOCATION_POLICY)) {
+        printf("Constraints are not satisfied.\n");
+        return 0;
+    }
+    struct stat st;
+    if (stat(source,&st) == -1 || !S_ISDIR(st.st_mode)) {
+        printf("No such directory %s\n",source);
+        return 0;
+    }
+    // Same superblock as cfs_create, so that the image matches one made by cfs_create and cfs_import
+    superblock sb;
+    CFS_NewSuperblock(&sb,BLOCK_SIZE,FILENAME_SIZE,MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER,ALLOCATION_POLICY,GROWTH_PERCENT);
+    struct cfs image;
+    memset(&image,0,sizeof(struct cfs));
+    image.fileDesc = -1;
+    MDS *data = malloc(sizeof(MDS));
+    if (data == NULL || !CFS_SetGeometry(&image,&sb)) {
+        printf("Not enough memory.\n");
+        free(data);
+        return 0;
+    }
+    // Plan the tree
+    buildPlan plan;
+    memset(&plan,0,sizeof(buildPlan));
+    CFS_BuildAddNode(&plan,"/",0,TYPE_DIRECTORY,0);
+    int ok = plan.count == 1 && CFS_BuildScanDirectory(&image,source,0,data,&plan);
+    nodeid_t nodeid;
+    // Children come after their parents so the aggregates are summed up backwards
+    for (nodeid = plan.count; ok && nodeid-- > 1;) {
+        buildNode *node = plan.nodes + nodeid,*parent = plan.nodes + node->parent;
+        parent->subtree_bytes += node->type == TYPE_DIRECTORY ? node->subtree_bytes : node->size;
+        parent->subtree_entries += node->type == TYPE_DIRECTORY ? node->subtree_entries + 1 : 1;
+    }
+    // Write the nodes in order after an empty superblock, that is only written once the nodes are
+    FILE *out = NULL;
+    char *zeros = calloc(1,image.NODE_STRIDE > image.NODES_OFFSET ? image.NODE_STRIDE : image.NODES_OFFSET);
+    if (ok && zeros == NULL) {
+        printf("Not enough memory.\n");
+        ok = 0;
+    }
+    if (ok && ((image.fileDesc = open(pathname,O_RDWR|O_CREAT|O_TRUNC,FILE_PERMISSIONS)) == -1 || (out = fdopen(dup(image.fileDesc),"w")) == NULL)) {
+        perror("Error creating cfs file");
+        ok = 0;
+    }
+    if (ok) {
+        setvbuf(out,NULL,_IOFBF,BUILD_BUFFER_SIZE);
+        ok = fwrite(zeros,1,image.NODES_OFFSET,out) == image.NODES_OFFSET;
+    }
+    time_t timer = time(NULL);
+    for (nodeid = 0; ok && nodeid < plan.count; nodeid++) {
+        buildNode *node = plan.nodes + nodeid;
+        // Initialize metadata bytes to 0 to avoid valgrind errors
+        memset(data,0,sizeof(MDS));
+        data->root = nodeid == 0;
+        data->nodeid = nodeid;
+        strcpy(data->filename,node->name);
+        data->type = node->type;
+        data->parent_nodeid = node->parent;
+        data->creation_time = data->accessTime = data->modificationTime = timer;
+        data->epoch = sb.EPOCH;
+        if (node->type == TYPE_DIRECTORY) {
+            nodeid_t child;
+            CFS_DirectoryInit(&image,data);
+            for (child = node->firstChild; child != 0; child = plan.nodes[child].nextSibling)
+                CFS_DirectoryAddEntry(&image,data,child,plan.nodes[child].type,plan.nodes[child].name);
+            data->subtree_bytes = node->subtree_bytes;
+            data->subtree_entries = node->subtree_entries;
+        } else {
+            // Read the file's content
+            string path = CFS_BuildHostPath(&plan,source,nodeid);
+            int fd = open(path,O_RDONLY);
+            if (fd == -1 || read(fd,data->data.datablocks,node->size) != node->size) {
+                printf("Failed to read %s\n",path);
+                ok = 0;
+            }
+            if (fd != -1)
+                close(fd);
+            DestroyString(&path);
+            data->size = node->size;
+            // Like cfs_import, so that a later cfs_import -update finds the file unchanged
+            data->modificationTime = node->mtime;
+        }
+        ok = ok && fwrite(data,1,image.NODE_SIZE,out) == image.NODE_SIZE && fwrite(zeros,1,image.NODE_STRIDE - image.NODE_SIZE,out) == image.NODE_STRIDE - image.NODE_SIZE;
+    }
+    if (out != NULL && fclose(out) == EOF)
+        ok = 0;
+    if (ok) {
+        // Account for the nodes and reserve the rest of the initial size
+        image.sb.NODE_COUNT = image.sb.RESERVED_NODES = image.sb.LIVE_NODES = plan.count;
+        image.sb.DIRECTORY_COUNT = plan.directories;
+        image.sb.FILE_BYTES = plan.fileBytes;
+        CFS_ReserveNodes(&image,PREALLOCATED_NODES);
+        ok = CFS_SyncSuperblock(&image);
+        if (ok)
+            printf("Built %s with %llu directories and %llu files (%llu bytes)\n",pathname,(unsigned long long)plan.directories - 1,(unsigned long long)(plan.count - plan.directories),(unsigned long long)plan.fileBytes);
+    }
+    if (image.fileDesc != -1) {
+        close(image.fileDesc);
+        // A metadata table left by a previous cfs file with the same name no longer applies
+        string metaFile = malloc(strlen(pathname) + strlen(".meta") + 1);
+        if (metaFile != NULL) {
+            sprintf(metaFile,"%s.meta",pathname);
+            unlink(metaFile);
+            free(metaFile);
+        }
+    }
+    for (nodeid = 0; nodeid < plan.count; nodeid++)
+        DestroyString(&plan.nodes[nodeid].name);
+    free(plan.nodes);
+    free(zeros);
+    free(data);
+    CFS_ReleaseGeometry(&image);
+    return ok;
+}
+
+// Copies the timestamps of a legacy node to a converted one
+void CFS_ConvertTimestamps(CFS cfs,nodeid_t nodeid,legacyMDS *legacyData) {
+    MDS data;
+    CFS_ReadNode(cfs,nodeid,&data);
+    data.creation_time = legacyData->creation_time;
+    data.accessTime = legacyData->accessTime;
+    data.modificationTime = legacyData->modificationTime;
+    CFS_WriteNode(cfs,&data);
+}
+
+// Recreates the contents of a legacy directory in a directory of the new cfs file
+// idMap keeps the new id of every converted legacy file so that hard links are preserved
+int CFS_ConvertLegacyDirectory(CFS cfs,int legacyDesc,unsigned int legacyDirId,nodeid_t dirnodeid,nodeid_t *idMap,unsigned int legacyCount) {
+    legacyMDS dirData,tmpData;
+    pread(legacyDesc,&dirData,sizeof(legacyMDS),sizeof(legacySuperblock) + (off_t)legacyDirId * sizeof(legacyMDS));
+    unsigned int i,curId,converted = 0;
+    nodeid_t newId;
+    for (i = 0; i < dirData.size/LEGACY_DIRECTORY_ENTRY_SIZE; i++) {
+        // Get id and name of the current entity
+        memcpy(&curId,dirData.datablocks + i*LEGACY_DIRECTORY_ENTRY_SIZE,sizeof(unsigned int));
+        string filename = dirData.datablocks + i*LEGACY_DIRECTORY_ENTRY_SIZE + sizeof(unsigned int);
+        // Ignore . and .. shortcuts and broken entries
+        if (!strcmp(".",filename) || !strcmp("..",filename) || curId >= legacyCount)
+            continue;
+        pread(legacyDesc,&tmpData,sizeof(legacyMDS),sizeof(legacySuperblock) + (off_t)curId * sizeof(legacyMDS));
+        if (tmpData.type == TYPE_DIRECTORY) {
+            if ((newId = CFS_CreateDirectory(cfs,filename,dirnodeid)) == 0) {
+                printf("Not enough space to convert directory %s\n",filename);
+                continue;
+            }
+            CFS_ConvertTimestamps(cfs,newId,&tmpData);
+            converted += 1 + CFS_ConvertLegacyDirectory(cfs,legacyDesc,curId,newId,idMap,legacyCount);
+        } else if (tmpData.type == TYPE_FILE) {
+            if (idMap[curId] != 0) {
+                // File was already converted under another name so just link it
+                int linked = CFS_CreateHardLink(cfs,filename,idMap[curId],dirnodeid);
+                if (linked == -1)
+                    printf("Too many links to convert hardlink %s\n",filename);
+                else if (!linked)
+                    printf("Not enough space to convert hardlink %s\n",filename);
+            } else if ((newId = CFS_CreateFile(cfs,filename,dirnodeid,tmpData.datablocks,tmpData.size,time(NULL))) != 0) {
+                CFS_ConvertTimestamps(cfs,newId,&tmpData);
+                idMap[curId] = newId;
+                converted++;
+            } else {
+                printf("Not enough space to convert file %s\n",filename);
+            }
+        }
+    }
+    return converted;
+}
+
+// Converts a cfs file created before the format was versioned to a new cfs file
+int CFS_ConvertLegacyFile(string source,string destination) {
+    int legacyDesc;
+    if ((legacyDesc = open(source,O_RDONLY)) == -1) {
+        printf("File %s does not exist\n",source);
+        return 0;
+    }
+    legacySuperblock lsb;
+    struct stat st;
+    fstat(legacyDesc,&st);
+    if (pread(legacyDesc,&lsb,sizeof(legacySuperblock),0) != sizeof(legacySuperblock) || ((superblock*)&lsb)->magic == CFS_MAGIC || lsb.BLOCK_SIZE != 1 || st.st_size < sizeof(legacySuperblock) + sizeof(legacyMDS)) {
+        printf("%s is not a legacy cfs file\n",source);
+        close(legacyDesc);
+        return 0;
+    }
+    unsigned int legacyCount = (st.st_size - sizeof(legacySuperblock))/sizeof(legacyMDS);
+    // Keep the legacy parameters where the new format allows them
+    unsigned int MAX_DIRECTORY_FILE_NUMBER = lsb.MAX_DIRECTORY_FILE_NUMBER;
+    if (MAX_DIRECTORY_FILE_NUMBER > (lsb.MAX_FILE_SIZE - sizeof(directoryHeader))/MIN_DIRECTORY_ENTRY_SIZE)
+        MAX_DIRECTORY_FILE_NUMBER = (lsb.MAX_FILE_SIZE - sizeof(directoryHeader))/MIN_DIRECTORY_ENTRY_SIZE;
+    if (Create_CFS_File(destination,lsb.BLOCK_SIZE,lsb.FILENAME_SIZE,lsb.MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER,ALLOCATE_FIRST,0,0,WRITE_IN_PLACE,0,1) == -1) {
+        close(legacyDesc);
+        return 0;
+    }
+    struct cfs target;
+    memset(&target,0,sizeof(struct cfs));
+    if ((target.fileDesc = open(destination,O_RDWR)) == -1) {
+        close(legacyDesc);
+        return 0;
+    }
+    superblock sb;
+    pread(target.fileDesc,&sb,sizeof(superblock),0);
+    CFS_SetGeometry(&target,&sb);
+    nodeid_t *idMap = calloc(legacyCount,sizeof(nodeid_t));
+    if (idMap == NULL) {
+        printf("Not enough memory.\n");
+        CFS_ReleaseGeometry(&target);
+        close(target.fileDesc);
+        close(legacyDesc);
+        return 0;
+    }
+    int converted = CFS_ConvertLegacyDirectory(&target,legacyDesc,0,0,idMap,legacyCount);
+    printf("Converted %d entities from %s to %s\n",converted,source,destination);
+    free(idMap);
+    CFS_ReleaseGeometry(&target);
+    close(target.fileDesc);
+    close(legacyDesc);
+    return 1;
+}
+
+// Prints the working cfs file's usage from the superblock counters (no nodes are read)
+void CFS_df(CFS cfs) {
+    superblock *sb = &cfs->sb;
+    // Log-structured cfs files use and reserve slots rather than nodes
+    nodeid_t used = cfs->logMap != NULL ? cfs->logSegments*LOG_SEGMENT_SLOTS : sb->NODE_COUNT,segment,freeSegments = 0;
+    printf("%s:\n",cfs->currentFile);
+    printf("Nodes: %llu total, %llu live, %llu deleted, %llu reserved\n",(unsigned long long)sb->NODE_COUNT,(unsigned long long)sb->LIVE_NODES,(unsigned long long)(sb->NODE_COUNT - sb->LIVE_NODES - sb->SNAPSHOT_NODES),(unsigned long long)(sb->RESERVED_NODES - used));
+    printf("Entities: %llu directories, %llu files, %llu hard links\n",(unsigned long long)sb->DIRECTORY_COUNT,(unsigned long long)(sb->LIVE_NODES - sb->DIRECTORY_COUNT),(unsigned long long)sb->HARD_LINKS);
+    printf("Bytes: %llu of file data, %llu used, %llu allocated\n",(unsigned long long)sb->FILE_BYTES,(unsigned long long)CFS_SlotsBytes(cfs,used),(unsigned long long)CFS_SlotsBytes(cfs,sb->RESERVED_NODES));
+    printf("Snapshots: %u, %llu preserved nodes\n",sb->SNAPSHOT_COUNT,(unsigned long long)sb->SNAPSHOT_NODES);
+    if (cfs->stripes > 1)
+        printf("Stripes: %u member files (%s, %s.1 ... %s.%u)\n",cfs->stripes,cfs->currentFile,cfs->currentFile,cfs->currentFile,cfs->stripes - 1);
+    if (cfs->logMap != NULL) {
+        for (segment = 0; segment < cfs->logSegments; segment++)
+            freeSegments += cfs->logSegmentCurrent[segment] == 0;
+        printf("Log: %llu segments of %d slots, %llu free, %llu current versions\n",(unsigned long long)cfs->logSegments,LOG_SEGMENT_SLOTS,(unsigned long long)freeSegments,(unsigned long long)cfs->logCurrent);
+    }
+    if (sb->CHANGE_CAPACITY > 0)
+        printf("Changes: %llu of %llu records kept, last sequence %llu\n",(unsigned long long)(sb->CHANGE_SEQUENCE - sb->CHANGE_FIRST + 1),(unsigned long long)sb->CHANGE_CAPACITY,(unsigned long long)sb->CHANGE_SEQUENCE);
+}
+
+// Writes the records of the changes after since, one per line as "sequence operation nodeid parent name",
+// followed by a checkpoint line with the sequence number to continue from. If records after since were already
+// dropped a truncated line with the last one dropped comes first and the tree has to be scanned again.
+int CFS_Changes(CFS cfs,uint64_t since) {
+    static const char *operations[] = {"create","modify","touch","link","move","remove","reset"};
+    superblock *sb = &cfs->sb;
+    if (sb->CHANGE_CAPACITY == 0) {
+        printf("%s has no change log (see cfs_create -changes)\n",cfs->currentFile);
+        return 0;
+    }
+    if (since > sb->CHANGE_SEQUENCE) {
+        printf("No change %llu in %s, the last one is %llu\n",(unsigned long long)since,cfs->currentFile,(unsigned long long)sb->CHANGE_SEQUENCE);
+        return 0;
+    }
+    changeRecord *records = malloc(CHANGE_BATCH*sizeof(changeRecord));
+    if (records == NULL) {
+        printf("Not enough memory.\n");
+        return 0;
+    }
+    uint64_t sequence = since + 1,slot,count,i;
+    if (sequence < sb->CHANGE_FIRST) {
+        printf("truncated %llu\n",(unsigned long long)(sb->CHANGE_FIRST - 1));
+        sequence = sb->CHANGE_FIRST;
+    }
+    int ok = 1;
+    while (ok && sequence <= sb->CHANGE_SEQUENCE) {
+        // Batches stop at the end of the ring
+        slot = (sequence - 1)%sb->CHANGE_CAPACITY;
+        count = sb->CHANGE_SEQUENCE - sequence + 1;
+        if (count > CHANGE_BATCH)
+            count = CHANGE_BATCH;
+        if (count > sb->CHANGE_CAPACITY - slot)
+            count = sb->CHANGE_CAPACITY - slot;
+        ok = CFS_ReadChanges(cfs,slot,count,records);
+        for (i = 0; ok && i < count; i++) {
+            ok = records[i].sequence == sequence + i && records[i].op <= CHANGE_RESET;
+            if (ok)
+                printf("%llu %s %llu %llu %s\n",(unsigned long long)records[i].sequence,operations[records[i].op],(unsigned long long)records[i].nodeid,(unsigned long long)records[i].parent,records[i].name);
+        }
+        sequence += count;
+    }
+    if (ok)
+        printf("checkpoint %llu\n",(unsigned long long)sb->CHANGE_SEQUENCE);
+    else
+        printf("Error reading the change log of %s\n",cfs->currentFile);
+    free(records);
+    return ok;
+}
+
+// Predicates of cfs_find and the buffer that matching paths are written to
+#define FIND_BUFFER_SIZE 65536
+
+typedef struct {
+    string name; // Glob the entity's name must match (NULL for any)
+    int type; // TYPE_FILE, TYPE_DIRECTORY or -1 for any
+    int sizeCompare; // Size must be greater (1), less (-1) or equal (0) to size
+    uint64_t size;
+    int hasSize;
+    time_t newer; // Modification time must be after newer
+    int hasNewer;
+    unsigned int links; // Number of names the entity must have
+    int hasLinks;
+    char buffer[FIND_BUFFER_SIZE];
+    size_t used;
+} findQuery;
+
+void CFS_FindFlush(findQuery *query) {
+    fwrite(query->buffer,1,query->used,stdout);
+    query->used = 0;
+}
+
+void CFS_FindOutput(findQuery *query,string path) {
+    size_t length = strlen(path);
+    if (query->used + length + 1 > FIND_BUFFER_SIZE)
+        CFS_FindFlush(query);
+    if (length + 1 > FIND_BUFFER_SIZE) {
+        puts(path);
+        return;
+    }
+    memcpy(query->buffer + query->used,path,length);
+    query->used += length;
+    query->buffer[query->used++] = '\n';
+}
+
+// Tests an entity against the predicates. Name and type come from the directory entry,
+// so the entity's metadata are only read if they pass and a metadata predicate is given
+int CFS_FindMatches(CFS cfs,findQuery *query,nodeid_t nodeid,string name,unsigned int type) {
+    if (query->name != NULL && fnmatch(query->name,name,0))
+        return 0;
+    if (query->type != -1 && query->type != type)
+        return 0;
+    if (!query->hasSize && !query->hasNewer && !query->hasLinks)
+        return 1;
+    MDS data;
+    CFS_ReadNodeAttributes(cfs,nodeid,&data);
+    if (query->hasSize && (query->sizeCompare > 0 ? data.size <= query->size : (query->sizeCompare < 0 ? data.size >= query->size : data.size != query->size)))
+        return 0;
+    if (query->hasNewer && data.modificationTime <= query->newer)
+        return 0;
+    if (query->hasLinks && data.links + 1 != query->links)
+        return 0;
+    return 1;
+}
+
+void CFS_FindDirectory(CFS cfs,nodeid_t dirnodeid,string path,findQuery *query) {
+    MDS dirData;
+    CFS_ReadNode(cfs,dirnodeid,&dirData);
+    unsigned int i,offset;
+    nodeid_t curId;
+    unsigned int type;
+    // Skip . and .. shortcuts
+    for (i = 2,offset = CFS_DirectoryEntryOffset(&dirData,2); i < CFS_DirectoryEntryCount(&dirData); i++,offset = CFS_DirectoryNextEntry(&dirData,offset)) {
+        curId = CFS_DirectoryEntryId(&dirData,offset);
+        type = CFS_DirectoryEntryType(&dirData,offset);
+        string name = CFS_DirectoryEntryName(&dirData,offset);
+        string entityPath = copyString(path);
+        if (entityPath[strlen(entityPath) - 1] != '/')
+            stringAppend(&entityPath,"/");
+        stringAppend(&entityPath,name);
+        if (CFS_FindMatches(cfs,query,curId,name,type))
+            CFS_FindOutput(query,entityPath);
+        if (type == TYPE_DIRECTORY)
+            CFS_FindDirectory(cfs,curId,entityPath,query);
+        DestroyString(&entityPath);
+    }
+}
+
+// Prints the paths of the entities under (and including) path that satisfy all the predicates
+void CFS_Find(CFS cfs,location loc,string path,findQuery *query) {
+    query->used = 0;
+    if (CFS_FindMatches(cfs,query,loc.nodeid,loc.filenanme,loc.type))
+        CFS_FindOutput(query,path);
+    if (loc.type == TYPE_DIRECTORY)
+        CFS_FindDirectory(cfs,loc.nodeid,path,query);
+    CFS_FindFlush(query);
+}
+
+// Runs worker on work in one thread per processor (at most tasks threads, the calling one included).
+// Workers take tasks until none is left, so the calling thread does whatever threads that could not be started would have.
+void CFS_RunWorkers(void *(*worker)(void*),void *work,unsigned int tasks) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int i,started = 0,threadCount = cpus < 1 ? 1 : (cpus > tasks ? tasks : cpus);
+    pthread_t *threads = threadCount > 1 ? malloc((threadCount - 1)*sizeof(pthread_t)) : NULL;
+    if (threads != NULL) {
+        for (started = 0; started < threadCount - 1; started++)
+            if (pthread_create(&threads[started],NULL,worker,work) != 0)
+                break;
+    }
+    worker(work);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i],NULL);
+    free(threads);
+}
+
+// Define grep option flags
+#define GREP_RECURSIVE 0
+#define GREP_FIXED 1
+#define GREP_EXTENDED 2
+#define GREP_LIST 3
+#define GREP_COUNT 4
+
+// Pattern of cfs_grep: fixed strings use the vectorized search, everything else a regular expression
+typedef struct {
+    string pattern;
+    size_t length;
+    int fixed;
+    regex_t regex;
+    int options[5];
+} grepPattern;
+
+// File searched by one of the worker threads, with the output it produced
+typedef struct {
+    nodeid_t nodeid;
+    string path;
+    string output;
+} grepTask;
+
+typedef struct {
+    CFS cfs;
+    grepPattern *pattern;
+    grepTask *tasks;
+    unsigned int taskCount;
+    unsigned int next; // Next task to be taken
+} grepWork;
+
+// Adds the regular files under (and including) an entity to the files to be searched
+int CFS_GrepCollect(CFS cfs,nodeid_t nodeid,unsigned int type,string path,int recursive,grepTask **tasks,unsigned int *taskCount,unsigned int *capacity) {
+    if (type == TYPE_FILE) {
+        if (*taskCount == *capacity) {
+            grepTask *grown = realloc(*tasks,(*capacity ? 2*(*capacity) : 64)*sizeof(grepTask));
+            if (grown == NULL)
+                return 0;
+            *tasks = grown;
+            *capacity = *capacity ? 2*(*capacity) : 64;
+        }
+        (*tasks)[*taskCount].nodeid = nodeid;
+        (*tasks)[*taskCount].path = copyString(path);
+        (*tasks)[*taskCount].output = NULL;
+        (*taskCount)++;
+        return 1;
+    }
+    if (!recursive) {
+        printf("%s is a directory\n",path);
+        return 1;
+    }
+    MDS dirData;
+    CFS_ReadNode(cfs,nodeid,&dirData);
+    unsigned int i,offset;
+    int ok = 1;
+    // Skip . and .. shortcuts
+    for (i = 2,offset = CFS_DirectoryEntryOffset(&dirData,2); ok && i < CFS_DirectoryEntryCount(&dirData); i++,offset = CFS_DirectoryNextEntry(&dirData,offset)) {
+        string entityPath = copyString(path);
+        if (entityPath[strlen(entityPath) - 1] != '/')
+            stringAppend(&entityPath,"/");
+        stringAppend(&entityPath,CFS_DirectoryEntryName(&dirData,offset));
+        ok = CFS_GrepCollect(cfs,CFS_DirectoryEntryId(&dirData,offset),CFS_DirectoryEntryType(&dirData,offset),entityPath,recursive,tasks,taskCount,capacity);
+        DestroyString(&entityPath);
+    }
+    return ok;
+}
+
+// Appends "path:line" to a task's output
+void CFS_GrepOutputLine(grepTask *task,const char *line,size_t length) {
+    string text = malloc(length + 1);
+    if (text == NULL)
+        return;
+    memcpy(text,line,length);
+    text[length] = '\0';
+    if (task->output == NULL)
+        task->output = copyString("");
+    stringAppend(&task->output,task->path);
+    stringAppend(&task->output,":");
+    stringAppend(&task->output,text);
+    stringAppend(&task->output,"\n");
+    free(text);
+}
+
+// Searches a file's datastream in place, line by line
+void CFS_GrepFile(CFS cfs,grepPattern *pattern,grepTask *task,MDS *data) {
+    CFS_ReadNode(cfs,task->nodeid,data);
+    const char *text = data->data.datablocks,*end = text + data->size,*line = text,*lineEnd,*found;
+    unsigned long long count = 0;
+    regmatch_t match;
+    while (line < end) {
+        if (pattern->fixed) {
+            // Jump straight to the next occurence and the line that contains it
+            if ((found = TextSearch_Find(line,end - line,pattern->pattern,pattern->length)) == NULL)
+                break;
+            while (found > line && found[-1] != '\n')
+                found--;
+            line = found;
+            lineEnd = memchr(line,'\n',end - line);
+            if (lineEnd == NULL)
+                lineEnd = end;
+        } else {
+            lineEnd = memchr(line,'\n',end - line);
+            if (lineEnd == NULL)
+                lineEnd = end;
+            match.rm_so = 0;
+            match.rm_eo = lineEnd - line;
+            if (regexec(&pattern->regex,line,1,&match,REG_STARTEND)) {
+                line = lineEnd + 1;
+                continue;
+            }
+        }
+        count++;
+        if (pattern->options[GREP_LIST])
+            break;
+        if (!pattern->options[GREP_COUNT])
+            CFS_GrepOutputLine(task,line,lineEnd - line);
+        line = lineEnd + 1;
+    }
+    if (pattern->options[GREP_LIST]) {
+        if (count) {
+            task->output = copyString(task->path);
+            stringAppend(&task->output,"\n");
+        }
+    } else if (pattern->options[GREP_COUNT]) {
+        char number[32];
+        sprintf(number,":%llu\n",count);
+        task->output = copyString(task->path);
+        stringAppend(&task->output,number);
+    }
+}
+
+void *CFS_GrepWorker(void *arg) {
+    grepWork *work = arg;
+    unsigned int t;
+    MDS *data = malloc(sizeof(MDS));
+    if (data == NULL)
+        return NULL;
+    while ((t = __sync_fetch_and_add(&work->next,1)) < work->taskCount)
+        CFS_GrepFile(work->cfs,work->pattern,&work->tasks[t],data);
+    free(data);
+    return NULL;
+}
+
+// Searches the files in parallel and prints their matches in order
+void CFS_Grep(CFS cfs,grepPattern *pattern,grepTask *tasks,unsigned int taskCount) {
+    grepWork work = {cfs,pattern,tasks,taskCount,0};
+    unsigned int i;
+    CFS_RunWorkers(CFS_GrepWorker,&work,taskCount);
+    for (i = 0; i < taskCount; i++) {
+        if (tasks[i].output != NULL)
+            fputs(tasks[i].output,stdout);
+    }
+}
+
+// Prints the size of an entity, answered from the subtree aggregates for directories
+void CFS_du(CFS cfs,nodeid_t nodeid,string path) {
+    MDS data;
+    CFS_ReadNodeMetadata(cfs,nodeid,&data);
+    if (data.type == TYPE_DIRECTORY)
+        printf("%llu\t%llu\t%s\n",(unsigned long long)data.subtree_bytes,(unsigned long long)data.subtree_entries,path);
+    else
+        printf("%llu\t1\t%s\n",(unsigned long long)data.size,path);
+}
+
+// Recounts the aggregates of a directory's subtree and reports every directory whose stored ones drifted
+// Returns the number of directories checked
+uint64_t CFS_DuVerifyDirectory(CFS cfs,nodeid_t dirnodeid,string path,uint64_t *bytes,uint64_t *entries,uint64_t *drifts) {
+    MDS dirData,tmpData;
+    CFS_ReadNode(cfs,dirnodeid,&dirData);
+    uint64_t checked = 1,subBytes,subEntries;
+    unsigned int i,offset;
+    *bytes = *entries = 0;
+    // Skip . and .. shortcuts
+    for (i = 2,offset = CFS_DirectoryEntryOffset(&dirData,2); i < CFS_DirectoryEntryCount(&dirData); i++,offset = CFS_DirectoryNextEntry(&dirData,offset)) {
+        (*entries)++;
+        if (CFS_DirectoryEntryType(&dirData,offset) == TYPE_DIRECTORY) {
+            string subPath = copyString(path);
+            if (strcmp(path,"/"))
+                stringAppend(&subPath,"/");
+            stringAppend(&subPath,CFS_DirectoryEntryName(&dirData,offset));
+            checked += CFS_DuVerifyDirectory(cfs,CFS_DirectoryEntryId(&dirData,offset),subPath,&subBytes,&subEntries,drifts);
+            *bytes += subBytes;
+            *entries += subEntries;
+            DestroyString(&subPath);
+        } else {
+            CFS_ReadNodeAttributes(cfs,CFS_DirectoryEntryId(&dirData,offset),&tmpData);
+            *bytes += tmpData.size;
+        }
+    }
+    if (*bytes != dirData.subtree_bytes || *entries != dirData.subtree_entries) {
+        printf("Drift in %s: stored %llu bytes %llu entries, counted %llu bytes %llu entries\n",path,(unsigned long long)dirData.subtree_bytes,(unsigned long long)dirData.subtree_entries,(unsigned long long)*bytes,(unsigned long long)*entries);
+        __sync_fetch_and_add(drifts,1);
+    }
+    return checked;
+}
+
+// Sub-directory of the verified directory, verified by one of the worker threads
+typedef struct {
+    nodeid_t nodeid;
+    string path;
+    uint64_t bytes;
+    uint64_t entries;
+    uint64_t checked;
+} duTask;
+
+typedef struct {
+    CFS cfs;
+    duTask *tasks;
+    unsigned int taskCount;
+    unsigned int next; // Next task to be taken
+    uint64_t drifts;
+} duWork;
+
+void *CFS_DuVerifyWorker(void *arg) {
+    duWork *work = arg;
+    unsigned int t;
+    while ((t = __sync_fetch_and_add(&work->next,1)) < work->taskCount)
+        work->tasks[t].checked = CFS_DuVerifyDirectory(work->cfs,work->tasks[t].nodeid,work->tasks[t].path,&work->tasks[t].bytes,&work->tasks[t].entries,&work->drifts);
+    return NULL;
+}
+
+// Recounts the aggregates below a directory, verifying it's sub-directories in parallel
+int CFS_DuVerify(CFS cfs,nodeid_t dirnodeid,string path) {
+    MDS dirData,tmpData;
+    CFS_ReadNode(cfs,dirnodeid,&dirData);
+    unsigned int i,offset,entries = CFS_DirectoryEntryCount(&dirData);
+    duWork work = {cfs,malloc(entries*sizeof(duTask)),0,0,0};
+    if (work.tasks == NULL) {
+        printf("Not enough memory.\n");
+        return 0;
+    }
+    uint64_t bytes = 0,checked = 1,counted = 0;
+    // Files are counted here and sub-directories are shared among the threads
+    for (i = 2,offset = CFS_DirectoryEntryOffset(&dirData,2); i < entries; i++,offset = CFS_DirectoryNextEntry(&dirData,offset)) {
+        counted++;
+        if (CFS_DirectoryEntryType(&dirData,offset) == TYPE_DIRECTORY) {
+            duTask *task = &work.tasks[work.taskCount++];
+            task->nodeid = CFS_DirectoryEntryId(&dirData,offset);
+            task->path = copyString(path);
+            if (strcmp(path,"/"))
+                stringAppend(&task->path,"/");
+            stringAppend(&task->path,CFS_DirectoryEntryName(&dirData,offset));
+        } else {
+            CFS_ReadNodeAttributes(cfs,CFS_DirectoryEntryId(&dirData,offset),&tmpData);
+            bytes += tmpData.size;
+        }
+    }
+    CFS_RunWorkers(CFS_DuVerifyWorker,&work,work.taskCount);
+    for (i = 0; i < work.taskCount; i++) {
+        bytes += work.tasks[i].bytes;
+        counted += work.tasks[i].entries;
+        checked += work.tasks[i].checked;
+        DestroyString(&work.tasks[i].path);
+    }
+    free(work.tasks);
+    if (bytes != dirData.subtree_bytes || counted != dirData.subtree_entries) {
+        printf("Drift in %s: stored %llu bytes %llu entries, counted %llu bytes %llu entries\n",path,(unsigned long long)dirData.subtree_bytes,(unsigned long long)dirData.subtree_entries,(unsigned long long)bytes,(unsigned long long)counted);
+        work.drifts++;
+    }
+    printf("Verified %llu directories under %s, %llu drifted\n",(unsigned long long)checked,path,(unsigned long long)work.drifts);
+    return work.drifts == 0;
+}
+
+// Punches the datablocks of every deleted node and truncates deleted nodes at the end of the cfs file
+int CFS_Trim(CFS cfs) {
+    nodeid_t nodeid,count = CFS_NodeCount(cfs),live = 0,punched = 0;
+    for (nodeid = 0; nodeid < count; nodeid++) {
+        if (!CFS_NodeDeleted(cfs,nodeid)) {
+            live = nodeid + 1;
+        } else if (!CFS_PunchNode(cfs,nodeid)) {
+            perror("Error punching deleted nodes");
+            return 0;
+        } else {
+            punched++;
         }
     }
-    return 0;
+    if (cfs->logMap != NULL) {
+        // The current versions are moved to the start of the log, leaving out the trailing holes
+        nodeid_t segments = cfs->logSegments;
+        cfs->sb.NODE_COUNT = live;
+        if (!CFS_LogCompact(cfs)) {
+            perror("Error compacting the log");
+            return 0;
+        }
+        if (cfs->meta != NULL)
+            MetaTable_Resize(cfs->meta,live);
+        printf("Trimmed %llu log segments, %llu nodes removed from the end of %s\n",(unsigned long long)(segments - cfs->logSegments),(unsigned long long)(count - live),cfs->currentFile);
+        return 1;
+    }
+    // Trailing holes and preallocated nodes are not needed since new nodes can be appended again
+    if (!CFS_TruncateSlots(cfs,live)) {
+        perror("Error truncating cfs file");
+        return 0;
+    }
+    cfs->sb.NODE_COUNT = cfs->sb.RESERVED_NODES = live;
+    CFS_SyncSuperblock(cfs);
+    if (cfs->meta != NULL)
+        MetaTable_Resize(cfs->meta,live);
+    printf("Trimmed %llu deleted nodes, %llu removed from the end of %s\n",(unsigned long long)punched,(unsigned long long)(count - live),cfs->currentFile);
+    return 1;
 }
 
-string getEntityNameFromPath(string path) {
-    string pathCopy = copyString(path);
-    string token = strtok(pathCopy,"/");
-    string name;
-    while (token != NULL) {
-        name = token;
-        token = strtok(NULL,"/");
+// Marks nodes that are not (yet) part of the compacted cfs file
+#define COMPACT_UNMAPPED ((nodeid_t)-1)
+
+// Numbers the entities of a directory's subtree in the order they are stored in the compacted cfs file:
+// a directory's entries right after it, followed by the subtrees of it's subdirectories.
+// idMap keeps the new id of every old node (so that hard links are numbered once) and order/parents the
+// old id and new parent of every new node
+void CFS_CompactNumberDirectory(CFS cfs,nodeid_t dirnodeid,nodeid_t count,nodeid_t *idMap,nodeid_t *order,nodeid_t *parents,nodeid_t *next) {
+    MDS dirData;
+    CFS_ReadNode(cfs,dirnodeid,&dirData);
+    nodeid_t first = *next,id;
+    unsigned int i,offset,entries = CFS_DirectoryEntryCount(&dirData);
+    // Skip . and .. shortcuts
+    offset = CFS_DirectoryEntryOffset(&dirData,2);
+    for (i = 2; i < entries; i++) {
+        id = CFS_DirectoryEntryId(&dirData,offset);
+        if (id < count && idMap[id] == COMPACT_UNMAPPED) {
+            idMap[id] = *next;
+            order[*next] = id;
+            parents[*next] = idMap[dirnodeid];
+            (*next)++;
+        }
+        offset = CFS_DirectoryNextEntry(&dirData,offset);
+    }
+    // Only descend into directories numbered above
+    offset = CFS_DirectoryEntryOffset(&dirData,2);
+    for (i = 2; i < entries; i++) {
+        id = CFS_DirectoryEntryId(&dirData,offset);
+        if (CFS_DirectoryEntryType(&dirData,offset) == TYPE_DIRECTORY && id < count && idMap[id] >= first)
+            CFS_CompactNumberDirectory(cfs,id,count,idMap,order,parents,next);
+        offset = CFS_DirectoryNextEntry(&dirData,offset);
     }
-    name = copyString(name);
-    DestroyString(&pathCopy);
-    return name;
 }
 
-int CFS_ImportFile(CFS cfs,string source,unsigned int nodeid) {
-    // Check if file exists in cfs
-    string filename = getEntityNameFromPath(source);
-    int ret = 1;
-    if (!exists(cfs->fileDesc,filename,nodeid)) {
-        // Open linux file
-        int fd = open(source,O_RDONLY);
-        // Get linux file size in bytes
-        unsigned int size = lseek(fd,0L,SEEK_END);
-        lseek(fd,0L,SEEK_SET);
-        // Check if linux file fits in cfs
-        if (size <= cfs->MAX_FILE_SIZE) {
-            // Linux file fits in cfs
-            // Read it's content
-            char bytes[DATABLOCK_NUM];
-            read(fd,bytes,size);
-            //printf("%s\n",bytes);
-            // Create the corresponding file in cfs
-            if (!CFS_CreateFile(cfs,filename,nodeid,bytes,size)) {
-                printf("Not enough space in cfs to import file %s\n",filename);
-                ret = 0;
+// Rewrites the working cfs file without holes and with it's nodes in tree order, so that recursive scans read it sequentially.
+// The new image is written next to the old one and replaces it only once complete.
+int CFS_Compact(CFS cfs) {
+    // Copies are only found through the node they preserve, which gets a new id
+    if (cfs->sb.SNAPSHOT_COUNT > 0) {
+        printf("Delete the snapshots of %s before compacting it\n",cfs->currentFile);
+        return 0;
+    }
+    nodeid_t count = CFS_NodeCount(cfs),next = 1,i;
+    nodeid_t *idMap = malloc(count*sizeof(nodeid_t));
+    nodeid_t *order = malloc(count*sizeof(nodeid_t));
+    nodeid_t *parents = malloc(count*sizeof(nodeid_t));
+    string tmpFile = malloc(strlen(cfs->currentFile) + strlen(".compact") + 1);
+    if (idMap == NULL || order == NULL || parents == NULL || tmpFile == NULL) {
+        printf("Not enough memory.\n");
+        free(idMap);
+        free(order);
+        free(parents);
+        free(tmpFile);
+        return 0;
+    }
+    // Root keeps id 0
+    for (i = 0; i < count; i++)
+        idMap[i] = COMPACT_UNMAPPED;
+    idMap[0] = order[0] = parents[0] = 0;
+    CFS_CompactNumberDirectory(cfs,0,count,idMap,order,parents,&next);
+    // Write the nodes to a new cfs file with the same parameters
+    sprintf(tmpFile,"%s.compact",cfs->currentFile);
+    superblock sb = cfs->sb;
+    // Unreachable nodes are dropped so the counters are recounted.
+    // The new image is written in place, which for log-structured cfs files is a log with node i in slot i.
+    sb.NODE_COUNT = sb.RESERVED_NODES = sb.LIVE_NODES = next;
+    if (sb.WRITE_MODE == WRITE_LOG)
+        sb.RESERVED_NODES = (next + LOG_SEGMENT_SLOTS - 1)/LOG_SEGMENT_SLOTS*LOG_SEGMENT_SLOTS;
+    sb.DIRECTORY_COUNT = sb.FILE_BYTES = sb.HARD_LINKS = 0;
+    // The records name the old ids so none is kept, a reset record follows them
+    sb.CHANGE_FIRST = sb.CHANGE_SEQUENCE + 1;
+    struct cfs target;
+    memset(&target,0,sizeof(struct cfs));
+    int ok = (target.fileDesc = open(tmpFile,O_RDWR|O_CREAT|O_TRUNC,FILE_PERMISSIONS)) != -1;
+    if (ok) {
+        ok = CFS_SetGeometry(&target,&sb) && CFS_OpenMembers(&target,tmpFile,O_RDWR|O_CREAT|O_TRUNC) && CFS_WriteSuperblock(&target,&sb);
+        MDS data;
+        unsigned int j,offset;
+        nodeid_t id;
+        for (i = 0; ok && i < next; i++) {
+            ok = CFS_ReadNode(cfs,order[i],&data);
+            data.nodeid = i;
+            // Files keep the directories of all their names
+            if (data.type == TYPE_FILE)
+                CFS_RenumberFileNames(&data,idMap);
+            else
+                data.parent_nodeid = parents[i];
+            // The log continues after the last node
+            data.sequence = i + 1;
+            if (data.type == TYPE_DIRECTORY) {
+                // Every entry (including . and ..) points to the new ids
+                offset = CFS_DirectoryFirstEntry();
+                for (j = 0; j < CFS_DirectoryEntryCount(&data); j++) {
+                    id = CFS_DirectoryEntryId(&data,offset);
+                    if (id < count && idMap[id] != COMPACT_UNMAPPED)
+                        memcpy(data.data.datablocks + offset,&idMap[id],sizeof(nodeid_t));
+                    offset = CFS_DirectoryNextEntry(&data,offset);
+                }
             }
-        } else {
-            // Linux file does not fit in cfs
-            printf("File %s does not fit in cfs.\n",filename);
-            ret = 0;
+            if (data.type == TYPE_DIRECTORY)
+                target.sb.DIRECTORY_COUNT++;
+            else
+                target.sb.FILE_BYTES += data.size;
+            target.sb.HARD_LINKS += data.links;
+            ok = ok && CFS_WriteNode(&target,&data);
         }
-        // Close linux file
-        close(fd);
+        ok = ok && CFS_SyncSuperblock(&target) && CFS_SyncMembers(&target);
+        sb = target.sb;
+        CFS_ReleaseGeometry(&target);
+        close(target.fileDesc);
+    }
+    int reopened = -1;
+    // The members of a striped cfs file are renamed before the 1st one, whose superblock describes them
+    if (ok && CFS_MoveMembers(&target,tmpFile,cfs->currentFile) && rename(tmpFile,cfs->currentFile) == 0
+        && (reopened = open(cfs->currentFile,cfs->direct ? O_RDWR|O_DIRECT : O_RDWR,FILE_PERMISSIONS)) != -1) {
+        close(cfs->fileDesc);
+        cfs->fileDesc = reopened;
+        cfs->sb = sb;
+        CFS_CloseMembers(cfs);
+        if (!CFS_OpenMembers(cfs,cfs->currentFile,cfs->direct ? O_RDWR|O_DIRECT : O_RDWR))
+            printf("Error reopening %s\n",cfs->currentFile);
+        // Every node moved so the inode map and the metadata table are rebuilt for the new image
+        if (cfs->logMap != NULL) {
+            CFS_CloseLog(cfs);
+            if (!CFS_OpenLog(cfs))
+                printf("Error reading the log of %s\n",cfs->currentFile);
+        }
+        MetaTable_Close(&cfs->meta);
+        CFS_OpenMetaTable(cfs,1);
+        cfs->currentDirectoryId = idMap[cfs->currentDirectoryId] == COMPACT_UNMAPPED ? 0 : idMap[cfs->currentDirectoryId];
+        CFS_RecordChange(cfs,CHANGE_RESET,0,0,"/");
+        printf("Compacted %s from %llu to %llu nodes\n",cfs->currentFile,(unsigned long long)count,(unsigned long long)next);
     } else {
-        printf("File %s already exists\n",filename);
-        ret = 0;
+        printf("Error compacting %s\n",cfs->currentFile);
+        unlink(tmpFile);
+        CFS_MoveMembers(&target,tmpFile,NULL);
+        ok = 0;
     }
-    DestroyString(&filename);
-    return ret;
+    free(idMap);
+    free(order);
+    free(parents);
+    free(tmpFile);
+    return ok;
 }
 
-int CFS_ImportDirectory(CFS cfs,string source,unsigned int nodeid) {
-    struct stat entryinfo;
-    DIR *dirp;
-    struct dirent *dirContent;
-    // Open linux directory
-    dirp = opendir(source);
-    // Read and import all entries
-    while ((dirContent = readdir(dirp)) != NULL) {
-        // Ignore . , .. directories and deleted entities
-        if (!strcmp(".",dirContent->d_name) || !strcmp("..",dirContent->d_name) || dirContent->d_ino == 0)
+// Entry of a directory being sealed
+typedef struct {
+    nodeid_t nodeid;
+    unsigned int type;
+    string name;
+} sealEntry;
+
+int CFS_SealEntryCompare(const void *a,const void *b) {
+    return strcmp(((const sealEntry*)a)->name,((const sealEntry*)b)->name);
+}
+
+// Rewrites the entries of a directory of a sealed cfs file: new ids, sorted names and the offset table (or fingerprints)
+void CFS_SealDirectory(CFS target,MDS *dirData,nodeid_t count,nodeid_t *idMap) {
+    MDS sorted = *dirData;
+    sealEntry entries[DATABLOCK_NUM/MIN_DIRECTORY_ENTRY_SIZE + 2];
+    unsigned int i,j = 0,offset,entryCount = CFS_DirectoryEntryCount(dirData);
+    // Skip . and .. shortcuts
+    for (i = 2,offset = CFS_DirectoryEntryOffset(dirData,2); i < entryCount; i++,offset = CFS_DirectoryNextEntry(dirData,offset)) {
+        nodeid_t id = CFS_DirectoryEntryId(dirData,offset);
+        if (id >= count || idMap[id] == COMPACT_UNMAPPED)
             continue;
-        // Recursively import all elements in linux directory 
-        string dirContentPath = copyString(source);
-        stringAppend(&dirContentPath,"/");
-        stringAppend(&dirContentPath,dirContent->d_name);
-        // Get entry type
-        if (stat(dirContentPath,&entryinfo) != -1) {
-            if (S_ISDIR(entryinfo.st_mode)) {
-                // Directory
-                // Check if corresponding directory exists
-                if (!exists(cfs->fileDesc,dirContent->d_name,nodeid)) {
-                    // Create corresponding directory in cfs
-                    unsigned int dirNodeId;
-                    // Check if there is enough space for the new directory
-                    if ((dirNodeId = CFS_CreateDirectory(cfs,dirContent->d_name,nodeid)) == 0) {
-                        printf("Not enough space to create directory %s\n",dirContent->d_name);
-                    } else {
-                        // Recursively import linux directory's content to cfs directory
-                        CFS_ImportDirectory(cfs,dirContentPath,dirNodeId);
-                    }
-                } else {
-                    printf("File %s already exists\n",dirContent->d_name);
-                }
-            } else if (S_ISREG(entryinfo.st_mode)) {
-                // Regular file
-                CFS_ImportFile(cfs,dirContentPath,nodeid);
+        entries[j].nodeid = idMap[id];
+        entries[j].type = CFS_DirectoryEntryType(dirData,offset);
+        entries[j++].name = CFS_DirectoryEntryName(dirData,offset);
+    }
+    qsort(entries,j,sizeof(sealEntry),CFS_SealEntryCompare);
+    memset(sorted.data.datablocks,0,target->MAX_FILE_SIZE);
+    CFS_DirectoryInit(target,&sorted);
+    for (i = 0; i < j; i++)
+        CFS_DirectoryAddEntry(target,&sorted,entries[i].nodeid,entries[i].type,entries[i].name);
+    if (CFS_DirectoryIndexed(target,&sorted)) {
+        // The offset table replaces the fingerprints
+        char *table = sorted.data.datablocks + target->MAX_FILE_SIZE - 2*CFS_DirectoryEntryCount(&sorted);
+        for (i = 0,offset = CFS_DirectoryFirstEntry(); i < CFS_DirectoryEntryCount(&sorted); i++,offset = CFS_DirectoryNextEntry(&sorted,offset)) {
+            uint16_t entryOffset = offset;
+            memcpy(table + 2*i,&entryOffset,sizeof(uint16_t));
+        }
+    }
+    *dirData = sorted;
+}
+
+// Writes a read-only copy of the working cfs file's live tree that is meant to be read by many processes:
+// nodes in tree order without holes or snapshot copies, page aligned so that readers map the file,
+// and directories sorted with an offset table for binary search lookups
+int CFS_Seal(CFS cfs,string destination) {
+    struct stat current,existing;
+    if (fstat(cfs->fileDesc,&current) == 0 && stat(destination,&existing) == 0 && current.st_dev == existing.st_dev && current.st_ino == existing.st_ino) {
+        printf("%s can not be sealed in place\n",destination);
+        return 0;
+    }
+    nodeid_t count = CFS_NodeCount(cfs),next = 1,i;
+    nodeid_t *idMap = malloc(count*sizeof(nodeid_t));
+    nodeid_t *order = malloc(count*sizeof(nodeid_t));
+    nodeid_t *parents = malloc(count*sizeof(nodeid_t));
+    MDS *data = malloc(sizeof(MDS));
+    if (idMap == NULL || order == NULL || parents == NULL || data == NULL) {
+        printf("Not enough memory.\n");
+        free(idMap);
+        free(order);
+        free(parents);
+        free(data);
+        return 0;
+    }
+    // Number the live tree like cfs_compact does, root keeps id 0
+    for (i = 0; i < count; i++)
+        idMap[i] = COMPACT_UNMAPPED;
+    idMap[0] = order[0] = parents[0] = 0;
+    CFS_CompactNumberDirectory(cfs,0,count,idMap,order,parents,&next);
+    // Same parameters, but page sized blocks and no snapshots
+    superblock sb = cfs->sb;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    sb.BLOCK_SIZE = CFS_ValidBlockSize(pageSize) ? pageSize : MIN_BLOCK_SIZE;
+    sb.NODE_COUNT = sb.RESERVED_NODES = sb.LIVE_NODES = next;
+    sb.DIRECTORY_COUNT = sb.FILE_BYTES = sb.HARD_LINKS = 0;
+    sb.EPOCH = 1;
+    sb.SNAPSHOT_NODES = 0;
+    sb.SNAPSHOT_COUNT = 0;
+    memset(sb.SNAPSHOTS,0,sizeof(sb.SNAPSHOTS));
+    sb.SEALED = 1;
+    sb.WRITE_MODE = WRITE_IN_PLACE;
+    sb.CHANGE_CAPACITY = sb.CHANGE_SEQUENCE = 0;
+    sb.CHANGE_FIRST = 1;
+    // Readers map a single file
+    sb.STRIPES = 1;
+    struct cfs target;
+    memset(&target,0,sizeof(struct cfs));
+    int ok = (target.fileDesc = open(destination,O_RDWR|O_CREAT|O_TRUNC,FILE_PERMISSIONS)) != -1;
+    if (!ok) {
+        perror("Error creating cfs file");
+    } else {
+        ok = CFS_SetGeometry(&target,&sb) && CFS_WriteSuperblock(&target,&sb);
+        for (i = 0; ok && i < next; i++) {
+            ok = CFS_ReadNode(cfs,order[i],data);
+            data->nodeid = i;
+            // Files keep the directories of all their names
+            if (data->type == TYPE_FILE)
+                CFS_RenumberFileNames(data,idMap);
+            else
+                data->parent_nodeid = parents[i];
+            if (data->type == TYPE_DIRECTORY) {
+                CFS_SealDirectory(&target,data,count,idMap);
+                target.sb.DIRECTORY_COUNT++;
             } else {
-                printf("Unknown file type of %s\n",source);
+                target.sb.FILE_BYTES += data->size;
             }
+            target.sb.HARD_LINKS += data->links;
+            ok = ok && CFS_WriteNode(&target,data);
+        }
+        // Nobody writes to a sealed cfs file again
+        ok = ok && CFS_SyncSuperblock(&target) && fsync(target.fileDesc) == 0 && fchmod(target.fileDesc,0444) == 0;
+        CFS_ReleaseGeometry(&target);
+        close(target.fileDesc);
+        if (ok) {
+            printf("Sealed %s to %s with %llu nodes\n",cfs->currentFile,destination,(unsigned long long)next);
         } else {
-            perror("Failed  to get  file  status");
+            printf("Error sealing %s\n",cfs->currentFile);
+            unlink(destination);
         }
-        DestroyString(&dirContentPath);
     }
-    // Close linux directory
-    closedir(dirp);
-    return 1;
+    free(idMap);
+    free(order);
+    free(parents);
+    free(data);
+    return ok;
 }
 
-int CFS_ImportSource(CFS cfs,string source,unsigned int nodeid) {
-    struct stat sourceinfo;
-    // Get source type
-    if (stat(source,&sourceinfo) != -1) {
-        if (S_ISDIR(sourceinfo.st_mode)) {
-            // Directory
-            CFS_ImportDirectory(cfs,source,nodeid);
-        } else if (S_ISREG(sourceinfo.st_mode)) {
-            // Regular file
-            CFS_ImportFile(cfs,source,nodeid);
+// Opens a cfs file for reading alongside the working one (which is returned itself if it is the one named).
+// Returns NULL if it can not be read.
+CFS CFS_OpenImage(CFS cfs,string path) {
+    struct stat working,st;
+    if (cfs->fileDesc != -1 && fstat(cfs->fileDesc,&working) == 0 && stat(path,&st) == 0 && working.st_dev == st.st_dev && working.st_ino == st.st_ino)
+        return cfs;
+    CFS image = malloc(sizeof(struct cfs));
+    string imapFile = malloc(strlen(path) + strlen(".imap") + 1);
+    superblock sb;
+    if (image == NULL || imapFile == NULL) {
+        printf("Not enough memory.\n");
+        free(image);
+        free(imapFile);
+        return NULL;
+    }
+    memset(image,0,sizeof(struct cfs));
+    image->fileDesc = -1;
+    if (strlen(path) >= PATH_MAX) {
+        printf("File %s does not exist\n",path);
+    } else if ((image->fileDesc = open(path,O_RDONLY)) == -1) {
+        printf("File %s does not exist\n",path);
+    } else if (pread(image->fileDesc,&sb,sizeof(superblock),0) != sizeof(superblock) || sb.magic != CFS_MAGIC || sb.version != CFS_VERSION) {
+        printf("%s is not a cfs file of the current format version\n",path);
+    } else if (!CFS_SetGeometry(image,&sb)) {
+        printf("Not enough memory.\n");
+    } else if (CFS_OpenMembers(image,path,O_RDONLY)) {
+        sprintf(imapFile,"%s.imap",path);
+        // Loading the inode map removes it, so a loaded one is saved again when the image is closed.
+        // One that is missing may belong to a cfs file open elsewhere and is left to that process.
+        if (sb.WRITE_MODE == WRITE_LOG && access(imapFile,F_OK) == 0)
+            strcpy(image->currentFile,path);
+        if (sb.WRITE_MODE == WRITE_LOG && !CFS_OpenLog(image)) {
+            printf("Error reading the log of %s\n",path);
         } else {
-            printf("Unknown file type of %s\n",source);
-            return 0;
+            if (sb.SEALED && fstat(image->fileDesc,&st) == 0 && (image->map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,image->fileDesc,0)) != MAP_FAILED)
+                image->mapLength = st.st_size;
+            else
+                image->map = NULL;
+            free(imapFile);
+            return image;
         }
-    } else {
-        perror("Failed  to get  file  status");
-        return 0;
     }
-    return 1;
+    CFS_ReleaseGeometry(image);
+    if (image->fileDesc != -1)
+        close(image->fileDesc);
+    free(image);
+    free(imapFile);
+    return NULL;
 }
 
-int CFS_ExportFile(CFS cfs,unsigned int nodeid,string directory,string filename) {
-    // Get file data
-    MDS data;
-    lseek(cfs->fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    read(cfs->fileDesc,&data,sizeof(MDS));
-    // Determine export path
-    string path = copyString(directory);
-    stringAppend(&path,"/");
-    stringAppend(&path,filename);
-    // Create file in linux and check if creation was ok
-    int fd;
-    if ((fd = open(path,O_CREAT|O_WRONLY|O_TRUNC,FILE_PERMISSIONS)) != -1) {
-        // Successful creation so write data
-        write(fd,data.data.datablocks,data.size);
-        // Close the file
-        close(fd);
-        DestroyString(&path);
+// Closes a cfs file opened by CFS_OpenImage
+void CFS_CloseImage(CFS cfs,CFS image) {
+    if (image == NULL || image == cfs)
+        return;
+    CFS_ReleaseGeometry(image);
+    close(image->fileDesc);
+    free(image);
+}
+
+// Differences found by cfs_diff, one "A", "D" or "M" line per added, removed or modified path
+typedef struct {
+    char *output;
+    size_t length;
+    size_t capacity;
+    uint64_t added;
+    uint64_t removed;
+    uint64_t modified;
+} diffReport;
+
+void CFS_DiffOutput(diffReport *report,char kind,string path,unsigned int type) {
+    size_t needed = report->length + strlen(path) + 5;
+    if (needed > report->capacity) {
+        size_t capacity = report->capacity > 0 ? 2*report->capacity : 4096;
+        while (capacity < needed)
+            capacity *= 2;
+        char *output = realloc(report->output,capacity);
+        if (output == NULL) {
+            printf("Not enough memory.\n");
+            return;
+        }
+        report->output = output;
+        report->capacity = capacity;
+    }
+    report->length += sprintf(report->output + report->length,"%c %s%s\n",kind,path,type == TYPE_DIRECTORY ? "/" : "");
+    if (kind == 'A')
+        report->added++;
+    else if (kind == 'D')
+        report->removed++;
+    else
+        report->modified++;
+}
+
+// Prints the part of a report's output from start to end (output is NULL if nothing was added to the report)
+void CFS_DiffPrint(diffReport *report,size_t start,size_t end) {
+    if (end > start)
+        fwrite(report->output + start,1,end - start,stdout);
+}
+
+// Entries of a directory (without . and ..) sorted by name, pointing into the directory's datablocks
+sealEntry *CFS_DiffEntries(MDS *dirData,unsigned int *count) {
+    unsigned int i,offset,entryCount = CFS_DirectoryEntryCount(dirData);
+    sealEntry *entries = malloc((entryCount + 1)*sizeof(sealEntry));
+    *count = 0;
+    if (entries == NULL)
+        return NULL;
+    // Skip . and .. shortcuts
+    for (i = 2,offset = CFS_DirectoryEntryOffset(dirData,2); i < entryCount; i++,offset = CFS_DirectoryNextEntry(dirData,offset)) {
+        entries[*count].nodeid = CFS_DirectoryEntryId(dirData,offset);
+        entries[*count].type = CFS_DirectoryEntryType(dirData,offset);
+        entries[(*count)++].name = CFS_DirectoryEntryName(dirData,offset);
+    }
+    qsort(entries,*count,sizeof(sealEntry),CFS_SealEntryCompare);
+    return entries;
+}
+
+// 1 if two files differ. Their metadata are compared first and their contents only if the sizes match but the
+// modification times do not, or always if content is set.
+int CFS_DiffFiles(CFS a,nodeid_t ida,CFS b,nodeid_t idb,int content) {
+    MDS dataA,dataB;
+    if (!CFS_ReadNodeMetadata(a,ida,&dataA) || !CFS_ReadNodeMetadata(b,idb,&dataB))
+        return 1;
+    if (dataA.size != dataB.size)
+        return 1;
+    if (dataA.modificationTime == dataB.modificationTime && !content)
+        return 0;
+    if (!CFS_ReadNode(a,ida,&dataA) || !CFS_ReadNode(b,idb,&dataB))
         return 1;
+    return memcmp(dataA.data.datablocks,dataB.data.datablocks,dataA.size) != 0;
+}
+
+// Directory present in both cfs files, compared by one of the worker threads
+typedef struct {
+    nodeid_t ida;
+    nodeid_t idb;
+    string path;
+    size_t position; // Length of the parent's output when the task was made, where the task's output goes
+    diffReport report;
+} diffTask;
+
+typedef struct {
+    CFS a;
+    CFS b;
+    int content;
+    diffTask *tasks;
+    unsigned int taskCount;
+    unsigned int next; // Next task to be taken
+} diffWork;
+
+// Compares two directories walking their entries sorted by name. Sub-directories present in both are compared
+// recursively, or made tasks of work if it is not NULL.
+void CFS_DiffDirectory(CFS a,nodeid_t ida,CFS b,nodeid_t idb,string path,int content,diffReport *report,diffWork *work) {
+    MDS dirA,dirB;
+    unsigned int countA,countB,i = 0,j = 0;
+    CFS_ReadNode(a,ida,&dirA);
+    CFS_ReadNode(b,idb,&dirB);
+    sealEntry *entriesA = CFS_DiffEntries(&dirA,&countA),*entriesB = CFS_DiffEntries(&dirB,&countB);
+    if (entriesA == NULL || entriesB == NULL) {
+        printf("Not enough memory.\n");
+        countA = countB = 0;
+    }
+    while (i < countA || j < countB) {
+        int order = i == countA ? 1 : (j == countB ? -1 : strcmp(entriesA[i].name,entriesB[j].name));
+        string subPath = copyString(path);
+        if (strcmp(path,"/"))
+            stringAppend(&subPath,"/");
+        stringAppend(&subPath,order > 0 ? entriesB[j].name : entriesA[i].name);
+        if (order < 0) {
+            CFS_DiffOutput(report,'D',subPath,entriesA[i].type);
+        } else if (order > 0) {
+            CFS_DiffOutput(report,'A',subPath,entriesB[j].type);
+        } else if (entriesA[i].type != entriesB[j].type) {
+            CFS_DiffOutput(report,'M',subPath,entriesB[j].type);
+        } else if (entriesA[i].type == TYPE_DIRECTORY && work != NULL) {
+            diffTask *task = &work->tasks[work->taskCount++];
+            memset(task,0,sizeof(diffTask));
+            task->ida = entriesA[i].nodeid;
+            task->idb = entriesB[j].nodeid;
+            task->path = subPath;
+            task->position = report->length;
+            subPath = NULL;
+        } else if (entriesA[i].type == TYPE_DIRECTORY) {
+            CFS_DiffDirectory(a,entriesA[i].nodeid,b,entriesB[j].nodeid,subPath,content,report,NULL);
+        } else if (CFS_DiffFiles(a,entriesA[i].nodeid,b,entriesB[j].nodeid,content)) {
+            CFS_DiffOutput(report,'M',subPath,TYPE_FILE);
+        }
+        if (subPath != NULL)
+            DestroyString(&subPath);
+        if (order <= 0)
+            i++;
+        if (order >= 0)
+            j++;
+    }
+    free(entriesA);
+    free(entriesB);
+}
+
+void *CFS_DiffWorker(void *arg) {
+    diffWork *work = arg;
+    unsigned int t;
+    while ((t = __sync_fetch_and_add(&work->next,1)) < work->taskCount)
+        CFS_DiffDirectory(work->a,work->tasks[t].ida,work->b,work->tasks[t].idb,work->tasks[t].path,work->content,&work->tasks[t].report,NULL);
+    return NULL;
+}
+
+// Reports the paths below a directory that were added, removed or modified from one cfs file to another,
+// comparing the sub-directories of the directory in parallel
+int CFS_Diff(CFS cfs,string fileA,string fileB,string path,int content) {
+    CFS a = CFS_OpenImage(cfs,fileA);
+    CFS b = a == NULL ? NULL : CFS_OpenImage(cfs,fileB);
+    if (b == NULL) {
+        CFS_CloseImage(cfs,a);
+        return 0;
+    }
+    string pathA = copyString(path),pathB = copyString(path);
+    location locA = getPathLocation(a,pathA,0,0),locB = getPathLocation(b,pathB,0,0);
+    DestroyString(&pathA);
+    DestroyString(&pathB);
+    int ok = 0;
+    if (!locA.valid || locA.type != TYPE_DIRECTORY) {
+        printf("No such directory %s in %s\n",path,fileA);
+    } else if (!locB.valid || locB.type != TYPE_DIRECTORY) {
+        printf("No such directory %s in %s\n",path,fileB);
     } else {
-        DestroyString(&path);
-        perror("File creation error");
+        MDS dirData;
+        CFS_ReadNode(a,locA.nodeid,&dirData);
+        diffReport report;
+        memset(&report,0,sizeof(diffReport));
+        diffWork work = {a,b,content,malloc((CFS_DirectoryEntryCount(&dirData) + 1)*sizeof(diffTask)),0,0};
+        ok = work.tasks != NULL;
+        if (!ok) {
+            printf("Not enough memory.\n");
+        } else {
+            string root = copyString(path[0] == '/' ? path : "/");
+            if (path[0] != '/')
+                stringAppend(&root,path);
+            // Trailing slashes are dropped so that the paths below are joined with a single one
+            size_t length = strlen(root);
+            while (length > 1 && root[length - 1] == '/')
+                root[--length] = '\0';
+            CFS_DiffDirectory(a,locA.nodeid,b,locB.nodeid,root,content,&report,&work);
+            DestroyString(&root);
+            unsigned int i;
+            CFS_RunWorkers(CFS_DiffWorker,&work,work.taskCount);
+            // Every task's output goes where it's directory is in the sorted output of the directory compared
+            size_t position = 0;
+            for (i = 0; i < work.taskCount; i++) {
+                CFS_DiffPrint(&report,position,work.tasks[i].position);
+                position = work.tasks[i].position;
+                CFS_DiffPrint(&work.tasks[i].report,0,work.tasks[i].report.length);
+                report.added += work.tasks[i].report.added;
+                report.removed += work.tasks[i].report.removed;
+                report.modified += work.tasks[i].report.modified;
+                free(work.tasks[i].report.output);
+                DestroyString(&work.tasks[i].path);
+            }
+            CFS_DiffPrint(&report,position,report.length);
+            printf("%llu added, %llu removed, %llu modified\n",(unsigned long long)report.added,(unsigned long long)report.removed,(unsigned long long)report.modified);
+            free(report.output);
+            free(work.tasks);
+        }
+    }
+    CFS_CloseImage(cfs,a);
+    CFS_CloseImage(cfs,b);
+    return ok;
+}
+
+// Index of the snapshot with that name or -1 if there is none
+int CFS_FindSnapshot(CFS cfs,string name) {
+    unsigned int i;
+    for (i = 0; i < cfs->sb.SNAPSHOT_COUNT; i++)
+        if (!strcmp(cfs->sb.SNAPSHOTS[i].name,name))
+            return i;
+    return -1;
+}
+
+// Number of snapshots that see a copy preserved for the epochs first to last, that is the copy's reference count
+unsigned int CFS_SnapshotReferences(CFS cfs,uint64_t first,uint64_t last) {
+    unsigned int i,references = 0;
+    for (i = 0; i < cfs->sb.SNAPSHOT_COUNT; i++)
+        if (cfs->sb.SNAPSHOTS[i].epoch >= first && cfs->sb.SNAPSHOTS[i].epoch <= last)
+            references++;
+    return references;
+}
+
+// Id of the 1st copy preserved for snapshots from nodeid on (count if there is none)
+nodeid_t CFS_NextSnapshotCopy(CFS cfs,nodeid_t nodeid,nodeid_t count) {
+    if (cfs->meta != NULL && MetaTable_Count(cfs->meta) >= count) {
+        nodeid = MetaTable_FindState(cfs->meta,METATABLE_SNAPSHOT,nodeid);
+        return nodeid < count ? nodeid : count;
+    }
+    MDS data;
+    for (; nodeid < count; nodeid++) {
+        CFS_ReadNodeMetadata(cfs,nodeid,&data);
+        if (!data.deleted && data.snapshot)
+            return nodeid;
+    }
+    return count;
+}
+
+// Takes a snapshot of the working cfs file. Only the superblock is written: the live tree moves to a new
+// epoch and nodes are copied for the snapshot when they are overwritten
+int CFS_SnapshotCreate(CFS cfs,string name) {
+    if (strlen(name) >= MAX_FILENAME_SIZE) {
+        printf("Snapshot name is too long.\n");
+        return 0;
+    }
+    if (CFS_FindSnapshot(cfs,name) != -1) {
+        printf("Snapshot %s already exists.\n",name);
+        return 0;
+    }
+    if (cfs->sb.SNAPSHOT_COUNT == MAX_SNAPSHOTS) {
+        printf("A cfs file can not keep more than %d snapshots.\n",MAX_SNAPSHOTS);
         return 0;
     }
+    snapshot *snap = &cfs->sb.SNAPSHOTS[cfs->sb.SNAPSHOT_COUNT++];
+    memset(snap,0,sizeof(snapshot));
+    snap->epoch = cfs->sb.EPOCH++;
+    snap->creation_time = time(NULL);
+    strcpy(snap->name,name);
+    return CFS_SyncSuperblock(cfs);
 }
 
-int CFS_ExportDirectory(CFS cfs,unsigned int nodeid,string directory) {
-    // Get directory data
+// Lists the snapshots with the number of copies they see and how many of those only they see (released on delete)
+int CFS_SnapshotList(CFS cfs) {
+    nodeid_t count = CFS_NodeCount(cfs),copy;
+    uint64_t held[MAX_SNAPSHOTS] = {0},only[MAX_SNAPSHOTS] = {0};
+    unsigned int i,last = 0;
     MDS data;
-    lseek(cfs->fileDesc,sizeof(superblock) + nodeid * sizeof(MDS),SEEK_SET);
-    read(cfs->fileDesc,&data,sizeof(MDS));
-    // Loop through all the entities
-    unsigned int i,curId;
-    MDS tmpData;
-    string path;
-    for (i = 0; i < data.size/(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)); i++) {
-        // Get id of the current entity
-        curId = *(unsigned int*)(data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)));
-        // Get name of the current entity
-        string filename = data.data.datablocks + i*(sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char)) + sizeof(unsigned int);
-        // Ignore . and .. shortcuts to avoid infinite loop
-        if (!strcmp(".",filename) || !strcmp("..",filename))
+    for (copy = CFS_NextSnapshotCopy(cfs,0,count); copy < count; copy = CFS_NextSnapshotCopy(cfs,copy + 1,count)) {
+        CFS_ReadNodeMetadata(cfs,copy,&data);
+        for (i = 0; i < cfs->sb.SNAPSHOT_COUNT; i++) {
+            if (cfs->sb.SNAPSHOTS[i].epoch >= data.epoch && cfs->sb.SNAPSHOTS[i].epoch <= data.epoch_end) {
+                held[i]++;
+                last = i;
+            }
+        }
+        if (CFS_SnapshotReferences(cfs,data.epoch,data.epoch_end) == 1)
+            only[last]++;
+    }
+    char creationTime[70];
+    for (i = 0; i < cfs->sb.SNAPSHOT_COUNT; i++) {
+        strftime(creationTime,sizeof(creationTime),"%c",localtime(&cfs->sb.SNAPSHOTS[i].creation_time));
+        printf("%s\t%s\t%llu preserved nodes, %llu only for it\n",cfs->sb.SNAPSHOTS[i].name,creationTime,(unsigned long long)held[i],(unsigned long long)only[i]);
+    }
+    return 1;
+}
+
+// Marks nodes without a copy for the snapshot being rolled back to
+#define SNAPSHOT_NO_COPY ((nodeid_t)-1)
+
+// Brings the live tree back to a snapshot. Restoring goes through the usual node writes, so the
+// versions that later snapshots still see are preserved for them first
+int CFS_SnapshotRollback(CFS cfs,string name) {
+    int s = CFS_FindSnapshot(cfs,name);
+    if (s == -1) {
+        printf("No such snapshot.\n");
+        return 0;
+    }
+    uint64_t epoch = cfs->sb.SNAPSHOTS[s].epoch;
+    nodeid_t count = CFS_NodeCount(cfs),nodeid,copy,restored = 0,removed = 0;
+    nodeid_t *copies = malloc(count*sizeof(nodeid_t));
+    if (copies == NULL) {
+        printf("Not enough memory.\n");
+        return 0;
+    }
+    MDS data;
+    for (nodeid = 0; nodeid < count; nodeid++)
+        copies[nodeid] = SNAPSHOT_NO_COPY;
+    for (copy = CFS_NextSnapshotCopy(cfs,0,count); copy < count; copy = CFS_NextSnapshotCopy(cfs,copy + 1,count)) {
+        CFS_ReadNodeMetadata(cfs,copy,&data);
+        if (data.epoch <= epoch && data.epoch_end >= epoch && data.origin < count)
+            copies[data.origin] = copy;
+    }
+    // Nodes written at or before the snapshot's epoch are still as the snapshot sees them
+    for (nodeid = 0; nodeid < count; nodeid++) {
+        if (copies[nodeid] != SNAPSHOT_NO_COPY) {
+            CFS_ReadNode(cfs,copies[nodeid],&data);
+            data.nodeid = nodeid;
+            data.snapshot = 0;
+            data.origin = data.epoch_end = 0;
+            CFS_WriteNode(cfs,&data);
+            restored++;
+        } else {
+            CFS_ReadNodeMetadata(cfs,nodeid,&data);
+            // Created after the snapshot
+            if (!data.deleted && !data.snapshot && data.epoch > epoch) {
+                data.deleted = 1;
+                CFS_WriteNodeMetadata(cfs,&data);
+                CFS_PunchNode(cfs,nodeid);
+                removed++;
+            }
+        }
+    }
+    free(copies);
+    // Recount the counters of the restored tree
+    cfs->sb.LIVE_NODES = cfs->sb.DIRECTORY_COUNT = cfs->sb.FILE_BYTES = cfs->sb.HARD_LINKS = cfs->sb.SNAPSHOT_NODES = 0;
+    for (nodeid = 0; nodeid < CFS_NodeCount(cfs); nodeid++) {
+        CFS_ReadNodeMetadata(cfs,nodeid,&data);
+        if (data.deleted)
+            continue;
+        if (data.snapshot) {
+            cfs->sb.SNAPSHOT_NODES++;
             continue;
-        // Seek to the current entity metadata
-        lseek(cfs->fileDesc,sizeof(superblock) + curId * sizeof(MDS),SEEK_SET);
-        // Get it's metadata
-        read(cfs->fileDesc,&tmpData,sizeof(MDS));
-        // Check it's type
-        if (tmpData.type == TYPE_DIRECTORY) {
-            // Directory
-            // Create the corresponding directory in linux
-            path = copyString(directory);
-            stringAppend(&path,"/");
-            stringAppend(&path,tmpData.filename);
-            mkdir(path,FILE_PERMISSIONS);
-            // Recursively export content of the current directory
-            CFS_ExportDirectory(cfs,tmpData.nodeid,path);
-            DestroyString(&path);
-        } else if (tmpData.type == TYPE_FILE) {
-            // Regular file
-            CFS_ExportFile(cfs,tmpData.nodeid,directory,filename);
         }
+        cfs->sb.LIVE_NODES++;
+        if (data.type == TYPE_DIRECTORY)
+            cfs->sb.DIRECTORY_COUNT++;
+        else
+            cfs->sb.FILE_BYTES += data.size;
+        cfs->sb.HARD_LINKS += data.links;
     }
+    CFS_SyncSuperblock(cfs);
+    CFS_RecordChange(cfs,CHANGE_RESET,0,0,"/");
+    cfs->currentDirectoryId = 0;
+    printf("Rolled %s back to snapshot %s: %llu nodes restored, %llu removed\n",cfs->currentFile,name,(unsigned long long)restored,(unsigned long long)removed);
     return 1;
 }
 
-int CFS_ExportSource(CFS cfs,string source,string directory) {
-    // Get source location
-    string sourceBackup = copyString(source);
-    location loc = getPathLocation(cfs->fileDesc,sourceBackup,cfs->currentDirectoryId,0);
-    // Check if it exists
-    if (loc.valid) {
-        // Check source type (shortcuts are not exported)
-        if (loc.type == TYPE_DIRECTORY) {
-            // Directory
-            CFS_ExportDirectory(cfs,loc.nodeid,directory);
-        } else if (loc.type == TYPE_FILE) {
-            // Regular file
-            CFS_ExportFile(cfs,loc.nodeid,directory,loc.filenanme);
+// Deletes a snapshot and releases the copies that no other snapshot sees
+int CFS_SnapshotDelete(CFS cfs,string name) {
+    int s = CFS_FindSnapshot(cfs,name);
+    if (s == -1) {
+        printf("No such snapshot.\n");
+        return 0;
+    }
+    memmove(&cfs->sb.SNAPSHOTS[s],&cfs->sb.SNAPSHOTS[s + 1],(cfs->sb.SNAPSHOT_COUNT - s - 1)*sizeof(snapshot));
+    cfs->sb.SNAPSHOT_COUNT--;
+    CFS_SyncSuperblock(cfs);
+    nodeid_t count = CFS_NodeCount(cfs),copy,released = 0;
+    MDS data;
+    for (copy = CFS_NextSnapshotCopy(cfs,0,count); copy < count; copy = CFS_NextSnapshotCopy(cfs,copy + 1,count)) {
+        CFS_ReadNodeMetadata(cfs,copy,&data);
+        if (CFS_SnapshotReferences(cfs,data.epoch,data.epoch_end) == 0) {
+            data.deleted = 1;
+            data.snapshot = 0;
+            CFS_WriteNodeMetadata(cfs,&data);
+            CFS_PunchNode(cfs,copy);
+            cfs->sb.SNAPSHOT_NODES--;
+            released++;
         }
-    } else {
-        printf("%s not found.\n",source);
     }
-    DestroyString(&sourceBackup);
+    CFS_SyncSuperblock(cfs);
+    printf("Deleted snapshot %s, released %llu nodes\n",name,(unsigned long long)released);
     return 1;
 }
 
+// Commands that change the working cfs file
+int CFS_CommandMutates(string command) {
+    static const char *commands[] = {"cfs_mkdir","cfs_touch","cfs_cp","cfs_cat","cfs_ln","cfs_mv","cfs_rm","cfs_import","cfs_unpack","cfs_trim","cfs_compact","cfs_snapshot"};
+    unsigned int i;
+    for (i = 0; i < sizeof(commands)/sizeof(commands[0]); i++)
+        if (!strcmp(commands[i],command))
+            return 1;
+    return 0;
+}
+
+// Skips the rest of a command's line and returns 1 if it named the standard input as an archive
+// (cfs_unpack - or cfs_import -tar -), whose blocks then follow the line and must be skipped too.
+int CFS_IgnoreArguments(string command,int lastword) {
+    int archive = 0,first = 1,afterTar = 0;
+    while (!lastword) {
+        string word = readNextWord(&lastword);
+        if (!strcmp("-",word) && ((first && !strcmp("cfs_unpack",command)) || (afterTar && !strcmp("cfs_import",command))))
+            archive = 1;
+        afterTar = !strcmp("-tar",word);
+        first = 0;
+        DestroyString(&word);
+    }
+    return archive;
+}
+
 int CFS_Run(CFS cfs) {
     int running = 1;
     char *commandLabel;
@@ -994,39 +4390,114 @@ int CFS_Run(CFS cfs) {
         // Read command label
         int lastword;
         commandLabel = readNextWord(&lastword);
+        // Sealed cfs files are read-only
+        if (cfs->fileDesc != -1 && cfs->sb.SEALED && CFS_CommandMutates(commandLabel)) {
+            printf("%s is sealed (read-only)\n",cfs->currentFile);
+            if (CFS_IgnoreArguments(commandLabel,lastword))
+                Tar_SkipArchive(stdin);
+        }
         // Work with specific file
-        if (!strcmp("cfs_workwith",commandLabel)) {
+        else if (!strcmp("cfs_workwith",commandLabel)) {
             // Check if it was specified
             if (!lastword) {
                 // Keep previous file descriptor
                 int prevDesc = cfs->fileDesc;
-                // Read filename
+                // Read filename (optionally preceded by -direct)
                 string file = readNextWord(&lastword);
-                // Check if file exists
-                if ((cfs->fileDesc = open(file,O_RDWR,FILE_PERMISSIONS)) < 0) {
+                int direct = 0;
+                if (!strcmp("-direct",file) && !lastword) {
+                    direct = 1;
+                    DestroyString(&file);
+                    file = readNextWord(&lastword);
+                }
+                superblock sb;
+                // Check if file exists (sealed cfs files are read-only)
+                int readOnly = 0;
+                if ((cfs->fileDesc = open(file,O_RDWR,FILE_PERMISSIONS)) < 0 && (errno == EACCES || errno == EROFS)) {
+                    cfs->fileDesc = open(file,O_RDONLY);
+                    readOnly = 1;
+                }
+                if (cfs->fileDesc < 0) {
                     printf("File %s does not exist\n",file);
                     cfs->fileDesc = prevDesc;
+                } else if (pread(cfs->fileDesc,&sb,sizeof(superblock),0) != sizeof(superblock) || sb.magic != CFS_MAGIC) {
+                    // Files created before the format was versioned do not start with the magic number
+                    printf("%s is not a cfs file or was created by an older cfs version (see cfs_convert)\n",file);
+                    close(cfs->fileDesc);
+                    cfs->fileDesc = prevDesc;
+                } else if (sb.version != CFS_VERSION) {
+                    printf("%s uses unsupported cfs format version %u\n",file,sb.version);
+                    close(cfs->fileDesc);
+                    cfs->fileDesc = prevDesc;
+                } else if (readOnly && !sb.SEALED) {
+                    printf("%s can not be opened for writing\n",file);
+                    close(cfs->fileDesc);
+                    cfs->fileDesc = prevDesc;
+                } else if (direct && sb.SEALED) {
+                    printf("%s is sealed and read through a mapping so it can not be opened with -direct\n",file);
+                    close(cfs->fileDesc);
+                    cfs->fileDesc = prevDesc;
+                } else if (direct && sb.BLOCK_SIZE == 1) {
+                    // O_DIRECT needs block aligned offsets and lengths
+                    printf("%s has no block size so it can not be opened with -direct (see cfs_create -bs)\n",file);
+                    close(cfs->fileDesc);
+                    cfs->fileDesc = prevDesc;
                 } else {
                     // Close previous file descriptor if there is one
-                    if (prevDesc != -1)
+                    if (prevDesc != -1) {
                         close(prevDesc);
+                        CFS_ReleaseGeometry(cfs);
+                    }
+                    cfs->direct = 0;
+                    if (direct) {
+                        // Bypass the host's page cache, unless the host filesystem does not support it
+                        int directDesc = open(file,O_RDWR|O_DIRECT,FILE_PERMISSIONS);
+                        if (directDesc < 0) {
+                            printf("%s can not be opened with O_DIRECT, using buffered I/O\n",file);
+                        } else {
+                            close(cfs->fileDesc);
+                            cfs->fileDesc = directDesc;
+                            cfs->direct = 1;
+                        }
+                    }
                     // File exists so open it
                     strcpy(cfs->currentFile,file);
                     // Set current directory to root (/)
                     cfs->currentDirectoryId = 0;
                     // Read file's parameters from superblock
-                    lseek(cfs->fileDesc,0L,SEEK_SET);
-                    superblock sb;
-                    read(cfs->fileDesc,&sb,sizeof(superblock));
-                    cfs->BLOCK_SIZE = sb.BLOCK_SIZE;
-                    cfs->FILENAME_SIZE = sb.FILENAME_SIZE;
-                    cfs->MAX_DIRECTORY_FILE_NUMBER = sb.MAX_DIRECTORY_FILE_NUMBER;
-                    cfs->MAX_FILE_SIZE = sb.MAX_FILE_SIZE;
+                    struct stat st;
+                    if (!CFS_SetGeometry(cfs,&sb)) {
+                        printf("Not enough memory.\n");
+                        close(cfs->fileDesc);
+                        cfs->fileDesc = -1;
+                        cfs->currentFile[0] = '\0';
+                    } else if (!CFS_OpenMembers(cfs,file,cfs->direct ? O_RDWR|O_DIRECT : O_RDWR)) {
+                        // Every member of a striped cfs file is needed for it's namespace
+                        CFS_ReleaseGeometry(cfs);
+                        close(cfs->fileDesc);
+                        cfs->fileDesc = -1;
+                        cfs->currentFile[0] = '\0';
+                    } else if (sb.WRITE_MODE == WRITE_LOG && !CFS_OpenLog(cfs)) {
+                        printf("Error reading the log of %s\n",file);
+                        CFS_ReleaseGeometry(cfs);
+                        close(cfs->fileDesc);
+                        cfs->fileDesc = -1;
+                        cfs->currentFile[0] = '\0';
+                    } else if (!sb.SEALED) {
+                        // The metadata table is rebuilt through the inode map of log-structured cfs files
+                        CFS_OpenMetaTable(cfs,0);
+                    } else if (fstat(cfs->fileDesc,&st) == 0 && (cfs->map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,cfs->fileDesc,0)) != MAP_FAILED) {
+                        // Sealed cfs files are read straight from the page cache, shared by every process that reads them
+                        cfs->mapLength = st.st_size;
+                    } else {
+                        // Fall back to reading the nodes
+                        cfs->map = NULL;
+                    }
                 }
                 DestroyString(&file);
             } else {
                 // File not specified
-                printf("Usage:cfs_workwith <FILE>\n");
+                printf("Usage:cfs_workwith [-direct] <FILE>\n");
             }
         }
         // Create directory (or directories)
@@ -1042,10 +4513,10 @@ int CFS_Run(CFS cfs) {
                         dir = readNextWord(&lastword);
                         // Check if directory exists
                         string dirCopy = copyString(dir);
-                        loc = getPathLocation(cfs->fileDesc,dirCopy,cfs->currentDirectoryId,0);
+                        loc = getPathLocation(cfs,dirCopy,cfs->currentDirectoryId,0);
                         if (!loc.valid) {
                             // Get location for the new directory
-                            loc = getPathLocation(cfs->fileDesc,dir,cfs->currentDirectoryId,1);
+                            loc = getPathLocation(cfs,dir,cfs->currentDirectoryId,1);
                             // Check if path exists
                             if (loc.valid) {
                                 // Path exists so create the new directory there
@@ -1111,18 +4582,18 @@ int CFS_Run(CFS cfs) {
                         while (1) {
                             filecopy = copyString(file);
                             // Check if file exists
-                            loc = getPathLocation(cfs->fileDesc,file,cfs->currentDirectoryId,0);
+                            loc = getPathLocation(cfs,file,cfs->currentDirectoryId,0);
                             if (loc.valid) {
                                 // File exists so just modify it's timestamps
-                                CFS_ModifyFileTimestamps(cfs->fileDesc,loc.nodeid,options[TOUCH_ACCESS],options[TOUCH_MODIFICATION]);
+                                CFS_ModifyFileTimestamps(cfs,loc.nodeid,options[TOUCH_ACCESS],options[TOUCH_MODIFICATION]);
                             } else {
                                 // File does not exist so create it
                                 // Get location for the new file
-                                loc = getPathLocation(cfs->fileDesc,filecopy,cfs->currentDirectoryId,1);
+                                loc = getPathLocation(cfs,filecopy,cfs->currentDirectoryId,1);
                                 // Check if path exists
                                 if (loc.valid) {
                                     // Path exists so create the new file there
-                                    if (!CFS_CreateFile(cfs,loc.filenanme,loc.nodeid,"",0)) {
+                                    if (!CFS_CreateFile(cfs,loc.filenanme,loc.nodeid,"",0,time(NULL))) {
                                         printf("Not enough space to create file %s\n",loc.filenanme);
                                     }
                                 } else {
@@ -1154,7 +4625,7 @@ int CFS_Run(CFS cfs) {
             // Check if we have an open file to work on
             if (lastword) {
                 if (cfs->fileDesc != -1) {
-                    CFS_pwd(cfs->fileDesc,cfs->currentDirectoryId,1);
+                    CFS_pwd(cfs,cfs->currentDirectoryId,1);
                 } else {
                     printf("Not currently working with a cfs file.\n");
                 }
@@ -1173,7 +4644,7 @@ int CFS_Run(CFS cfs) {
                     // Check for correct usage (no other parameters)
                     if (lastword) {
                         // Correect usage so change working directory
-                        location newdir = getPathLocation(cfs->fileDesc,path,cfs->currentDirectoryId,0);
+                        location newdir = getPathLocation(cfs,path,cfs->currentDirectoryId,0);
                         if (newdir.valid) {
                             if (newdir.type == TYPE_DIRECTORY) {
                                 cfs->currentDirectoryId = newdir.nodeid;
@@ -1258,12 +4729,12 @@ int CFS_Run(CFS cfs) {
                                 location loc;
                                 while (1) {
                                     pathCopy = copyString(path);
-                                    loc = getPathLocation(cfs->fileDesc,path,cfs->currentDirectoryId,0);
+                                    loc = getPathLocation(cfs,path,cfs->currentDirectoryId,0);
                                     if (loc.valid) {
                                         if (loc.type == TYPE_DIRECTORY)
-                                            CFS_ls(cfs->fileDesc,loc.nodeid,options,pathCopy);
+                                            CFS_ls(cfs,loc.nodeid,options,pathCopy);
                                         else
-                                            CFS_PrintFileInfo(cfs->fileDesc,getMetadataFromNodeId(cfs->fileDesc,loc.nodeid),loc.filenanme,options);
+                                            CFS_PrintFileInfo(cfs,getMetadataFromNodeId(cfs,loc.nodeid),loc.filenanme,options);
                                     } else {
                                         printf("No such file or directory %s\n",path);
                                     }
@@ -1277,7 +4748,7 @@ int CFS_Run(CFS cfs) {
                                 }
                             } else {
                                 // Only options were specified so list the current directory
-                                CFS_ls(cfs->fileDesc,cfs->currentDirectoryId,options,".");
+                                CFS_ls(cfs,cfs->currentDirectoryId,options,".");
                                 DestroyString(&option);
                             }
                         } else {
@@ -1286,12 +4757,12 @@ int CFS_Run(CFS cfs) {
                             location loc;
                             while (1){
                                 pathCopy = copyString(path);
-                                loc = getPathLocation(cfs->fileDesc,option,cfs->currentDirectoryId,0);
+                                loc = getPathLocation(cfs,option,cfs->currentDirectoryId,0);
                                 if (loc.valid) {
                                     if (loc.type == TYPE_DIRECTORY)
-                                        CFS_ls(cfs->fileDesc,loc.nodeid,options,pathCopy);
+                                        CFS_ls(cfs,loc.nodeid,options,pathCopy);
                                     else
-                                        CFS_PrintFileInfo(cfs->fileDesc,getMetadataFromNodeId(cfs->fileDesc,loc.nodeid),loc.filenanme,options);
+                                        CFS_PrintFileInfo(cfs,getMetadataFromNodeId(cfs,loc.nodeid),loc.filenanme,options);
                                 } else {
                                     printf("No such file or directory %s\n",path);
                                 }
@@ -1308,7 +4779,7 @@ int CFS_Run(CFS cfs) {
                 } else {
                     // No parameters specified so list the current directory
                     int options[6] = {0,0,0,0,0,0}; // Default options
-                    CFS_ls(cfs->fileDesc,cfs->currentDirectoryId,options,".");
+                    CFS_ls(cfs,cfs->currentDirectoryId,options,".");
                 }
             } else {
                 printf("Not currently working with a cfs file.\n");
@@ -1386,7 +4857,7 @@ int CFS_Run(CFS cfs) {
                                     // More than 2 arguments so destination must always be a directory (2nd usage)
                                     // Get destination location
                                     destinationCopy = copyString(destination);
-                                    destinationLocation = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,0);
+                                    destinationLocation = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,0);
                                     DestroyString(&destinationCopy);
                                     // Check if destination exists
                                     if (destinationLocation.valid) {
@@ -1399,7 +4870,7 @@ int CFS_Run(CFS cfs) {
                                                 // Extract source from queue
                                                 path = Queue_Pop(sourcesQueue);
                                                 pathCopy = copyString(path);
-                                                loc = getPathLocation(cfs->fileDesc,pathCopy,cfs->currentDirectoryId,0);
+                                                loc = getPathLocation(cfs,pathCopy,cfs->currentDirectoryId,0);
                                                 // Check if source exists
                                                 if (loc.valid) {
                                                     // Determine source queue and act appropriately
@@ -1431,11 +4902,11 @@ int CFS_Run(CFS cfs) {
                                     // Get source location
                                     string source = Queue_Pop(sourcesQueue);
                                     string sourceBackup = copyString(source);
-                                    location sourceLocation = getPathLocation(cfs->fileDesc,sourceBackup,cfs->currentDirectoryId,0);
+                                    location sourceLocation = getPathLocation(cfs,sourceBackup,cfs->currentDirectoryId,0);
                                     // Check if source exists
                                     if (sourceLocation.valid) {
                                         destinationCopy = copyString(destination);
-                                        destinationLocation = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,0);
+                                        destinationLocation = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,0);
                                         DestroyString(&destinationCopy);
                                         // Check if destination exists
                                         if (destinationLocation.valid) {
@@ -1463,21 +4934,21 @@ int CFS_Run(CFS cfs) {
                                                         printf("Not enough space to copy file %s\n",sourceLocation.filenanme);
                                                 } else {
                                                     // File so modify it with new content
-                                                    MDS sourceData = getMetadataFromNodeId(cfs->fileDesc,sourceLocation.nodeid);
-                                                    CFS_ModifyFile(cfs->fileDesc,destinationLocation.nodeid,sourceData.data.datablocks,sourceData.size);
+                                                    MDS sourceData = getMetadataFromNodeId(cfs,sourceLocation.nodeid);
+                                                    CFS_ModifyFile(cfs,destinationLocation.nodeid,sourceData.data.datablocks,sourceData.size,time(NULL));
                                                 }
                                             }
                                         } else {
                                             // Destination does not exist so check the argument before the last one
                                             destinationCopy = copyString(destination);
-                                            destinationLocation = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,1);
+                                            destinationLocation = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,1);
                                             // Check if it is a valid directory
                                             if (destinationLocation.valid) {
                                                 if (destinationLocation.type == TYPE_DIRECTORY) {
                                                     // Determine source type and act appropriately
                                                     if (sourceLocation.type == TYPE_DIRECTORY) {
                                                         if (options[CP_COPY_DIRECTORY_CONTENT] || options[CP_RECURSIVELY_COPY_DIRECTORIES]) {
-                                                            unsigned int newDirId = CFS_CreateDirectory(cfs,destinationLocation.filenanme,destinationLocation.nodeid);
+                                                            nodeid_t newDirId = CFS_CreateDirectory(cfs,destinationLocation.filenanme,destinationLocation.nodeid);
                                                             if (newDirId != 0)
                                                                 CFS_CopyDirectoryContents(cfs,sourceLocation.nodeid,newDirId,options);
                                                             else
@@ -1549,7 +5020,8 @@ int CFS_Run(CFS cfs) {
                             // Usage check
                             if (lastword) {
                                 location loc;
-                                unsigned int totalSize = 0,ok = 1;
+                                uint64_t totalSize = 0;
+                                int ok = 1;
                                 char datablocks[DATABLOCK_NUM];
                                 string sourceBackup;
                                 MDS sourceData;
@@ -1558,11 +5030,11 @@ int CFS_Run(CFS cfs) {
                                     source = Queue_Pop(sourcesQueue);
                                     sourceBackup = copyString(source);
                                     // Get source location and check if it exists and is a regular file
-                                    loc = getPathLocation(cfs->fileDesc,sourceBackup,cfs->currentDirectoryId,0);
+                                    loc = getPathLocation(cfs,sourceBackup,cfs->currentDirectoryId,0);
                                     if (loc.valid) {
                                         if (loc.type == TYPE_FILE) {
                                             // Get source data
-                                            sourceData = getMetadataFromNodeId(cfs->fileDesc,loc.nodeid);
+                                            sourceData = getMetadataFromNodeId(cfs,loc.nodeid);
                                             // Check if it fits in the curren concatinated file
                                             if (totalSize + sourceData.size <= cfs->MAX_FILE_SIZE) {
                                                 memcpy(datablocks + totalSize,sourceData.data.datablocks,sourceData.size);
@@ -1585,12 +5057,12 @@ int CFS_Run(CFS cfs) {
                                 // If there is enough space create the file
                                 if (ok) {
                                     string outputFileCopy = copyString(outputFile);
-                                    location outputFileLocation = getPathLocation(cfs->fileDesc,outputFileCopy,cfs->currentDirectoryId,1);
+                                    location outputFileLocation = getPathLocation(cfs,outputFileCopy,cfs->currentDirectoryId,1);
                                     // Check if output file location exists
                                     if (outputFileLocation.valid) {
                                         // Check if output file exists
-                                        if (!exists(cfs->fileDesc,outputFileLocation.filenanme,outputFileLocation.nodeid)) {
-                                            if(!CFS_CreateFile(cfs,outputFileLocation.filenanme,outputFileLocation.nodeid,datablocks,totalSize))
+                                        if (!exists(cfs,outputFileLocation.filenanme,outputFileLocation.nodeid)) {
+                                            if(!CFS_CreateFile(cfs,outputFileLocation.filenanme,outputFileLocation.nodeid,datablocks,totalSize,time(NULL)))
                                                 printf("Not enough space to create file %s\n",outputFileLocation.filenanme);
                                         } else {
                                             printf("%s already exists.\n",outputFile);
@@ -1639,18 +5111,21 @@ int CFS_Run(CFS cfs) {
                         // Usage check
                         if (lastword) {
                             // Get source file location
-                            location sourceLocation = getPathLocation(cfs->fileDesc,sourceFile,cfs->currentDirectoryId,0);
+                            location sourceLocation = getPathLocation(cfs,sourceFile,cfs->currentDirectoryId,0);
                             // Chech if the source file exists
                             if (sourceLocation.valid) {
                                 if (sourceLocation.type == TYPE_FILE) {
                                     // Get output file location
                                     string outputFileCopy = copyString(outputFile);
-                                    location outputLocation = getPathLocation(cfs->fileDesc,outputFileCopy,cfs->currentDirectoryId,1);
+                                    location outputLocation = getPathLocation(cfs,outputFileCopy,cfs->currentDirectoryId,1);
                                     // Check if output location exists
                                     if (outputLocation.valid) {
                                         // Check if a file with the same name exists in the output directory and create the hard link only if not
-                                        if (!exists(cfs->fileDesc,outputLocation.filenanme,outputLocation.nodeid)) {
-                                            if (!CFS_CreateHardLink(cfs,outputLocation.filenanme,sourceLocation.nodeid,outputLocation.nodeid)) {
+                                        if (!exists(cfs,outputLocation.filenanme,outputLocation.nodeid)) {
+                                            int linked = CFS_CreateHardLink(cfs,outputLocation.filenanme,sourceLocation.nodeid,outputLocation.nodeid);
+                                            if (linked == -1) {
+                                                printf("Too many links to create hardlink %s\n",outputLocation.filenanme);
+                                            } else if (!linked) {
                                                 printf("Not enough space to create hardlink %s\n",outputLocation.filenanme);
                                             }
                                         } else {
@@ -1740,7 +5215,7 @@ int CFS_Run(CFS cfs) {
                                     // More than 2 arguments so destination must always be a directory (2nd usage)
                                     // Get destination location
                                     destinationCopy = copyString(destination);
-                                    destinationLocation = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,0);
+                                    destinationLocation = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,0);
                                     DestroyString(&destinationCopy);
                                     // Check if destination exists
                                     if (destinationLocation.valid) {
@@ -1753,10 +5228,10 @@ int CFS_Run(CFS cfs) {
                                                 // Extract source from queue
                                                 path = Queue_Pop(sourcesQueue);
                                                 pathCopy = copyString(path);
-                                                loc = getPathLocation(cfs->fileDesc,pathCopy,cfs->currentDirectoryId,1);
+                                                loc = getPathLocation(cfs,pathCopy,cfs->currentDirectoryId,1);
                                                 // Check if source exists
-                                                if (loc.valid && exists(cfs->fileDesc,loc.filenanme,loc.nodeid)) {
-                                                    if (!exists(cfs->fileDesc,loc.filenanme,destinationLocation.nodeid)) {
+                                                if (loc.valid && exists(cfs,loc.filenanme,loc.nodeid)) {
+                                                    if (!exists(cfs,loc.filenanme,destinationLocation.nodeid)) {
                                                         if (!CFS_MoveSource(cfs,loc.nodeid,loc.filenanme,destinationLocation.nodeid,loc.filenanme,prompt))
                                                             printf("Not enough space in destination directory to move %s\n",loc.filenanme);
                                                     } else {
@@ -1779,17 +5254,17 @@ int CFS_Run(CFS cfs) {
                                     // Get source location
                                     string source = Queue_Pop(sourcesQueue);
                                     string sourceBackup = copyString(source);
-                                    location sourceLocation = getPathLocation(cfs->fileDesc,sourceBackup,cfs->currentDirectoryId,1);
+                                    location sourceLocation = getPathLocation(cfs,sourceBackup,cfs->currentDirectoryId,1);
                                     // Check if source exists
-                                    if (sourceLocation.valid && exists(cfs->fileDesc,sourceLocation.filenanme,sourceLocation.nodeid)) {
+                                    if (sourceLocation.valid && exists(cfs,sourceLocation.filenanme,sourceLocation.nodeid)) {
                                         destinationCopy = copyString(destination);
-                                        destinationLocation = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,0);
+                                        destinationLocation = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,0);
                                         DestroyString(&destinationCopy);
                                         // Check if destination exists
                                         if (destinationLocation.valid) {
                                             // Determine destination type and act appropriately
                                             if (destinationLocation.type == TYPE_DIRECTORY) {
-                                                if (!exists(cfs->fileDesc,sourceLocation.filenanme,destinationLocation.nodeid)) {
+                                                if (!exists(cfs,sourceLocation.filenanme,destinationLocation.nodeid)) {
                                                     if (!CFS_MoveSource(cfs,sourceLocation.nodeid,sourceLocation.filenanme,destinationLocation.nodeid,sourceLocation.filenanme,prompt)) {
                                                         printf("Not enough space in destination directory to move %s\n",sourceLocation.filenanme);
                                                     }
@@ -1802,12 +5277,12 @@ int CFS_Run(CFS cfs) {
                                         } else {
                                             // Destination does not exist so check the argument before the last one
                                             destinationCopy = copyString(destination);
-                                            destinationLocation = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,1);
+                                            destinationLocation = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,1);
                                             // Check if it is a valid directory
                                             if (destinationLocation.valid) {
                                                 if (destinationLocation.type == TYPE_DIRECTORY) {
                                                     // Determine source type and act appropriately
-                                                    if (!exists(cfs->fileDesc,destinationLocation.filenanme,destinationLocation.nodeid)) {
+                                                    if (!exists(cfs,destinationLocation.filenanme,destinationLocation.nodeid)) {
                                                         if (!CFS_MoveSource(cfs,sourceLocation.nodeid,sourceLocation.filenanme,destinationLocation.nodeid,destinationLocation.filenanme,prompt)) {
                                                             printf("Not enough space in destination directory to move %s\n",sourceLocation.filenanme);
                                                         }
@@ -1856,13 +5331,15 @@ int CFS_Run(CFS cfs) {
                 if (!lastword) {
                     // Read options
                     string option = readNextWord(&lastword);
-                    int options[2] = {0,0};
+                    int options[3] = {0,0,0};
                     unsigned int optionsCount = 0,ok = 1,lastwasoption = 0;
                     while (!lastword && ok && option[0] == '-') {
                         if (!strcmp("-i",option)) {
                             options[RM_PROMPT] = 1;
                         } else if (!strcmp("-r",option)) {
                             options[RM_RECURSIVE] = 1;
+                        } else if (!strcmp("-p",option)) {
+                            options[RM_PUNCH] = 1;
                         } else {
                             printf("Wrong option %s\n",option);
                             ok = 0;
@@ -1887,10 +5364,10 @@ int CFS_Run(CFS cfs) {
                                 location loc;
                                 while (1) {
                                     destinationCopy = copyString(destination);
-                                    loc = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,0);
+                                    loc = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,0);
                                     if (loc.valid) {
                                         if (loc.type == TYPE_DIRECTORY)
-                                            CFS_RemoveDirectoryContent(cfs->fileDesc,loc.nodeid,options);
+                                            CFS_RemoveDirectoryContent(cfs,loc.nodeid,options);
                                         else
                                             printf("%s not a directory.\n",destination);
                                     } else {
@@ -1915,10 +5392,10 @@ int CFS_Run(CFS cfs) {
                             location loc;
                             while (1) {
                                 destinationCopy = copyString(destination);
-                                loc = getPathLocation(cfs->fileDesc,destinationCopy,cfs->currentDirectoryId,0);
+                                loc = getPathLocation(cfs,destinationCopy,cfs->currentDirectoryId,0);
                                 if (loc.valid) {
                                     if (loc.type == TYPE_DIRECTORY)
-                                        CFS_RemoveDirectoryContent(cfs->fileDesc,loc.nodeid,options);
+                                        CFS_RemoveDirectoryContent(cfs,loc.nodeid,options);
                                     else
                                         printf("%s not a directory.\n",destination);
                                 } else {
@@ -1949,43 +5426,106 @@ int CFS_Run(CFS cfs) {
             if (cfs->fileDesc != -1) {
                 // Check if sources and destination directory were specified
                 if (!lastword) {
+                    // Read options
+                    importReport report;
+                    memset(&report,0,sizeof(importReport));
+                    int ok = 1,fromStdin = 0,unpacked = 0;
+                    string archive = NULL;
+                    string argument = readNextWord(&lastword);
+                    while (!lastword && argument[0] == '-') {
+                        if (!strcmp("-tar",argument) && archive == NULL) {
+                            DestroyString(&argument);
+                            argument = readNextWord(&lastword);
+                            // The archive follows the command in the standard input
+                            fromStdin = !strcmp("-",argument);
+                            // The archive's name is followed by the directory
+                            if (lastword) {
+                                printf("Usage:cfs_import -tar <FILE>|- [-update] <DIRECTORY>\n");
+                                ok = 0;
+                                break;
+                            }
+                            archive = argument;
+                            argument = readNextWord(&lastword);
+                            continue;
+                        } else if (!strcmp("-update",argument)) {
+                            report.options[IMPORT_UPDATE] = 1;
+                        } else if (!strcmp("-delete",argument)) {
+                            report.options[IMPORT_DELETE] = 1;
+                        } else {
+                            printf("Wrong option %s\n",argument);
+                            ok = 0;
+                            fromStdin |= CFS_IgnoreArguments(commandLabel,lastword);
+                            break;
+                        }
+                        DestroyString(&argument);
+                        argument = readNextWord(&lastword);
+                    }
                     // Read sources and add them to the queue
-                    string argument = NULL;
                     Queue sourcesQueue;
                     Queue_Create(&sourcesQueue);
-                    do {
+                    unsigned int sources = 0;
+                    while (ok && !lastword) {
+                        Queue_Push(sourcesQueue,argument);
+                        sources++;
                         DestroyString(&argument);
                         argument = readNextWord(&lastword);
-                        if (!lastword)
-                            Queue_Push(sourcesQueue,argument);
-                    } while (!lastword);
+                    }
                     // Read directory
                     string directory = argument;
-                    // Get directory location in cfs
-                    location loc = getPathLocation(cfs->fileDesc,directory,cfs->currentDirectoryId,0);
-                    // Check if directory exists
-                    if (loc.valid && loc.type == TYPE_DIRECTORY) {
+                    location loc;
+                    if (!ok) {
+                        DestroyString(&directory);
+                    } else if (archive != NULL && (sources != 0 || report.options[IMPORT_DELETE])) {
+                        // Archives are imported on their own and do not list what to remove
+                        printf("Usage:cfs_import -tar <FILE>|- [-update] <DIRECTORY>\n");
+                        DestroyString(&directory);
+                    } else if (report.options[IMPORT_DELETE] && (!report.options[IMPORT_UPDATE] || sources != 1)) {
+                        // Otherwise the sources would remove each other's files
+                        printf("Usage:cfs_import -update -delete <SOURCE> <DIRECTORY>\n");
+                        DestroyString(&directory);
+                    } else if ((loc = getPathLocation(cfs,directory,cfs->currentDirectoryId,0)).valid && loc.type == TYPE_DIRECTORY) {
+                        FILE *in = NULL;
+                        if (fromStdin) {
+                            in = stdin;
+                        } else if (archive != NULL && (in = fopen(archive,"r")) == NULL) {
+                            perror("Archive open error");
+                        } else if (archive != NULL) {
+                            setvbuf(in,NULL,_IOFBF,PACK_BUFFER_SIZE);
+                        }
+                        // Archive members are created while they are read, without any host files
+                        if (in != NULL) {
+                            unpacked = CFS_Unpack(cfs,in,loc.nodeid,report.options[IMPORT_UPDATE] ? &report : NULL);
+                            if (in != stdin)
+                                fclose(in);
+                        }
                         // Read all sources from linux and import their contents in cfs
                         string source;
                         while (!Queue_Empty(sourcesQueue)) {
                             source = Queue_Pop(sourcesQueue);
-                            CFS_ImportSource(cfs,source,loc.nodeid);
+                            CFS_ImportSource(cfs,source,loc.nodeid,report.options[IMPORT_UPDATE] ? &report : NULL);
                             DestroyString(&source);
                         }
+                        if (report.options[IMPORT_UPDATE] && (archive == NULL || in != NULL))
+                            printf("Imported %llu new files (%llu bytes), updated %llu (%llu bytes), %llu unchanged (%llu bytes), removed %llu entities\n",(unsigned long long)report.added,(unsigned long long)report.addedBytes,(unsigned long long)report.updated,(unsigned long long)report.updatedBytes,(unsigned long long)report.unchanged,(unsigned long long)report.unchangedBytes,(unsigned long long)report.removed);
                         DestroyString(&directory);
-                        Queue_Destroy(&sourcesQueue);
                     } else {
                         // Not a directory
                         printf("No such directory %s\n",directory);
                     }
+                    Queue_Destroy(&sourcesQueue);
+                    if (archive != NULL)
+                        DestroyString(&archive);
+                    // Whatever is left of an archive in the standard input must not be read as commands
+                    if (fromStdin && !unpacked)
+                        Tar_SkipArchive(stdin);
                 } else {
                     // Nothing was specified
-                    printf("Usage:cfs_import <SOURCES> ... <DIRECTORY>\n");
+                    printf("Usage:cfs_import [-update [-delete]] <SOURCES> ... <DIRECTORY>\n       cfs_import -tar <FILE>|- [-update] <DIRECTORY>\n");
                 }
             } else {
                 printf("Not currently working with a cfs file.\n");
-                if (!lastword)
-                    IgnoreRemainingInput();
+                if (CFS_IgnoreArguments(commandLabel,lastword))
+                    Tar_SkipArchive(stdin);
             }
         }
         // Export cfs files/directories to linux fs
@@ -1994,44 +5534,169 @@ int CFS_Run(CFS cfs) {
             if (cfs->fileDesc != -1) {
                 // Check if sources and destination directory were specified
                 if (!lastword) {
+                    // Read options
+                    exportReport report;
+                    memset(&report,0,sizeof(exportReport));
+                    int ok = 1;
+                    string argument = readNextWord(&lastword);
+                    while (!lastword && argument[0] == '-') {
+                        if (!strcmp("-sync",argument)) {
+                            report.options[EXPORT_SYNC] = 1;
+                        } else if (!strcmp("-delete",argument)) {
+                            report.options[EXPORT_DELETE] = 1;
+                        } else {
+                            printf("Wrong option %s\n",argument);
+                            ok = 0;
+                            IgnoreRemainingInput();
+                            break;
+                        }
+                        DestroyString(&argument);
+                        argument = readNextWord(&lastword);
+                    }
                     // Read sources and add them to the queue
-                    string argument = NULL;
                     Queue sourcesQueue;
                     Queue_Create(&sourcesQueue);
-                    do {
+                    unsigned int sources = 0;
+                    while (ok && !lastword) {
+                        Queue_Push(sourcesQueue,argument);
+                        sources++;
                         DestroyString(&argument);
                         argument = readNextWord(&lastword);
-                        if (!lastword)
-                            Queue_Push(sourcesQueue,argument);
-                    } while (!lastword);
+                    }
                     // Read directory
                     string directory = argument;
                     // Check if directory exists
                     struct stat st;
-                    if (stat(directory,&st) == 0 && S_ISDIR(st.st_mode)) {
+                    if (!ok) {
+                        DestroyString(&directory);
+                    } else if (report.options[EXPORT_DELETE] && (!report.options[EXPORT_SYNC] || sources != 1)) {
+                        // Otherwise the sources would delete each other's files
+                        printf("Usage:cfs_export -sync -delete <SOURCE> <DIRECTORY>\n");
+                        DestroyString(&directory);
+                    } else if (stat(directory,&st) == 0 && S_ISDIR(st.st_mode)) {
                         // Read all sources from linux and import their contents in cfs
                         string source;
                         while (!Queue_Empty(sourcesQueue)) {
                             source = Queue_Pop(sourcesQueue);
-                            CFS_ExportSource(cfs,source,directory);
+                            CFS_ExportSource(cfs,source,directory,report.options[EXPORT_SYNC] ? &report : NULL);
                             DestroyString(&source);
                         }
+                        if (report.options[EXPORT_SYNC])
+                            printf("Exported %llu files (%llu bytes), skipped %llu unchanged files (%llu bytes), deleted %llu host entries\n",(unsigned long long)report.written,(unsigned long long)report.writtenBytes,(unsigned long long)report.skipped,(unsigned long long)report.skippedBytes,(unsigned long long)report.deleted);
                         DestroyString(&directory);
-                        Queue_Destroy(&sourcesQueue);
                     } else {
                         // Not a directory
                         printf("No such directory %s.\n",directory);
                     }
+                    Queue_Destroy(&sourcesQueue);
                 } else {
                     // Nothing was specified
-                    printf("Usage:cfs_export <SOURCES> ... <DIRECTORY>\n");
+                    printf("Usage:cfs_export [-sync [-delete]] <SOURCES> ... <DIRECTORY>\n");
+                }
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Write a cfs file or directory tree to a tar archive
+        else if (!strcmp("cfs_pack",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                string path = NULL,option = NULL,file = NULL;
+                if (!lastword)
+                    path = readNextWord(&lastword);
+                if (!lastword)
+                    option = readNextWord(&lastword);
+                if (!lastword)
+                    file = readNextWord(&lastword);
+                if (!lastword || file == NULL || strcmp("-o",option)) {
+                    printf("Usage:cfs_pack <PATH> -o <FILE>|-\n");
+                    if (!lastword)
+                        IgnoreRemainingInput();
+                } else {
+                    string pathCopy = copyString(path);
+                    location loc = getPathLocation(cfs,pathCopy,cfs->currentDirectoryId,0);
+                    FILE *out = NULL;
+                    if (!loc.valid) {
+                        printf("%s not found.\n",path);
+                    } else if (!strcmp("-",file)) {
+                        // The archive goes to the standard output right after the prompt
+                        fflush(stdout);
+                        out = stdout;
+                    } else if ((out = fopen(file,"w")) == NULL) {
+                        perror("Archive creation error");
+                    } else {
+                        setvbuf(out,NULL,_IOFBF,PACK_BUFFER_SIZE);
+                    }
+                    if (out != NULL) {
+                        packArchive archive;
+                        memset(&archive,0,sizeof(packArchive));
+                        if (CFS_Pack(cfs,loc,out,&archive) && out != stdout)
+                            printf("Packed %llu directories, %llu files (%llu bytes) and %llu links\n",(unsigned long long)archive.directories,(unsigned long long)(archive.fileCount - archive.links),(unsigned long long)archive.bytes,(unsigned long long)archive.links);
+                        if (out != stdout)
+                            fclose(out);
+                    }
+                    DestroyString(&pathCopy);
                 }
+                if (path != NULL)
+                    DestroyString(&path);
+                if (option != NULL)
+                    DestroyString(&option);
+                if (file != NULL)
+                    DestroyString(&file);
             } else {
                 printf("Not currently working with a cfs file.\n");
                 if (!lastword)
                     IgnoreRemainingInput();
             }
         }
+        // Add the contents of a tar archive to a cfs directory
+        else if (!strcmp("cfs_unpack",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                string file = NULL,directory = NULL;
+                if (!lastword)
+                    file = readNextWord(&lastword);
+                if (!lastword)
+                    directory = readNextWord(&lastword);
+                // The archive follows the command in the standard input
+                int fromStdin = file != NULL && !strcmp("-",file),unpacked = 0;
+                if (!lastword || directory == NULL) {
+                    printf("Usage:cfs_unpack <FILE>|- <DIRECTORY>\n");
+                    if (!lastword)
+                        IgnoreRemainingInput();
+                } else {
+                    location loc = getPathLocation(cfs,directory,cfs->currentDirectoryId,0);
+                    FILE *in = NULL;
+                    if (!loc.valid || loc.type != TYPE_DIRECTORY) {
+                        printf("No such directory %s\n",directory);
+                    } else if (fromStdin) {
+                        in = stdin;
+                    } else if ((in = fopen(file,"r")) == NULL) {
+                        perror("Archive open error");
+                    } else {
+                        setvbuf(in,NULL,_IOFBF,PACK_BUFFER_SIZE);
+                    }
+                    if (in != NULL) {
+                        unpacked = CFS_Unpack(cfs,in,loc.nodeid,NULL);
+                        if (in != stdin)
+                            fclose(in);
+                    }
+                }
+                // Whatever is left of an archive in the standard input must not be read as commands
+                if (fromStdin && !unpacked)
+                    Tar_SkipArchive(stdin);
+                if (file != NULL)
+                    DestroyString(&file);
+                if (directory != NULL)
+                    DestroyString(&directory);
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (CFS_IgnoreArguments(commandLabel,lastword))
+                    Tar_SkipArchive(stdin);
+            }
+        }
         // Create new cfs file
         else if (!strcmp("cfs_create",commandLabel)) {
             // Check if options were specified
@@ -2042,7 +5707,9 @@ int CFS_Run(CFS cfs) {
                 option = readNextWord(&lastword);
                 int ok = 1;
                 // Default values for all options
-                unsigned int BLOCK_SIZE = sizeof(char),FILENAME_SIZE = MAX_FILENAME_SIZE,MAX_FILE_SIZE = DATABLOCK_NUM,MAX_DIRECTORY_FILE_NUMBER = sizeof(unsigned int) + MAX_FILENAME_SIZE*sizeof(char);
+                unsigned int BLOCK_SIZE = sizeof(char),FILENAME_SIZE = MAX_FILENAME_SIZE,MAX_FILE_SIZE = DATABLOCK_NUM,MAX_DIRECTORY_FILE_NUMBER = 0,ALLOCATION_POLICY = ALLOCATE_FIRST,GROWTH_PERCENT = 0,WRITE_MODE = WRITE_IN_PLACE,STRIPES = 1;
+                nodeid_t PREALLOCATED_NODES = 0;
+                uint64_t CHANGE_CAPACITY = 0;
                 while (option[0] == '-') {
                     // Check if option argument was not specified
                     if (lastword) {
@@ -2069,6 +5736,30 @@ int CFS_Run(CFS cfs) {
                             // MAX_DIRECTORY_FILE_NUMBER
                             MAX_DIRECTORY_FILE_NUMBER = atoi(option_argument);
                         }
+                        else if (!strcmp("-alloc",option) && (!strcmp("first",option_argument) || !strcmp("near",option_argument))) {
+                            // ALLOCATION_POLICY
+                            ALLOCATION_POLICY = strcmp("first",option_argument) ? ALLOCATE_NEAR : ALLOCATE_FIRST;
+                        }
+                        else if (!strcmp("-prealloc",option)) {
+                            // Initial size in nodes
+                            PREALLOCATED_NODES = strtoull(option_argument,NULL,10);
+                        }
+                        else if (!strcmp("-grow",option)) {
+                            // GROWTH_PERCENT
+                            GROWTH_PERCENT = atoi(option_argument);
+                        }
+                        else if (!strcmp("-write",option) && (!strcmp("inplace",option_argument) || !strcmp("log",option_argument))) {
+                            // WRITE_MODE
+                            WRITE_MODE = strcmp("inplace",option_argument) ? WRITE_LOG : WRITE_IN_PLACE;
+                        }
+                        else if (!strcmp("-changes",option)) {
+                            // Records the change log keeps
+                            CHANGE_CAPACITY = strtoull(option_argument,NULL,10);
+                        }
+                        else if (!strcmp("-stripe",option)) {
+                            // Member files that the nodes are spread across
+                            STRIPES = atoi(option_argument);
+                        }
                         else {
                             printf("Wrong option\n");
                             ok = 0;
@@ -2087,8 +5778,11 @@ int CFS_Run(CFS cfs) {
                 if (ok) {
                     // Last word is the file
                     string file = option;
+                    // By default directories hold as many entries as fit in MAX_FILE_SIZE
+                    if (MAX_DIRECTORY_FILE_NUMBER == 0 && MAX_FILE_SIZE > sizeof(directoryHeader))
+                        MAX_DIRECTORY_FILE_NUMBER = (MAX_FILE_SIZE - sizeof(directoryHeader))/MIN_DIRECTORY_ENTRY_SIZE;
                     // Create the file
-                    Create_CFS_File(file,BLOCK_SIZE,FILENAME_SIZE,MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER);
+                    Create_CFS_File(file,BLOCK_SIZE,FILENAME_SIZE,MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER,ALLOCATION_POLICY,PREALLOCATED_NODES,GROWTH_PERCENT,WRITE_MODE,CHANGE_CAPACITY,STRIPES);
                 } else {
                     // No file specified
                     printf("Usage:cfs_workwith <OPTIONS> <FILE>\n");
@@ -2100,6 +5794,390 @@ int CFS_Run(CFS cfs) {
                 printf("Usage:cfs_workwith <OPTIONS> <FILE>\n");
             }
         }
+        // Convert a cfs file created by an older cfs version to the current format
+        else if (!strcmp("cfs_convert",commandLabel)) {
+            // Usage check
+            if (!lastword) {
+                string source = readNextWord(&lastword);
+                if (!lastword) {
+                    string destination = readNextWord(&lastword);
+                    if (lastword) {
+                        CFS_ConvertLegacyFile(source,destination);
+                    } else {
+                        printf("Usage:cfs_convert <LEGACY_FILE> <NEW_FILE>\n");
+                        IgnoreRemainingInput();
+                    }
+                    DestroyString(&destination);
+                } else {
+                    printf("Usage:cfs_convert <LEGACY_FILE> <NEW_FILE>\n");
+                }
+                DestroyString(&source);
+            } else {
+                printf("Usage:cfs_convert <LEGACY_FILE> <NEW_FILE>\n");
+            }
+        }
+        // Search the contents of files
+        else if (!strcmp("cfs_grep",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                grepPattern pattern;
+                memset(&pattern,0,sizeof(grepPattern));
+                string word = NULL;
+                int ok = !lastword;
+                // Read options
+                while (ok) {
+                    word = readNextWord(&lastword);
+                    if (word[0] != '-' || lastword)
+                        break;
+                    if (!strcmp("-r",word))
+                        pattern.options[GREP_RECURSIVE] = 1;
+                    else if (!strcmp("-F",word))
+                        pattern.options[GREP_FIXED] = 1;
+                    else if (!strcmp("-E",word))
+                        pattern.options[GREP_EXTENDED] = 1;
+                    else if (!strcmp("-l",word))
+                        pattern.options[GREP_LIST] = 1;
+                    else if (!strcmp("-c",word))
+                        pattern.options[GREP_COUNT] = 1;
+                    else {
+                        printf("Wrong option %s\n",word);
+                        ok = 0;
+                    }
+                    DestroyString(&word);
+                }
+                // Pattern and at least 1 path are required
+                if (ok && !lastword) {
+                    pattern.pattern = word;
+                    pattern.length = strlen(word);
+                    // Patterns without special characters are fixed strings even if -F was not given
+                    pattern.fixed = pattern.options[GREP_FIXED] || strpbrk(word,pattern.options[GREP_EXTENDED] ? "\\^$.[]|()*+?{}" : "\\^$.[]*") == NULL;
+                    if (!pattern.fixed && regcomp(&pattern.regex,word,pattern.options[GREP_EXTENDED] ? REG_EXTENDED|REG_NOSUB : REG_NOSUB) != 0) {
+                        printf("Invalid regular expression %s\n",word);
+                        IgnoreRemainingInput();
+                    } else {
+                        grepTask *tasks = NULL;
+                        unsigned int i,taskCount = 0,capacity = 0;
+                        string path,pathCopy;
+                        location loc;
+                        do {
+                            path = readNextWord(&lastword);
+                            pathCopy = copyString(path);
+                            loc = getPathLocation(cfs,pathCopy,cfs->currentDirectoryId,0);
+                            if (!loc.valid)
+                                printf("%s: No such file or directory.\n",path);
+                            else if (!CFS_GrepCollect(cfs,loc.nodeid,loc.type,path,pattern.options[GREP_RECURSIVE],&tasks,&taskCount,&capacity))
+                                printf("Not enough memory.\n");
+                            DestroyString(&pathCopy);
+                            DestroyString(&path);
+                        } while (!lastword);
+                        CFS_Grep(cfs,&pattern,tasks,taskCount);
+                        for (i = 0; i < taskCount; i++) {
+                            DestroyString(&tasks[i].path);
+                            DestroyString(&tasks[i].output);
+                        }
+                        free(tasks);
+                        if (!pattern.fixed)
+                            regfree(&pattern.regex);
+                    }
+                } else {
+                    printf("Usage:cfs_grep [-r] [-F|-E] [-l|-c] <PATTERN> <PATHS>\n");
+                    if (!lastword)
+                        IgnoreRemainingInput();
+                }
+                DestroyString(&word);
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Search a directory tree for entities satisfying some predicates
+        else if (!strcmp("cfs_find",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                if (!lastword) {
+                    string path = readNextWord(&lastword),option,option_argument;
+                    findQuery *query = malloc(sizeof(findQuery));
+                    int ok = query != NULL;
+                    if (ok) {
+                        query->name = NULL;
+                        query->type = -1;
+                        query->hasSize = query->hasNewer = query->hasLinks = 0;
+                    }
+                    while (ok && !lastword) {
+                        option = readNextWord(&lastword);
+                        if (lastword) {
+                            // Every predicate takes an argument
+                            ok = 0;
+                            DestroyString(&option);
+                            break;
+                        }
+                        option_argument = readNextWord(&lastword);
+                        if (!strcmp("-name",option)) {
+                            DestroyString(&query->name);
+                            query->name = copyString(option_argument);
+                        } else if (!strcmp("-type",option) && (!strcmp("f",option_argument) || !strcmp("d",option_argument))) {
+                            query->type = option_argument[0] == 'f' ? TYPE_FILE : TYPE_DIRECTORY;
+                        } else if (!strcmp("-size",option)) {
+                            query->hasSize = 1;
+                            query->sizeCompare = option_argument[0] == '+' ? 1 : (option_argument[0] == '-' ? -1 : 0);
+                            query->size = strtoull(option_argument + (query->sizeCompare != 0),NULL,10);
+                        } else if (!strcmp("-newer",option)) {
+                            // Either an entity whose modification time is used or seconds since the epoch
+                            string newerCopy = copyString(option_argument);
+                            location newerLoc = getPathLocation(cfs,newerCopy,cfs->currentDirectoryId,0);
+                            if (newerLoc.valid) {
+                                query->newer = getMetadataFromNodeId(cfs,newerLoc.nodeid).modificationTime;
+                            } else {
+                                char *end;
+                                query->newer = strtoll(option_argument,&end,10);
+                                if (*end != '\0') {
+                                    printf("No such file or directory.\n");
+                                    ok = 0;
+                                }
+                            }
+                            query->hasNewer = 1;
+                            DestroyString(&newerCopy);
+                        } else if (!strcmp("-links",option)) {
+                            query->hasLinks = 1;
+                            query->links = atoi(option_argument);
+                        } else {
+                            printf("Wrong option %s\n",option);
+                            ok = 0;
+                        }
+                        DestroyString(&option);
+                        DestroyString(&option_argument);
+                    }
+                    if (ok) {
+                        string pathCopy = copyString(path);
+                        location loc = getPathLocation(cfs,pathCopy,cfs->currentDirectoryId,0);
+                        if (loc.valid)
+                            CFS_Find(cfs,loc,path,query);
+                        else
+                            printf("No such file or directory.\n");
+                        DestroyString(&pathCopy);
+                    } else {
+                        printf("Usage:cfs_find <PATH> [-name <GLOB>] [-type f|d] [-size [+|-]<BYTES>] [-newer <PATH>|<SECONDS>] [-links <N>]\n");
+                        if (!lastword)
+                            IgnoreRemainingInput();
+                    }
+                    if (query != NULL)
+                        DestroyString(&query->name);
+                    free(query);
+                    DestroyString(&path);
+                } else {
+                    printf("Usage:cfs_find <PATH> [-name <GLOB>] [-type f|d] [-size [+|-]<BYTES>] [-newer <PATH>|<SECONDS>] [-links <N>]\n");
+                }
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Show the size of files and directories
+        else if (!strcmp("cfs_du",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                int verify = 0;
+                string path = NULL,pathCopy;
+                location loc;
+                if (!lastword) {
+                    path = readNextWord(&lastword);
+                    if (!strcmp("-verify",path)) {
+                        verify = 1;
+                        DestroyString(&path);
+                        if (!lastword)
+                            path = readNextWord(&lastword);
+                    }
+                }
+                // Current directory by default
+                if (path == NULL) {
+                    path = copyString(".");
+                    lastword = 1;
+                }
+                while (1) {
+                    pathCopy = copyString(path);
+                    loc = getPathLocation(cfs,pathCopy,cfs->currentDirectoryId,0);
+                    if (!loc.valid)
+                        printf("No such file or directory.\n");
+                    else if (verify && loc.type == TYPE_DIRECTORY)
+                        CFS_DuVerify(cfs,loc.nodeid,path);
+                    else
+                        CFS_du(cfs,loc.nodeid,path);
+                    DestroyString(&pathCopy);
+                    DestroyString(&path);
+                    if (lastword)
+                        break;
+                    path = readNextWord(&lastword);
+                }
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Show how full the working cfs file is
+        else if (!strcmp("cfs_df",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                if (lastword) {
+                    CFS_df(cfs);
+                } else {
+                    printf("Usage:cfs_df\n");
+                    IgnoreRemainingInput();
+                }
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Stream the change log's records after a sequence number
+        else if (!strcmp("cfs_changes",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                string option = NULL,argument = NULL;
+                if (!lastword)
+                    option = readNextWord(&lastword);
+                if (option != NULL && !lastword)
+                    argument = readNextWord(&lastword);
+                if (option == NULL) {
+                    CFS_Changes(cfs,0);
+                } else if (!lastword || argument == NULL || strcmp("-since",option)) {
+                    printf("Usage:cfs_changes [-since <SEQUENCE>]\n");
+                    if (!lastword)
+                        IgnoreRemainingInput();
+                } else {
+                    CFS_Changes(cfs,strtoull(argument,NULL,10));
+                }
+                if (option != NULL)
+                    DestroyString(&option);
+                if (argument != NULL)
+                    DestroyString(&argument);
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Release the host disk space of deleted nodes
+        else if (!strcmp("cfs_trim",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                if (lastword) {
+                    CFS_Trim(cfs);
+                } else {
+                    printf("Usage:cfs_trim\n");
+                    IgnoreRemainingInput();
+                }
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Remove holes from the working cfs file and store it's nodes in tree order
+        else if (!strcmp("cfs_compact",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                if (lastword) {
+                    CFS_Compact(cfs);
+                } else {
+                    printf("Usage:cfs_compact\n");
+                    IgnoreRemainingInput();
+                }
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Write a read-only copy of the working cfs file for mapped reads
+        else if (!strcmp("cfs_seal",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                string file = NULL;
+                if (!lastword)
+                    file = readNextWord(&lastword);
+                if (!lastword || file == NULL) {
+                    printf("Usage:cfs_seal <FILE>\n");
+                    if (!lastword)
+                        IgnoreRemainingInput();
+                } else {
+                    CFS_Seal(cfs,file);
+                }
+                if (file != NULL)
+                    DestroyString(&file);
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
+        // Compare the trees of two cfs files
+        else if (!strcmp("cfs_diff",commandLabel)) {
+            string fileA = NULL,fileB = NULL,path = NULL;
+            int content = 0;
+            if (!lastword) {
+                fileA = readNextWord(&lastword);
+                if (!strcmp("-content",fileA) && !lastword) {
+                    // Compare the contents of every file, not only of those whose metadata differ
+                    content = 1;
+                    DestroyString(&fileA);
+                    fileA = readNextWord(&lastword);
+                }
+            }
+            if (!lastword)
+                fileB = readNextWord(&lastword);
+            if (!lastword)
+                path = readNextWord(&lastword);
+            if (!lastword || fileB == NULL) {
+                printf("Usage:cfs_diff [-content] <FILE> <FILE> [<PATH>]\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            } else {
+                CFS_Diff(cfs,fileA,fileB,path != NULL ? path : "/",content);
+            }
+            if (fileA != NULL)
+                DestroyString(&fileA);
+            if (fileB != NULL)
+                DestroyString(&fileB);
+            if (path != NULL)
+                DestroyString(&path);
+        }
+        // Create, list, roll back to or delete snapshots of the working cfs file
+        else if (!strcmp("cfs_snapshot",commandLabel)) {
+            // Check if we have an open file to work on
+            if (cfs->fileDesc != -1) {
+                string action = NULL,name = NULL;
+                if (!lastword)
+                    action = readNextWord(&lastword);
+                if (action != NULL && strcmp("list",action) && !lastword)
+                    name = readNextWord(&lastword);
+                if (!lastword) {
+                    printf("Usage:cfs_snapshot create|rollback|delete <NAME>\n       cfs_snapshot list\n");
+                    IgnoreRemainingInput();
+                } else if (action != NULL && !strcmp("list",action)) {
+                    CFS_SnapshotList(cfs);
+                } else if (action != NULL && name != NULL && !strcmp("create",action)) {
+                    CFS_SnapshotCreate(cfs,name);
+                } else if (action != NULL && name != NULL && !strcmp("rollback",action)) {
+                    CFS_SnapshotRollback(cfs,name);
+                } else if (action != NULL && name != NULL && !strcmp("delete",action)) {
+                    CFS_SnapshotDelete(cfs,name);
+                } else {
+                    printf("Usage:cfs_snapshot create|rollback|delete <NAME>\n       cfs_snapshot list\n");
+                }
+                if (action != NULL)
+                    DestroyString(&action);
+                if (name != NULL)
+                    DestroyString(&name);
+            } else {
+                printf("Not currently working with a cfs file.\n");
+                if (!lastword)
+                    IgnoreRemainingInput();
+            }
+        }
         // Exit cfs interface 
         else if (!strcmp("cfs_exit",commandLabel)) {
             running = 0;
@@ -2118,6 +6196,7 @@ int CFS_Destroy(CFS *cfs) {
         // Close open cfs file if exists
         if ((*cfs)->fileDesc != -1) {
             close((*cfs)->fileDesc);
+            CFS_ReleaseGeometry(*cfs);
         }
         // Free allocated memory for cfs
         free(*cfs);
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../headers/fingerprint.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FINGERPRINT_X86
+#endif
+
+typedef unsigned int (*FindPreviousFunction)(const unsigned char*,unsigned int,unsigned char,unsigned int);
+
+unsigned char Fingerprint_Compute(const char *name) {
+    // 32 bit FNV-1a hash of the name folded to a single byte
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    unsigned char fp = (hash ^ (hash >> 8) ^ (hash >> 16) ^ (hash >> 24)) & 0xff;
+    // 0 is reserved for unknown fingerprints
+    return fp ? fp : 1;
+}
+
+static unsigned int findPreviousScalar(const unsigned char *fps,unsigned int count,unsigned char fp,unsigned int end) {
+    while (end-- > 0) {
+        if (fps[end] == fp || fps[end] == 0)
+            return end;
+    }
+    return count;
+}
+
+#ifdef FINGERPRINT_X86
+__attribute__((target("sse2")))
+static unsigned int findPreviousSSE2(const unsigned char *fps,unsigned int count,unsigned char fp,unsigned int end) {
+    const __m128i wanted = _mm_set1_epi8((char)fp),unknown = _mm_setzero_si128();
+    // Compare 16 fingerprints at a time, from the end backwards
+    for (; end >= 16; end -= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(fps + end - 16));
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block,wanted),_mm_cmpeq_epi8(block,unknown)));
+        if (mask)
+            return end - 16 + 31 - __builtin_clz(mask);
+    }
+    return findPreviousScalar(fps,count,fp,end);
+}
+
+__attribute__((target("avx2")))
+static unsigned int findPreviousAVX2(const unsigned char *fps,unsigned int count,unsigned char fp,unsigned int end) {
+    const __m256i wanted = _mm256_set1_epi8((char)fp),unknown = _mm256_setzero_si256();
+    // Compare 32 fingerprints at a time, from the end backwards
+    for (; end >= 32; end -= 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(fps + end - 32));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block,wanted),_mm256_cmpeq_epi8(block,unknown)));
+        if (mask)
+            return end - 32 + 31 - __builtin_clz(mask);
+    }
+    return findPreviousSSE2(fps,count,fp,end);
+}
+#endif
+
+// Kernel used by Fingerprint_FindPrevious, picked once since the 1st lookups may come from several threads at a time
+static FindPreviousFunction findPrevious = findPreviousScalar;
+static pthread_once_t findPreviousOnce = PTHREAD_ONCE_INIT;
+
+// Picks the widest kernel supported by the running cpu
+static void selectFindPrevious() {
+#ifdef FINGERPRINT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        findPrevious = findPreviousAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        findPrevious = findPreviousSSE2;
+#endif
+}
+
+unsigned int Fingerprint_FindPrevious(const unsigned char *fps,unsigned int count,unsigned char fp,unsigned int end) {
+    pthread_once(&findPreviousOnce,selectFindPrevious);
+    return findPrevious(fps,count,fp,end);
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../headers/metatable.h"
+
+#define METATABLE_MAGIC 0x4154454D
+#define METATABLE_VERSION 1
+#define METATABLE_HEADER_SIZE 64
+#define METATABLE_MIN_CAPACITY 1024
+// Bytes of every row across all the columns
+#define METATABLE_ROW_SIZE (5*sizeof(uint64_t) + sizeof(uint32_t) + sizeof(unsigned char))
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t clean; // 1 if the side file was closed after the last update
+  uint32_t unused;
+  uint64_t device; // Image that the side file describes
+  uint64_t inode;
+  uint64_t capacity; // Rows every column has room for
+  uint64_t count; // Rows in use
+} metaHeader;
+
+// Side file layout: the header followed by the columns, each one capacity rows long,
+// in the order sizes, parents, creation/access/modification times, links and states
+struct metatable
+{
+  int fd;
+  unsigned char *map;
+  size_t length;
+  metaHeader *header;
+  uint64_t *sizes;
+  uint64_t *parents;
+  int64_t *creationTimes;
+  int64_t *accessTimes;
+  int64_t *modificationTimes;
+  uint32_t *links;
+  unsigned char *states;
+};
+
+static size_t MetaTable_Length(uint64_t capacity) {
+  return METATABLE_HEADER_SIZE + capacity*METATABLE_ROW_SIZE;
+}
+
+// Maps the side file and points the columns inside it
+static int MetaTable_Map(MetaTable table,uint64_t capacity) {
+  table->length = MetaTable_Length(capacity);
+  table->map = mmap(NULL,table->length,PROT_READ|PROT_WRITE,MAP_SHARED,table->fd,0);
+  if (table->map == MAP_FAILED) {
+    table->map = NULL;
+    return 0;
+  }
+  table->header = (metaHeader*)table->map;
+  table->sizes = (uint64_t*)(table->map + METATABLE_HEADER_SIZE);
+  table->parents = table->sizes + capacity;
+  table->creationTimes = (int64_t*)(table->parents + capacity);
+  table->accessTimes = table->creationTimes + capacity;
+  table->modificationTimes = table->accessTimes + capacity;
+  table->links = (uint32_t*)(table->modificationTimes + capacity);
+  table->states = (unsigned char*)(table->links + capacity);
+  return 1;
+}
+
+int MetaTable_Open(MetaTable *table,const char *path,uint64_t device,uint64_t inode,int *valid) {
+  // Allocate memory for the table
+  if ((*table = (MetaTable)malloc(sizeof(struct metatable))) == NULL) {
+    printf("Not enough memory.\n");
+    return 0;
+  }
+  if (((*table)->fd = open(path,O_RDWR|O_CREAT,0644)) == -1) {
+    free(*table);
+    *table = NULL;
+    return 0;
+  }
+  // Reuse the side file only if it was left consistent by this very image
+  metaHeader header;
+  struct stat st;
+  *valid = fstat((*table)->fd,&st) == 0 && pread((*table)->fd,&header,sizeof(metaHeader),0) == sizeof(metaHeader)
+    && header.magic == METATABLE_MAGIC && header.version == METATABLE_VERSION && header.clean
+    && header.device == device && header.inode == inode && header.count <= header.capacity
+    && st.st_size == MetaTable_Length(header.capacity);
+  if (!*valid) {
+    // Start over with an empty table
+    memset(&header,0,sizeof(metaHeader));
+    header.magic = METATABLE_MAGIC;
+    header.version = METATABLE_VERSION;
+    header.device = device;
+    header.inode = inode;
+    header.capacity = METATABLE_MIN_CAPACITY;
+    if (ftruncate((*table)->fd,0) == -1 || ftruncate((*table)->fd,MetaTable_Length(header.capacity)) == -1
+      || pwrite((*table)->fd,&header,sizeof(metaHeader),0) != sizeof(metaHeader)) {
+      close((*table)->fd);
+      free(*table);
+      *table = NULL;
+      return 0;
+    }
+  }
+  if (!MetaTable_Map(*table,header.capacity)) {
+    close((*table)->fd);
+    free(*table);
+    *table = NULL;
+    return 0;
+  }
+  // Until it is closed the side file can not be trusted by the next run
+  (*table)->header->clean = 0;
+  return 1;
+}
+
+uint64_t MetaTable_Count(MetaTable table) {
+  return table->header->count;
+}
+
+int MetaTable_Resize(MetaTable table,uint64_t count) {
+  uint64_t capacity = table->header->capacity,used = table->header->count,i;
+  if (count > capacity) {
+    // Grow the columns geometrically
+    while (capacity < count)
+      capacity *= 2;
+    if (ftruncate(table->fd,MetaTable_Length(capacity)) == -1)
+      return 0;
+    munmap(table->map,table->length);
+    unsigned char *old[7];
+    if (!MetaTable_Map(table,capacity))
+      return 0;
+    // Columns only move towards the end of the file, so moving the last one first never overwrites the rest
+    uint64_t oldCapacity = table->header->capacity;
+    size_t widths[7] = {sizeof(uint64_t),sizeof(uint64_t),sizeof(int64_t),sizeof(int64_t),sizeof(int64_t),sizeof(uint32_t),sizeof(unsigned char)};
+    unsigned char *columns[7] = {(unsigned char*)table->sizes,(unsigned char*)table->parents,(unsigned char*)table->creationTimes,(unsigned char*)table->accessTimes,(unsigned char*)table->modificationTimes,(unsigned char*)table->links,table->states};
+    size_t offset = METATABLE_HEADER_SIZE;
+    int c;
+    for (c = 0; c < 7; c++) {
+      old[c] = table->map + offset;
+      offset += oldCapacity*widths[c];
+    }
+    for (c = 6; c >= 0; c--)
+      memmove(columns[c],old[c],used*widths[c]);
+    table->header->capacity = capacity;
+  }
+  // New rows stand for nodes that were not written yet
+  for (i = used; i < count; i++) {
+    table->sizes[i] = table->parents[i] = 0;
+    table->creationTimes[i] = table->accessTimes[i] = table->modificationTimes[i] = 0;
+    table->links[i] = 0;
+    table->states[i] = METATABLE_DELETED;
+  }
+  table->header->count = count;
+  return 1;
+}
+
+void MetaTable_Set(MetaTable table,uint64_t row,unsigned char state,uint64_t size,uint32_t links,uint64_t parent,int64_t creationTime,int64_t accessTime,int64_t modificationTime) {
+  if (row >= table->header->count)
+    return;
+  table->states[row] = state;
+  table->sizes[row] = size;
+  table->links[row] = links;
+  table->parents[row] = parent;
+  table->creationTimes[row] = creationTime;
+  table->accessTimes[row] = accessTime;
+  table->modificationTimes[row] = modificationTime;
+}
+
+const unsigned char *MetaTable_States(MetaTable table) {
+  return table->states;
+}
+
+const uint64_t *MetaTable_Sizes(MetaTable table) {
+  return table->sizes;
+}
+
+const uint32_t *MetaTable_Links(MetaTable table) {
+  return table->links;
+}
+
+const uint64_t *MetaTable_Parents(MetaTable table) {
+  return table->parents;
+}
+
+const int64_t *MetaTable_CreationTimes(MetaTable table) {
+  return table->creationTimes;
+}
+
+const int64_t *MetaTable_AccessTimes(MetaTable table) {
+  return table->accessTimes;
+}
+
+const int64_t *MetaTable_ModificationTimes(MetaTable table) {
+  return table->modificationTimes;
+}
+
+// Returns the 1st row from start on with the given state, or the number of rows if there is none
+uint64_t MetaTable_FindState(MetaTable table,unsigned char state,uint64_t start) {
+  uint64_t count = table->header->count;
+  if (start >= count)
+    return count;
+  // The states are one byte each so the C library's vectorized memchr does the scanning
+  const unsigned char *found = memchr(table->states + start,state,count - start);
+  return found == NULL ? count : (uint64_t)(found - table->states);
+}
+
+int MetaTable_Close(MetaTable *table) {
+  // Check if table was previously opened
+  if (*table != NULL) {
+    // A table whose remapping failed stays marked as not clean
+    if ((*table)->map != NULL) {
+      (*table)->header->clean = 1;
+      munmap((*table)->map,(*table)->length);
+    }
+    close((*table)->fd);
+    free(*table);
+    *table = NULL;
+    return 1;
+  }
+  return 0;
+}
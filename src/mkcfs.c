@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../headers/cfs.h"
+
+// Same defaults as cfs_create
+#define DEFAULT_BLOCK_SIZE 1
+#define DEFAULT_ALLOCATION_POLICY ALLOCATE_FIRST
+
+int main(int argc, char *argv[]) {
+    unsigned int BLOCK_SIZE = DEFAULT_BLOCK_SIZE,FILENAME_SIZE = MAX_FILENAME_SIZE,MAX_FILE_SIZE = DATABLOCK_NUM,MAX_DIRECTORY_FILE_NUMBER = 0,ALLOCATION_POLICY = DEFAULT_ALLOCATION_POLICY,GROWTH_PERCENT = 0;
+    uint64_t PREALLOCATED_NODES = 0;
+    int i,ok = 1;
+    // Read the cfs_create options
+    for (i = 1; i + 2 < argc && argv[i][0] == '-'; i += 2) {
+        if (!strcmp("-bs",argv[i])) {
+            BLOCK_SIZE = atoi(argv[i + 1]);
+        } else if (!strcmp("-fns",argv[i])) {
+            FILENAME_SIZE = atoi(argv[i + 1]);
+        } else if (!strcmp("-cfs",argv[i])) {
+            MAX_FILE_SIZE = atoi(argv[i + 1]);
+        } else if (!strcmp("-mdfn",argv[i])) {
+            MAX_DIRECTORY_FILE_NUMBER = atoi(argv[i + 1]);
+        } else if (!strcmp("-alloc",argv[i]) && (!strcmp("first",argv[i + 1]) || !strcmp("near",argv[i + 1]))) {
+            ALLOCATION_POLICY = strcmp("first",argv[i + 1]) ? ALLOCATE_NEAR : ALLOCATE_FIRST;
+        } else if (!strcmp("-prealloc",argv[i])) {
+            PREALLOCATED_NODES = strtoull(argv[i + 1],NULL,10);
+        } else if (!strcmp("-grow",argv[i])) {
+            GROWTH_PERCENT = atoi(argv[i + 1]);
+        } else {
+            printf("Wrong option\n");
+            ok = 0;
+            break;
+        }
+    }
+    // Check for correct usage
+    if (!ok || argc - i != 2) {
+        printf("Usage:./mkcfs <OPTIONS> <DIRECTORY> <FILE>\n");
+        return 1;
+    }
+    return CFS_BuildImage(argv[i],argv[i + 1],BLOCK_SIZE,FILENAME_SIZE,MAX_FILE_SIZE,MAX_DIRECTORY_FILE_NUMBER,ALLOCATION_POLICY,PREALLOCATED_NODES,GROWTH_PERCENT) ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "../headers/tar.h"
+
+// Largest pax or GNU long name header that is accepted
+#define TAR_MAX_EXTENSION (1 << 20)
+// Bytes of a "length key=value\n" pax record besides the value: the longest key, the length's digits,
+// the separators and snprintf's terminating zero
+#define TAR_PAX_RECORD_OVERHEAD 32
+
+// ustar header block
+typedef struct {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char mtime[12];
+  char chksum[8];
+  char typeflag;
+  char linkname[100];
+  char magic[6];
+  char version[2];
+  char uname[32];
+  char gname[32];
+  char devmajor[8];
+  char devminor[8];
+  char prefix[155];
+  char pad[12];
+} tarHeader;
+
+// Writes zeros up to the end of the block that the last size bytes ended in
+static int Tar_WritePadding(FILE *out,uint64_t size) {
+  static const char zeros[TAR_BLOCK_SIZE];
+  size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+  return fwrite(zeros,1,padding,out) == padding;
+}
+
+static int Tar_WriteHeader(FILE *out,const char *prefix,const char *name,char type,unsigned int mode,time_t mtime,const char *linkname,uint64_t size) {
+  tarHeader header;
+  memset(&header,0,sizeof(tarHeader));
+  // Fields are copied without their terminating zero when they fill the whole field
+  strncpy(header.name,name,sizeof(header.name));
+  strncpy(header.prefix,prefix,sizeof(header.prefix));
+  strncpy(header.linkname,linkname,sizeof(header.linkname));
+  snprintf(header.mode,sizeof(header.mode),"%07o",mode & 07777);
+  snprintf(header.uid,sizeof(header.uid),"%07o",0);
+  snprintf(header.gid,sizeof(header.gid),"%07o",0);
+  snprintf(header.size,sizeof(header.size),"%011llo",(unsigned long long)size);
+  // Times out of the field's 11 octal digits are clamped
+  unsigned long long seconds = mtime < 0 ? 0 : mtime > 077777777777LL ? 077777777777LL : mtime;
+  snprintf(header.mtime,sizeof(header.mtime),"%011llo",seconds & 077777777777ULL);
+  header.typeflag = type;
+  memcpy(header.magic,"ustar",6);
+  memcpy(header.version,"00",2);
+  // The checksum is computed with it's own field filled with spaces
+  memset(header.chksum,' ',sizeof(header.chksum));
+  unsigned int checksum = 0,i;
+  for (i = 0; i < sizeof(tarHeader); i++)
+    checksum += ((unsigned char*)&header)[i];
+  snprintf(header.chksum,sizeof(header.chksum),"%06o",checksum);
+  return fwrite(&header,1,sizeof(tarHeader),out) == sizeof(tarHeader);
+}
+
+// Appends a "length key=value\n" pax record, whose length counts the record's own digits,
+// to records of capacity bytes
+static void Tar_AppendPaxRecord(char *records,size_t *length,size_t capacity,const char *key,const char *value) {
+  size_t size = strlen(key) + strlen(value) + 3,digits = 1,power = 10;
+  while (size + digits >= power) {
+    digits++;
+    power *= 10;
+  }
+  *length += snprintf(records + *length,capacity - *length,"%zu %s=%s\n",size + digits,key,value);
+}
+
+int Tar_WriteMember(FILE *out,const char *name,char type,unsigned int mode,time_t mtime,const char *linkname,const char *data,uint64_t size) {
+  size_t nameLength = strlen(name),split = 0,i;
+  const char *shortName = name;
+  char prefix[156] = "";
+  if (nameLength > 100) {
+    // Split long names at a '/' so that the start goes to the prefix field and the rest to the name field
+    for (i = nameLength > 101 ? nameLength - 101 : 1; i <= 155 && i + 1 < nameLength; i++) {
+      if (name[i] == '/') {
+        split = i;
+        break;
+      }
+    }
+    if (split > 0) {
+      memcpy(prefix,name,split);
+      prefix[split] = '\0';
+      shortName = name + split + 1;
+    }
+  }
+  int longName = nameLength > 100 && split == 0,longLink = strlen(linkname) > 100;
+  if (longName || longLink) {
+    // Names that do not fit the ustar fields go to a pax extended header
+    size_t capacity = nameLength + strlen(linkname) + 2*TAR_PAX_RECORD_OVERHEAD,length = 0;
+    char *records = malloc(capacity);
+    if (records == NULL) {
+      printf("Not enough memory.\n");
+      return 0;
+    }
+    if (longName)
+      Tar_AppendPaxRecord(records,&length,capacity,"path",name);
+    if (longLink)
+      Tar_AppendPaxRecord(records,&length,capacity,"linkpath",linkname);
+    int ok = Tar_WriteHeader(out,"","PaxHeaders/member",'x',0644,mtime,"",length)
+      && fwrite(records,1,length,out) == length && Tar_WritePadding(out,length);
+    free(records);
+    if (!ok)
+      return 0;
+  }
+  if (!Tar_WriteHeader(out,prefix,shortName,type,mode,mtime,linkname,size))
+    return 0;
+  if (size > 0 && (fwrite(data,1,size,out) != size || !Tar_WritePadding(out,size)))
+    return 0;
+  return 1;
+}
+
+int Tar_WriteEnd(FILE *out) {
+  static const char zeros[2*TAR_BLOCK_SIZE];
+  return fwrite(zeros,1,sizeof(zeros),out) == sizeof(zeros);
+}
+
+// Parses an octal field, or a base-256 one (used by some writers for large values)
+static uint64_t Tar_ParseNumber(const char *field,size_t width) {
+  uint64_t value = 0;
+  size_t i = 0;
+  if ((unsigned char)field[0] & 0x80) {
+    value = (unsigned char)field[0] & 0x7F;
+    for (i = 1; i < width; i++)
+      value = (value << 8) | (unsigned char)field[i];
+    return value;
+  }
+  while (i < width && field[i] == ' ')
+    i++;
+  for (; i < width && field[i] >= '0' && field[i] <= '7'; i++)
+    value = (value << 3) | (field[i] - '0');
+  return value;
+}
+
+static int Tar_ChecksumValid(tarHeader *header) {
+  unsigned int checksum = 0,i;
+  for (i = 0; i < sizeof(tarHeader); i++) {
+    if (i >= offsetof(tarHeader,chksum) && i < offsetof(tarHeader,chksum) + sizeof(header->chksum))
+      checksum += ' ';
+    else
+      checksum += ((unsigned char*)header)[i];
+  }
+  return checksum == Tar_ParseNumber(header->chksum,sizeof(header->chksum));
+}
+
+// Copies a name of the given length, failing if it does not fit
+static int Tar_CopyName(char *destination,const char *source,size_t length) {
+  if (length >= TAR_MAX_PATH)
+    return 0;
+  memcpy(destination,source,length);
+  destination[length] = '\0';
+  return 1;
+}
+
+int Tar_ReadData(FILE *in,char *data,uint64_t size) {
+  char padding[TAR_BLOCK_SIZE];
+  size_t paddingSize = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+  return fread(data,1,size,in) == size && fread(padding,1,paddingSize,in) == paddingSize;
+}
+
+int Tar_SkipData(FILE *in,uint64_t size) {
+  char buffer[16*TAR_BLOCK_SIZE];
+  // Streams can not always seek so the data is read and dropped
+  size += (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+  while (size > 0) {
+    size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+    if (fread(buffer,1,chunk,in) != chunk)
+      return 0;
+    size -= chunk;
+  }
+  return 1;
+}
+
+int Tar_ReadMember(FILE *in,tarEntry *entry) {
+  tarHeader header;
+  int haveName = 0,haveLink = 0,haveSize = 0,haveTime = 0;
+  uint64_t paxSize = 0;
+  time_t paxTime = 0;
+  while (1) {
+    size_t bytes = fread(&header,1,sizeof(tarHeader),in);
+    // A stream that stops at a member boundary is taken as ended
+    if (bytes == 0 && !haveName && !haveLink && !haveSize && !haveTime)
+      return 0;
+    if (bytes != sizeof(tarHeader))
+      return -1;
+    unsigned int i;
+    for (i = 0; i < sizeof(tarHeader) && ((char*)&header)[i] == 0; i++);
+    if (i == sizeof(tarHeader)) {
+      // End of archive: consume the rest of the zero blocks (archives are often padded to whole records)
+      // but leave whatever follows them in the stream
+      int ch;
+      while ((ch = getc(in)) == 0);
+      if (ch != EOF)
+        ungetc(ch,in);
+      return 0;
+    }
+    if (!Tar_ChecksumValid(&header))
+      return -1;
+    uint64_t size = Tar_ParseNumber(header.size,sizeof(header.size));
+    if (header.typeflag == 'x' || header.typeflag == 'g' || header.typeflag == 'L' || header.typeflag == 'K') {
+      // Extension headers describe the member that follows them
+      char *data;
+      if (size > TAR_MAX_EXTENSION || (data = malloc(size + 1)) == NULL)
+        return -1;
+      if (!Tar_ReadData(in,data,size)) {
+        free(data);
+        return -1;
+      }
+      data[size] = '\0';
+      int ok = 1;
+      if (header.typeflag == 'L') {
+        ok = haveName = Tar_CopyName(entry->name,data,strlen(data));
+      } else if (header.typeflag == 'K') {
+        ok = haveLink = Tar_CopyName(entry->linkname,data,strlen(data));
+      } else if (header.typeflag == 'x') {
+        // Records are "length key=value\n"
+        char *record = data,*end = data + size;
+        while (ok && record < end) {
+          char *space,*equals;
+          unsigned long length = strtoul(record,&space,10);
+          if (space == record || *space != ' ' || length == 0 || length > (unsigned long)(end - record)
+            || (equals = memchr(space,'=',length - (space - record))) == NULL) {
+            ok = 0;
+            break;
+          }
+          char *value = equals + 1;
+          size_t valueLength = record + length - 1 - value;
+          if (equals - space - 1 == 4 && !strncmp(space + 1,"path",4))
+            ok = haveName = Tar_CopyName(entry->name,value,valueLength);
+          else if (equals - space - 1 == 8 && !strncmp(space + 1,"linkpath",8))
+            ok = haveLink = Tar_CopyName(entry->linkname,value,valueLength);
+          else if (equals - space - 1 == 4 && !strncmp(space + 1,"size",4))
+            paxSize = strtoull(value,NULL,10),haveSize = 1;
+          else if (equals - space - 1 == 5 && !strncmp(space + 1,"mtime",5))
+            paxTime = strtoll(value,NULL,10),haveTime = 1;
+          record += length;
+        }
+      }
+      free(data);
+      if (!ok)
+        return -1;
+      continue;
+    }
+    // Regular member
+    entry->type = header.typeflag == '\0' || header.typeflag == '7' ? TAR_FILE : header.typeflag;
+    if (!haveName) {
+      if (header.prefix[0] != '\0' && !memcmp(header.magic,"ustar",5))
+        snprintf(entry->name,TAR_MAX_PATH,"%.155s/%.100s",header.prefix,header.name);
+      else
+        snprintf(entry->name,TAR_MAX_PATH,"%.100s",header.name);
+    }
+    if (!haveLink)
+      snprintf(entry->linkname,TAR_MAX_PATH,"%.100s",header.linkname);
+    entry->size = haveSize ? paxSize : size;
+    entry->mtime = haveTime ? paxTime : (time_t)Tar_ParseNumber(header.mtime,sizeof(header.mtime));
+    return 1;
+  }
+}
+
+int Tar_SkipArchive(FILE *in) {
+  tarEntry entry;
+  int ret;
+  // Blocks that are not valid headers are dropped one at a time until the end of the archive
+  while ((ret = Tar_ReadMember(in,&entry)) != 0)
+    if (ret == 1 && !Tar_SkipData(in,entry.size))
+      return 0;
+  return 1;
+}
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../headers/textsearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXTSEARCH_X86
+#endif
+
+typedef const char *(*FindFunction)(const char*,size_t,const char*,size_t);
+
+static const char *findScalar(const char *text,size_t length,const char *needle,size_t needleLength) {
+    return memmem(text,length,needle,needleLength);
+}
+
+#ifdef TEXTSEARCH_X86
+// Candidates are the positions where both the 1st and the last byte of the needle match,
+// so only those are compared in full
+__attribute__((target("sse2")))
+static const char *findSSE2(const char *text,size_t length,const char *needle,size_t needleLength) {
+    if (needleLength == 0 || needleLength > length)
+        return findScalar(text,length,needle,needleLength);
+    const __m128i first = _mm_set1_epi8(needle[0]),last = _mm_set1_epi8(needle[needleLength - 1]);
+    size_t i;
+    // Check 16 candidates at a time
+    for (i = 0; i + needleLength - 1 + 16 <= length; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i*)(text + i + needleLength - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst,first),_mm_cmpeq_epi8(blockLast,last)));
+        while (mask) {
+            unsigned int bit = __builtin_ctz(mask);
+            if (!memcmp(text + i + bit + 1,needle + 1,needleLength - 1))
+                return text + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(text + i,length - i,needle,needleLength);
+}
+
+__attribute__((target("avx2")))
+static const char *findAVX2(const char *text,size_t length,const char *needle,size_t needleLength) {
+    if (needleLength == 0 || needleLength > length)
+        return findScalar(text,length,needle,needleLength);
+    const __m256i first = _mm256_set1_epi8(needle[0]),last = _mm256_set1_epi8(needle[needleLength - 1]);
+    size_t i;
+    // Check 32 candidates at a time
+    for (i = 0; i + needleLength - 1 + 32 <= length; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i*)(text + i + needleLength - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(blockFirst,first),_mm256_cmpeq_epi8(blockLast,last)));
+        while (mask) {
+            unsigned int bit = __builtin_ctz(mask);
+            if (!memcmp(text + i + bit + 1,needle + 1,needleLength - 1))
+                return text + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return findSSE2(text + i,length - i,needle,needleLength);
+}
+#endif
+
+// Kernel used by TextSearch_Find, picked once since the 1st calls may come from several threads at a time
+static FindFunction find = findScalar;
+static pthread_once_t findOnce = PTHREAD_ONCE_INIT;
+
+// Picks the widest kernel supported by the running cpu
+static void selectFind() {
+#ifdef TEXTSEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        find = findAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        find = findSSE2;
+#endif
+}
+
+const char *TextSearch_Find(const char *text,size_t length,const char *needle,size_t needleLength) {
+    pthread_once(&findOnce,selectFind);
+    return find(text,length,needle,needleLength);
+}